@@ -0,0 +1,148 @@
+#ifndef INC_BLOCK_DEVICE_H_
+#define INC_BLOCK_DEVICE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Sector size used commonly for SD card and FAT filesystem. Most new
+ * cards will use 512 as sector size and FAT32 also supports it
+ */
+#define SECTOR_SIZE	(512)
+
+/**
+ * Return codes to expect from block device operations
+ */
+typedef enum {
+	BLOCK_DEVICE_OK,                /**< BLOCK_DEVICE_OK */
+	BLOCK_DEVICE_READ_ERR,          /**< BLOCK_DEVICE_READ_ERR */
+	BLOCK_DEVICE_OUT_OF_RANGE,      /**< BLOCK_DEVICE_OUT_OF_RANGE */
+	BLOCK_DEVICE_ASYNC_UNSUPPORTED, /**< BLOCK_DEVICE_ASYNC_UNSUPPORTED */
+	BLOCK_DEVICE_BUSY,              /**< BLOCK_DEVICE_BUSY */
+} Block_Device_Status;
+
+/**
+ * Function to call when an asynchronous read of blocks finishes
+ *
+ * @param status	(IN)	Status of the read operation
+ * @param cb_ctx	(IN)	Context pointer provided when the read was submitted
+ */
+typedef void (*Block_Device_Read_Callback)(const Block_Device_Status status,
+	void *cb_ctx);
+
+/**
+ * Storage holding fixed size blocks of SECTOR_SIZE bytes. Filesystem code only
+ * talks to this interface, so that it can run on top of SD card on target and
+ * on top of a disk image on a development host
+ */
+typedef struct {
+	// Read count consecutive blocks starting from lba into buffer, which should
+	// be at least count * SECTOR_SIZE in size
+	Block_Device_Status (*read_blocks)(void *ctx, const uint32_t lba,
+		const uint32_t count, uint8_t *restrict const buffer);
+	// Start reading blocks and return right away. cb is called once the data
+	// is in buffer. NULL if the device only supports synchronous reads
+	Block_Device_Status (*read_blocks_async)(void *ctx, const uint32_t lba,
+		const uint32_t count, uint8_t *restrict const buffer,
+		Block_Device_Read_Callback cb, void *cb_ctx);
+	// Sleep until *done becomes non-zero, which is set from the callback of an
+	// asynchronous read. NULL if asynchronous reads complete before returning
+	void (*wait_for_completion)(void *ctx, volatile const uint8_t *done);
+	// Number of blocks available on the device
+	uint32_t (*get_block_count)(void *ctx);
+	// Note that blocks from lba up to end_lba are about to be read in order,
+	// and the ones from end_lba on are not, so that they are not read ahead.
+	// NULL if the device does not read ahead
+	void (*hint_sequential_read)(void *ctx, const uint32_t lba,
+		const uint32_t end_lba);
+	// Implementation specific state passed to all the functions above
+	void *ctx;
+} Block_Device;
+
+/**
+ * Read consecutive blocks from a block device
+ *
+ * @param dev		(IN)	Block device to read from
+ * @param lba		(IN)	Address of the first block to read
+ * @param count		(IN)	Number of consecutive blocks to read
+ * @param buffer	(OUT)	Buffer to read the blocks into. It should be at least
+ * 							count * SECTOR_SIZE in size
+ *
+ * @return	Status of the read operation
+ */
+static inline Block_Device_Status Block_Device_Read_Blocks(
+	const Block_Device *restrict const dev, const uint32_t lba,
+	const uint32_t count, uint8_t *restrict const buffer) {
+	return dev->read_blocks(dev->ctx, lba, count, buffer);
+}
+
+/**
+ * Start reading consecutive blocks from a block device without waiting for the
+ * data to arrive
+ *
+ * @param dev		(IN)	Block device to read from
+ * @param lba		(IN)	Address of the first block to read
+ * @param count		(IN)	Number of consecutive blocks to read
+ * @param buffer	(OUT)	Buffer to read the blocks into. It should be at least
+ * 							count * SECTOR_SIZE in size and stay valid until cb
+ * 							is called
+ * @param cb		(IN)	Function to call when the read finishes
+ * @param cb_ctx	(IN)	Context pointer to pass to cb
+ *
+ * @return	Status of submitting the read operation
+ */
+static inline Block_Device_Status Block_Device_Read_Blocks_Async(
+	const Block_Device *restrict const dev, const uint32_t lba,
+	const uint32_t count, uint8_t *restrict const buffer,
+	Block_Device_Read_Callback cb, void *cb_ctx) {
+	if (dev->read_blocks_async == NULL) {
+		return BLOCK_DEVICE_ASYNC_UNSUPPORTED;
+	}
+	return dev->read_blocks_async(dev->ctx, lba, count, buffer, cb, cb_ctx);
+}
+
+/**
+ * Wait for an asynchronous read to finish. The read's callback is expected to
+ * set the flag
+ *
+ * @param dev	(IN)	Block device the read was submitted to
+ * @param done	(IN)	Flag which becomes non-zero when the read finishes
+ */
+static inline void Block_Device_Wait_For_Completion(
+	const Block_Device *restrict const dev, volatile const uint8_t *done) {
+	if (dev->wait_for_completion != NULL) {
+		dev->wait_for_completion(dev->ctx, done);
+	}
+	while (*done == 0) {
+	}
+}
+
+/**
+ * Get the number of blocks available on a block device
+ *
+ * @param dev	(IN)	Block device to query
+ *
+ * @return	Number of blocks on the device
+ */
+static inline uint32_t Block_Device_Get_Block_Count(
+	const Block_Device *restrict const dev) {
+	return dev->get_block_count(dev->ctx);
+}
+
+/**
+ * Tell a block device which blocks are about to be read in order, so that it
+ * does not read ahead past them. Devices which do not read ahead ignore it
+ *
+ * @param dev		(IN)	Block device to read from
+ * @param lba		(IN)	Address of the first block of the sequential reads
+ * @param end_lba	(IN)	Address of the first block after them
+ */
+static inline void Block_Device_Hint_Sequential_Read(
+	const Block_Device *restrict const dev, const uint32_t lba,
+	const uint32_t end_lba) {
+	if (dev->hint_sequential_read != NULL) {
+		dev->hint_sequential_read(dev->ctx, lba, end_lba);
+	}
+}
+
+#endif /* INC_BLOCK_DEVICE_H_ */
@@ -1,6 +1,7 @@
 #ifndef INC_EPD_H_
 #define INC_EPD_H_
 
+#include <stdint.h>
 #include "data_processing.h"
 
 /*
@@ -16,6 +17,11 @@
 #define EPD_WIDTH			(EPD_WIDTH_PIXELS/2)
 #define EPD_HEIGHT			(EPD_HEIGHT_PIXELS)
 
+/*
+ * Size of each of the 2 buffers frame data is copied into when sending it with
+ * DMA. One buffer is filled while DMA sends the other one to the display
+ */
+#define EPD_DMA_BUFFER_SIZE	(2 * 1024)
 
 /**
  * Colors supported by E-paper display
@@ -44,8 +50,52 @@ typedef enum {
 	EPD_REFRESH_DISPLAY_ERR,   /**< EPD_REFRESH_DISPLAY_ERR */
 	EPD_SLEEP_DATA_SEND_ERR,   /**< EPD_SLEEP_DATA_SEND_ERR */
 	EPD_DEINIT_IO_DEINIT_ERR,  /**<EPD_DEINIT_IO_DEINIT_ERR */
+	EPD_BANDS_SIZE_ERR,        /**< EPD_BANDS_SIZE_ERR */
 } EPD_Status;
 
+/**
+ * Band of full-width rows filled with one color
+ */
+typedef struct {
+	EPD_Color_t color;
+	uint16_t rows;
+} EPD_Color_Band;
+
+/**
+ * Ways to send frame data to E-paper display
+ */
+typedef enum {
+	EPD_TRANSFER_MODE_BLOCKING,	/**< CPU sends each burst of data over SPI */
+	EPD_TRANSFER_MODE_DMA,		/**< DMA sends data while CPU produces more */
+	EPD_TRANSFER_MODE_COUNT,	/**< Number of transfer modes */
+} EPD_Transfer_Mode;
+
+/**
+ * Cost of sending the last frame of image data to E-paper display
+ */
+typedef struct {
+	uint32_t frames;			// Frames sent since initialization
+	uint32_t bytes;				// Data bytes sent in the last frame
+	uint32_t bursts;			// Bursts the last frame was sent in
+	uint32_t transfer_time_us;	// Time spent sending the last frame's data
+	uint32_t wall_time_us;		// Time from start of the last frame until all
+								// its data was sent, including time spent
+								// producing the data
+	uint32_t dma_wait_time_us;	// Time the core slept waiting for DMA to
+								// free a buffer or finish the frame
+} EPD_Transfer_Stats;
+
+/**
+ * Cost of waiting for the last display refresh, while BUSY line was low
+ */
+typedef struct {
+	uint32_t refreshes;			// Refreshes since initialization
+	uint32_t busy_time_ms;		// Time display was busy during the last refresh
+	uint32_t active_time_us;	// Time MCU was running during the last refresh,
+								// instead of sleeping in Stop mode
+	uint32_t stop_entries;		// Times MCU entered Stop mode during the last
+								// refresh
+} EPD_Refresh_Stats;
 
 /**
  * Initialize the E-paper display
@@ -63,6 +113,19 @@ EPD_Status EPD_Init(void);
  */
 EPD_Status EPD_Display_Clear(const EPD_Color_t color);
 
+/**
+ * Fill the display with bands of solid color from top to bottom, like black
+ * letterbox bands above and below a white area
+ *
+ * @param bands			(IN)	Bands to fill the display with, starting from the top
+ * @param band_count	(IN)	Number of bands. Rows of all the bands should add
+ * 								up to EPD_HEIGHT
+ *
+ * @return	Status of operation to display the bands
+ */
+EPD_Status EPD_Display_Color_Bands(const EPD_Color_Band *restrict const bands,
+	const uint8_t band_count);
+
 /**
  * Display an image on the full E-paper display screen
  *
@@ -100,6 +163,28 @@ DataProcessingStatus EPD_Display_Image_Callback(
  */
 EPD_Status EPD_Put_To_Sleep(void);
 
+/**
+ * Select how frame data is sent to E-paper display. DMA mode is used by
+ * default. Takes effect from the next frame
+ *
+ * @param mode	(IN)	Transfer mode to use for subsequent frames
+ */
+void EPD_Set_Transfer_Mode(const EPD_Transfer_Mode mode);
+
+/**
+ * Get the cost of sending the last frame of image data
+ *
+ * @param stats	(OUT)	Variable to store the stats in
+ */
+void EPD_Get_Transfer_Stats(EPD_Transfer_Stats *restrict const stats);
+
+/**
+ * Get the cost of waiting for the last display refresh
+ *
+ * @param stats	(OUT)	Variable to store the stats in
+ */
+void EPD_Get_Refresh_Stats(EPD_Refresh_Stats *restrict const stats);
+
 /**
  * De-initialize E-paper display
  *
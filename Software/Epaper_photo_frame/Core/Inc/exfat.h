@@ -0,0 +1,80 @@
+#ifndef INC_EXFAT_H_
+#define INC_EXFAT_H_
+
+#include <stdint.h>
+#include "data_processing.h"
+#include "block_device.h"
+
+/**
+ * Return codes to expect when using exFAT APIs
+ */
+typedef enum {
+	EXFAT_OK,                                   /**< EXFAT_OK */
+	EXFAT_INIT_PARTITION_DISCOVERY_ERR,         /**< EXFAT_INIT_PARTITION_DISCOVERY_ERR */
+	EXFAT_INIT_PARTITION_READ_ERR,              /**< EXFAT_INIT_PARTITION_READ_ERR */
+	EXFAT_INIT_INVALID_BOOT_SECTOR,             /**< EXFAT_INIT_INVALID_BOOT_SECTOR */
+	EXFAT_INIT_UNSUPPORTED_SECTOR_SIZE,         /**< EXFAT_INIT_UNSUPPORTED_SECTOR_SIZE */
+	EXFAT_INIT_UNSUPPORTED_SECTORS_PER_CLUSTER, /**< EXFAT_INIT_UNSUPPORTED_SECTORS_PER_CLUSTER */
+	EXFAT_READ_FILE_NOT_FOUND,                  /**< EXFAT_READ_FILE_NOT_FOUND */
+	EXFAT_READ_FILE_TOO_LARGE,                  /**< EXFAT_READ_FILE_TOO_LARGE */
+	EXFAT_READ_DIR_ERR,                         /**< EXFAT_READ_DIR_ERR */
+	EXFAT_READ_FILE_ERR,                        /**< EXFAT_READ_FILE_ERR */
+	EXFAT_READ_FAT_READ_ERR,                    /**< EXFAT_READ_FAT_READ_ERR */
+	EXFAT_READ_FILE_DATA_PROCESS_ERR,           /**< EXFAT_READ_FILE_DATA_PROCESS_ERR */
+	EXFAT_READ_BUFFER_TOO_SMALL,                /**< EXFAT_READ_BUFFER_TOO_SMALL */
+} EXFAT_Status;
+
+/**
+ * Counters for file data reads
+ */
+typedef struct {
+	uint32_t files;				// Files read
+	uint32_t contiguous_files;	// Files read without looking at FAT
+	uint32_t extents;			// Runs of physically contiguous clusters read
+	uint32_t fat_reads;			// FAT sectors read to follow cluster chains
+} EXFAT_Read_Stats;
+
+/**
+ * Initialize internal data structures for reading an exFAT volume. The volume
+ * is found in the lowest exFAT partition of the MBR, or at the start of the
+ * device if it has no partition table
+ *
+ * @param dev	(IN)	Block device holding the filesystem. It is used for all
+ * 						subsequent exFAT operations
+ *
+ * @return Status for exFAT initialization operation
+ */
+EXFAT_Status EXFAT_Init(const Block_Device *restrict const dev);
+
+/**
+ * Read data from a file from root directory and call the data processing
+ * callback function with each block of partial data read from the file into
+ * user provided buffer. Files marked as contiguous in their directory entry
+ * are read without looking at FAT. Filenames are compared without case for
+ * ASCII characters only
+ *
+ * @param filename		(IN)	Name of the file to read the data from inside the
+ * 								root directory
+ * @param buffer		(OUT)	Buffer to read the partial data into
+ * @param buffer_size	(IN)	Size of the buffer. Should be large enough to
+ * 								support at least 1 sector worth of data
+ * @param cb			(IN)	Function to call to process each block of partial
+ * 								data read from the file
+ *
+ * @return	Status for finding, reading and processing each block of data from
+ * 			the file corresponding to the provided filename
+ */
+EXFAT_Status EXFAT_Read_File_From_Root_Dir_And_Process_Data(
+	const char *restrict const filename,
+	uint8_t *restrict const buffer,
+	const uint32_t buffer_size,
+	DataBufferProcessingCallback cb);
+
+/**
+ * Get the counters for file data reads
+ *
+ * @param stats	(OUT)	Variable to store the counters in
+ */
+void EXFAT_Get_Read_Stats(EXFAT_Read_Stats *restrict const stats);
+
+#endif /* INC_EXFAT_H_ */
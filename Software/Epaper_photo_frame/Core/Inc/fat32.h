@@ -3,12 +3,7 @@
 
 #include <stdint.h>
 #include "data_processing.h"
-
-/*
- * The current implementation only supports 1024 sized clusters. Since
- * SECTOR_SIZE is 512, this has the value 2
- */
-#define SECTORS_PER_CLUSTER	(2)
+#include "block_device.h"
 
 /**
  * Return codes to expect when using FAT32 APIs
@@ -26,26 +21,196 @@ typedef enum {
 	FAT32_READ_FILE_ERR,                        /**< FAT32_READ_FILE_ERR */
 	FAT32_READ_FAT_READ_ERR,                    /**< FAT32_READ_FAT_READ_ERR */
 	FAT32_READ_FILE_DATA_PROCESS_ERR,           /**< FAT32_READ_FILE_DATA_PROCESS_ERR */
+	FAT32_READ_BUFFER_TOO_SMALL,                /**< FAT32_READ_BUFFER_TOO_SMALL */
+	FAT32_INIT_VOLUME_MISMATCH,                 /**< FAT32_INIT_VOLUME_MISMATCH */
+	FAT32_READ_PATH_TOO_LONG,                   /**< FAT32_READ_PATH_TOO_LONG */
+	FAT32_FILE_NOT_OPEN,                        /**< FAT32_FILE_NOT_OPEN */
+	FAT32_FILE_SEEK_OUT_OF_RANGE,               /**< FAT32_FILE_SEEK_OUT_OF_RANGE */
+	FAT32_INIT_LOCATION_STALE,                  /**< FAT32_INIT_LOCATION_STALE */
 } FAT32_Status;
 
+/*
+ * Number of extents recorded in a file location. Sized so that a location
+ * fits in the spare RTC backup registers. Extents past these are found from
+ * FAT while reading the file
+ */
+#define FAT32_LOCATION_MAX_EXTENTS	(10)
+
+/*
+ * File attribute values from https://wiki.osdev.org/FAT32#Standard_8.3_format
+ */
+#define FAT32_FILE_ATTR_RD_ONLY         (1 << 0)
+#define FAT32_FILE_ATTR_HIDDEN          (1 << 1)
+#define FAT32_FILE_ATTR_SYSTEM          (1 << 2)
+#define FAT32_FILE_ATTR_VOL_ID          (1 << 3)
+#define FAT32_FILE_ATTR_DIR             (1 << 4)
+#define FAT32_FILE_ATTR_ARCHIVE         (1 << 5)
+#define FAT32_FILE_ATTR_LONG_FILENAME   (0xF)
+
+// 8.3 filename with the '.' and the NULL byte
+#define FAT32_DIR_ENTRY_NAME_LENGTH	(13)
+
+/*
+ * Number of images named by their number (0.bin, 1.bin, ...) indexed from the
+ * root directory, so that looking them up does not scan the directory. Each
+ * entry takes 20 bytes of RAM. If the directory has more images, the ones with
+ * the larger numbers are found by scanning the directory
+ */
+#define FAT32_IMAGE_INDEX_ENTRIES	(256)
+
+/*
+ * Number of directories resolved from paths which are cached, and the longest
+ * directory path which can be cached. Each entry takes FAT32_PATH_MAX_LENGTH +
+ * 20 bytes of RAM
+ */
+#define FAT32_DIR_CACHE_ENTRIES	(4)
+#define FAT32_PATH_MAX_LENGTH	(64)
+
+/*
+ * Number of cluster chain checkpoints kept in a file handle. Checkpoints are
+ * spread evenly over the file, so that seeking follows at most
+ * (file clusters / FAT32_FILE_CHECKPOINTS) FAT entries from the closest one
+ */
+#define FAT32_FILE_CHECKPOINTS	(16)
+
+/**
+ * Open file which can be read from any offset. Fields are managed by the
+ * FAT32_File_* functions and should only be read by the caller
+ */
+typedef struct {
+	uint8_t is_open;
+	uint32_t file_size;
+	uint32_t position;				// Offset of the next byte to read
+	uint32_t cluster_index;			// Index of current cluster in the chain
+	uint32_t current_cluster;
+	uint32_t checkpoint_interval;	// Clusters between checkpoints
+	uint32_t checkpoint_count;		// Checkpoints found so far
+	uint32_t checkpoints[FAT32_FILE_CHECKPOINTS];	// Every interval'th cluster
+} FAT32_File;
+
+/**
+ * Run of physically contiguous clusters holding file data
+ */
+typedef struct {
+	uint32_t first_cluster;
+	uint32_t clusters;
+} FAT32_Extent;
+
+/**
+ * Where a file's data lives on a volume, so that it can be read later without
+ * mounting the filesystem or scanning the directory again. Made only of 32-bit
+ * words, so that it can be stored word by word
+ */
+typedef struct {
+	uint32_t partition_lba;	// LBA of the partition's BPB
+	uint32_t volume_id;		// Volume ID from the BPB when the file was found
+	uint32_t dir_entry_lba;		// LBA of the directory sector with the file's entry
+	uint32_t dir_entry_index;	// Index of the file's entry in that sector
+	uint32_t file_size;
+	uint32_t extent_count;
+	FAT32_Extent extents[FAT32_LOCATION_MAX_EXTENTS];
+} FAT32_File_Location;
+
+/**
+ * Counters for lookups of the cluster chain in cached FAT sectors
+ */
+typedef struct {
+	uint32_t hits;		// Lookups served from a cached FAT sector
+	uint32_t misses;	// Lookups which had to read a FAT sector
+} FAT32_Cache_Stats;
+
+/**
+ * Counters for file data reads
+ */
+typedef struct {
+	uint32_t files;		// Files read
+	uint32_t extents;	// Runs of physically contiguous clusters in the files
+	uint32_t clusters;	// Clusters of file data read
+	uint32_t contiguous_files;	// Files streamed without following the chain
+} FAT32_Read_Stats;
+
+/**
+ * File found while enumerating a directory
+ */
+typedef struct {
+	char filename[FAT32_DIR_ENTRY_NAME_LENGTH];	// 8.3 name, like "1.BIN"
+	uint8_t attributes;							// FAT32_FILE_ATTR_* bits
+	uint32_t first_cluster;
+	uint32_t file_size;
+} FAT32_Dir_Entry;
+
+/**
+ * Values to return from directory enumeration callback
+ */
+typedef enum {
+	FAT32_ENUMERATE_CONTINUE,/**< FAT32_ENUMERATE_CONTINUE */
+	FAT32_ENUMERATE_STOP,    /**< FAT32_ENUMERATE_STOP */
+} FAT32_Enumerate_Action;
+
+/**
+ * Function to call with each file found while enumerating a directory
+ *
+ * @param entry	(IN)	File found in the directory. Only valid during the call
+ * @param ctx	(IN)	Context pointer provided for the enumeration
+ *
+ * @return	Whether to continue with the next file or stop the enumeration
+ */
+typedef FAT32_Enumerate_Action (*FAT32_Dir_Entry_Callback)(
+	const FAT32_Dir_Entry *restrict const entry, void *ctx);
+
+/**
+ * Counters for looking up files in directories
+ */
+typedef struct {
+	uint32_t entries;			// Images in the root directory index
+	uint32_t hits;				// Lookups served from the index
+	uint32_t dir_scans;			// Scans of a directory
+	uint32_t dir_cache_hits;	// Directories in paths found in the cache
+	uint32_t dir_cache_misses;	// Directories in paths which were scanned for
+} FAT32_Index_Stats;
+
 /**
  * Initialize internal data structures for using FAT32 filesystem
  *
+ * @param dev	(IN)	Block device holding the filesystem. It is used for all
+ * 						subsequent FAT32 operations
+ *
+ * @return Status for FAT32 initialization operation
+ */
+FAT32_Status FAT32_Init(const Block_Device *restrict const dev);
+
+/**
+ * Initialize internal data structures for using FAT32 filesystem from a
+ * previously resolved file location. Only the partition's BPB and the sector
+ * with the file's directory entry are read. Volume ID has to match the one in
+ * the location, and the directory entry has to still have the first cluster
+ * and size recorded in the location. Files whose data was rewritten in place
+ * without changing either are not detected
+ *
+ * @param dev		(IN)	Block device holding the filesystem. It is used for
+ * 							all subsequent FAT32 operations
+ * @param location	(IN)	File location resolved by
+ * 							FAT32_Locate_File_In_Root_Dir
+ *
  * @return Status for FAT32 initialization operation
  */
-FAT32_Status FAT32_Init(void);
+FAT32_Status FAT32_Init_From_Location(const Block_Device *restrict const dev,
+	const FAT32_File_Location *restrict const location);
 
 /**
  * Read data from a file from root directory and call the data processing
  * callback function with each block of partial data read from the file into
- * user provided buffer
+ * user provided buffer. Physically contiguous clusters are merged into
+ * extents, and each extent is streamed with reads as large as the buffer
+ * allows, independent of the cluster size
  *
- * @param filename	(IN)	Name of the file to read the data from inside the
- * 							root directory
- * @param buffer	(OUT)	Buffer to read the partial data into. Should be large
- * 							enough to support 1 cluster worth of data
- * @param cb		(IN)	Function to call to process each block of partial
- * 							data read from the file
+ * @param filename		(IN)	Name of the file to read the data from inside the
+ * 								root directory
+ * @param buffer		(OUT)	Buffer to read the partial data into
+ * @param buffer_size	(IN)	Size of the buffer. Should be large enough to
+ * 								support at least 1 sector worth of data
+ * @param cb			(IN)	Function to call to process each block of partial
+ * 								data read from the file
  *
  * @return	Status for finding, reading and processing each block of data from
  * 			the file corresponding to the provided filename
@@ -53,6 +218,155 @@ FAT32_Status FAT32_Init(void);
 FAT32_Status FAT32_Read_File_From_Root_Dir_And_Process_Data(
 	const char *restrict const filename,
 	uint8_t *restrict const buffer,
+	const uint32_t buffer_size,
 	DataBufferProcessingCallback cb);
 
+/**
+ * Find a file in root directory and record where its data lives
+ *
+ * @param filename	(IN)	Name of the file to find inside the root directory
+ * @param location	(OUT)	Variable to store the file's location in
+ *
+ * @return	Status for finding the file and following its cluster chain
+ */
+FAT32_Status FAT32_Locate_File_In_Root_Dir(const char *restrict const filename,
+	FAT32_File_Location *restrict const location);
+
+/**
+ * Read data from a file at a path and call the data processing callback
+ * function with each block of partial data read from the file into user
+ * provided buffer. Directories in the path are separated by '/' and have to
+ * have 8.3 names. Resolved directories are cached, so that repeated lookups in
+ * the same directory do not scan its parent directories again
+ *
+ * @param path			(IN)	Path of the file to read the data from, like
+ * 								"albums/summer/3.bin"
+ * @param buffer		(OUT)	Buffer to read the partial data into
+ * @param buffer_size	(IN)	Size of the buffer. Should be large enough to
+ * 								support at least 1 sector worth of data
+ * @param cb			(IN)	Function to call to process each block of partial
+ * 								data read from the file
+ *
+ * @return	Status for finding, reading and processing each block of data from
+ * 			the file at the provided path
+ */
+FAT32_Status FAT32_Read_File_At_Path_And_Process_Data(
+	const char *restrict const path,
+	uint8_t *restrict const buffer,
+	const uint32_t buffer_size,
+	DataBufferProcessingCallback cb);
+
+/**
+ * Find a file at a path and record where its data lives
+ *
+ * @param path		(IN)	Path of the file, like "albums/summer/3.bin"
+ * @param location	(OUT)	Variable to store the file's location in
+ *
+ * @return	Status for finding the file and following its cluster chain
+ */
+FAT32_Status FAT32_Locate_File_At_Path(const char *restrict const path,
+	FAT32_File_Location *restrict const location);
+
+/**
+ * Open a file for reading from arbitrary offsets
+ *
+ * @param path	(IN)	Path of the file, like "albums/summer/3.bin"
+ * @param file	(OUT)	File handle to initialize
+ *
+ * @return	Status for finding the file
+ */
+FAT32_Status FAT32_File_Open(const char *restrict const path,
+	FAT32_File *restrict const file);
+
+/**
+ * Move the read position of an open file. The cluster chain is followed on
+ * the next read, starting from the closest checkpoint or the current cluster
+ *
+ * @param file		(IN/OUT)	Open file handle
+ * @param offset	(IN)		Offset from the start of the file. Can be at most
+ * 								the file size
+ *
+ * @return	Status for moving the read position
+ */
+FAT32_Status FAT32_File_Seek(FAT32_File *restrict const file,
+	const uint32_t offset);
+
+/**
+ * Read data from the read position of an open file and move the position past
+ * it. Whole sectors are read straight into the buffer, and partial sectors at
+ * either end go through an internal sector buffer
+ *
+ * @param file			(IN/OUT)	Open file handle
+ * @param buffer		(OUT)		Buffer to read the data into
+ * @param size			(IN)		Number of bytes to read
+ * @param bytes_read	(OUT)		Variable to store the number of bytes read
+ * 									in. Less than size at the end of the file
+ *
+ * @return	Status for reading the data
+ */
+FAT32_Status FAT32_File_Read(FAT32_File *restrict const file,
+	uint8_t *restrict const buffer, const uint32_t size,
+	uint32_t *restrict const bytes_read);
+
+/**
+ * Close a file handle
+ *
+ * @param file	(IN/OUT)	File handle to close
+ */
+void FAT32_File_Close(FAT32_File *restrict const file);
+
+/**
+ * Read data from a file at a previously resolved location and call the data
+ * processing callback function with each block of partial data read from the
+ * file into user provided buffer
+ *
+ * @param location		(IN)	Location of the file to read
+ * @param buffer		(OUT)	Buffer to read the partial data into
+ * @param buffer_size	(IN)	Size of the buffer. Should be large enough to
+ * 								support at least 1 sector worth of data
+ * @param cb			(IN)	Function to call to process each block of partial
+ * 								data read from the file
+ *
+ * @return	Status for reading and processing each block of data from the file
+ */
+FAT32_Status FAT32_Read_File_At_Location(
+	const FAT32_File_Location *restrict const location,
+	uint8_t *restrict const buffer,
+	const uint32_t buffer_size,
+	DataBufferProcessingCallback cb);
+
+/**
+ * Call the callback with each file in the root directory, in directory order,
+ * with one scan of the directory. Deleted entries, long filename entries,
+ * volume ID, system files and directories are skipped. If the image index is
+ * not built yet, it is built by the same scan
+ *
+ * @param cb	(IN)	Function to call with each file
+ * @param ctx	(IN)	Context pointer to pass to cb
+ *
+ * @return	Status of reading the directory
+ */
+FAT32_Status FAT32_Enumerate_Root_Dir(FAT32_Dir_Entry_Callback cb, void *ctx);
+
+/**
+ * Get the counters for lookups of the cluster chain in cached FAT sectors
+ *
+ * @param stats	(OUT)	Variable to store the counters in
+ */
+void FAT32_Get_Cache_Stats(FAT32_Cache_Stats *restrict const stats);
+
+/**
+ * Get the counters for file data reads
+ *
+ * @param stats	(OUT)	Variable to store the counters in
+ */
+void FAT32_Get_Read_Stats(FAT32_Read_Stats *restrict const stats);
+
+/**
+ * Get the counters for looking up files in the root directory
+ *
+ * @param stats	(OUT)	Variable to store the counters in
+ */
+void FAT32_Get_Index_Stats(FAT32_Index_Stats *restrict const stats);
+
 #endif /* INC_FAT32_H_ */
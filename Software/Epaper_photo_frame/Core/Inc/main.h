@@ -10,6 +10,20 @@
 // keeps track of the filenames when the MCU goes to sleep mode
 #define FILENAME_COUNTER_BKUP_REG	(0)
 
+// SPI clock rate proven to work with the inserted SD card, so that later wakes
+// do not need to probe for it again
+#define SDC_CLOCK_CALIBRATION_BKUP_REG	(1)
+
+// Location of the next image on the SD card, resolved before going to sleep so
+// that the next wake can skip mounting the filesystem. Takes a checksum word,
+// the filename counter it belongs to and the location itself, in this and the
+// following backup registers
+#define NEXT_FILE_LOCATION_BKUP_REG	(2)
+
+// Policy for clearing the E-paper display before showing an image, and the
+// number of images shown since the last clear in the following backup register
+#define REFRESH_POLICY_BKUP_REG	(30)
+
 // uint32_t can store 2**32-1 = 4294967295
 // So the largest filename can be 4294967295.bin, which leads to 15 bytes
 // including the NULL byte
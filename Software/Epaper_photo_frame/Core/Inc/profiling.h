@@ -0,0 +1,36 @@
+#ifndef INC_PROFILING_H_
+#define INC_PROFILING_H_
+
+#include <stdint.h>
+
+/**
+ * Enable the DWT cycle counter used to measure how long the core is running
+ */
+void Profiling_Init(void);
+
+/**
+ * Read the DWT cycle counter. The counter only advances while the core clock
+ * is running, so time spent in WFI is not included
+ *
+ * @return	Current value of the free running cycle counter
+ */
+uint32_t Profiling_Get_Cycles(void);
+
+/**
+ * Read a microsecond timestamp derived from the HAL tick and SysTick counter.
+ * Unlike the cycle counter, this keeps advancing while the core sleeps in WFI
+ *
+ * @return	Number of microseconds since HAL tick was started
+ */
+uint32_t Profiling_Get_Time_Us(void);
+
+/**
+ * Convert cycles counted at current core clock to microseconds
+ *
+ * @param cycles	(IN)	Number of core clock cycles
+ *
+ * @return	Number of microseconds corresponding to the cycles
+ */
+uint32_t Profiling_Cycles_To_Us(const uint32_t cycles);
+
+#endif /* INC_PROFILING_H_ */
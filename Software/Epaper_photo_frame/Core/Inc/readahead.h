@@ -0,0 +1,52 @@
+#ifndef INC_READAHEAD_H_
+#define INC_READAHEAD_H_
+
+#include <stdint.h>
+#include "block_device.h"
+
+/*
+ * RAM set aside for sectors read ahead of the caller, and number of runs of
+ * sectors kept in flight. A run has the size of the sequential reads being
+ * served (1 extent of FAT32 file data), and can be at most
+ * READAHEAD_RAM_BUDGET / READAHEAD_DEPTH bytes long. Longer reads are passed
+ * through to the underlying device
+ */
+#define READAHEAD_RAM_BUDGET	(16 * 1024)
+#define READAHEAD_DEPTH			(2)
+
+/**
+ * Counters for reads served by the read-ahead layer
+ */
+typedef struct {
+	uint32_t hits;				// Reads served from sectors read ahead
+	uint32_t misses;			// Reads sent to the underlying device
+	uint32_t prefetched_blocks;	// Sectors requested ahead of the caller
+	uint32_t wasted_blocks;		// Sectors read ahead but never used
+} Readahead_Stats;
+
+/**
+ * Wrap a block device with a layer which detects sequential reads and starts
+ * reading the following runs of sectors asynchronously, while the caller is
+ * still processing the current one. Underlying device should support
+ * asynchronous reads, otherwise reads are passed through
+ *
+ * @param dev	(IN)	Block device to read from
+ *
+ * @return	Block device serving reads through the read-ahead layer
+ */
+const Block_Device* Readahead_Init(const Block_Device *restrict const dev);
+
+/**
+ * Wait for reads started ahead of the caller and drop their data, so that the
+ * underlying device is idle
+ */
+void Readahead_Flush(void);
+
+/**
+ * Get the counters for reads served by the read-ahead layer
+ *
+ * @param stats	(OUT)	Variable to store the counters in
+ */
+void Readahead_Get_Stats(Readahead_Stats *restrict const stats);
+
+#endif /* INC_READAHEAD_H_ */
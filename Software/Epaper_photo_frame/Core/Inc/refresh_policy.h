@@ -0,0 +1,68 @@
+#ifndef INC_REFRESH_POLICY_H_
+#define INC_REFRESH_POLICY_H_
+
+#include <stdint.h>
+#include "main.h"
+
+/**
+ * When to clear the E-paper display to white before showing the next image.
+ * Clearing takes a full refresh of its own, doubling the time the display is
+ * busy and the energy spent per wake
+ */
+typedef enum {
+	REFRESH_POLICY_NEVER_CLEAR,					/**< Only show images */
+	REFRESH_POLICY_CLEAR_EVERY_N_IMAGES,		/**< Clear before every interval'th image */
+	REFRESH_POLICY_CLEAR_AFTER_POWER_LOSS,		/**< Clear on the first wake after power up */
+	REFRESH_POLICY_CLEAR_ON_GHOSTING_SCHEDULE,	/**< Clear after power up, and once
+													 images have been shown for
+													 interval hours since the
+													 last clear */
+	REFRESH_POLICY_COUNT,						/**< Number of refresh policies */
+} Refresh_Policy;
+
+/*
+ * Policy used until another one is set, and its interval in images or hours
+ * (1 to 255). Changing either replaces any stored policy on the next boot
+ */
+#define REFRESH_POLICY_DEFAULT			(REFRESH_POLICY_CLEAR_ON_GHOSTING_SCHEDULE)
+#define REFRESH_POLICY_DEFAULT_INTERVAL	(24)
+
+/**
+ * Load the refresh policy and the number of images shown since the last clear
+ * from RTC backup registers. Default policy is used if the registers do not
+ * hold a valid policy
+ *
+ * @param is_boot_from_lpm	(IN)	TRUE if MCU is booting up from low-power
+ * 									mode, FALSE after power loss or reset
+ */
+void Refresh_Policy_Init(const Boolean is_boot_from_lpm);
+
+/**
+ * Select the refresh policy. It is stored in RTC backup registers so that it
+ * stays in effect across wakes from low-power mode, until power is lost or the
+ * firmware is updated with different defaults
+ *
+ * @param policy	(IN)	Refresh policy to use
+ * @param interval	(IN)	Number of images for REFRESH_POLICY_CLEAR_EVERY_N_IMAGES,
+ * 							or number of hours for
+ * 							REFRESH_POLICY_CLEAR_ON_GHOSTING_SCHEDULE. Should
+ * 							be at least 1
+ */
+void Refresh_Policy_Set(const Refresh_Policy policy, const uint8_t interval);
+
+/**
+ * Check if the display should be cleared before showing the next image
+ *
+ * @return	TRUE if the display should be cleared. FALSE otherwise
+ */
+Boolean Refresh_Policy_Should_Clear(void);
+
+/**
+ * Record that an image was shown, and store the number of images shown since
+ * the last clear in RTC backup registers
+ *
+ * @param is_cleared	(IN)	TRUE if the display was cleared before the image
+ */
+void Refresh_Policy_Record_Image(const Boolean is_cleared);
+
+#endif /* INC_REFRESH_POLICY_H_ */
@@ -25,6 +25,21 @@ RTC_Status RTC_Init(void);
  */
 void PWR_Enter_Low_Power_Mode(void);
 
+/**
+ * Put MCU in Stop 2 mode until an interrupt arrives, and restore the system
+ * clock after waking up. Stop 2 halts peripheral clocks, so MCU only sleeps
+ * with WFI instead while a DMA1 channel is transferring data. Call with
+ * interrupts masked after checking the wake condition, so that the interrupt
+ * cannot slip in between the check and sleeping
+ *
+ * @param is_stop_entered	(OUT)	TRUE if MCU entered Stop 2 mode, FALSE if it
+ * 								slept with WFI instead
+ *
+ * @return	TRUE if the system clock was restored after waking up, or if MCU
+ * 			did not enter Stop 2 mode. FALSE otherwise
+ */
+Boolean PWR_Enter_Stop_Mode(Boolean *const is_stop_entered);
+
 /**
  * Check if MCU is booting up from low-power mode or not, and handle the
  * initialization if it is booting up from low-power mode
@@ -45,6 +60,29 @@ void PWR_Handle_Boot_From_Low_Power_Mode(
  */
 RTC_Status RTC_Set_WakeUp_Timer(const uint32_t seconds_to_sleep);
 
+/**
+ * Check if the RTC Wakeup timer has elapsed since it was last set
+ *
+ * @return	TRUE if the Wakeup timer interrupt was triggered. FALSE otherwise
+ */
+Boolean RTC_Has_WakeUp_Timer_Elapsed(void);
+
+/**
+ * Stop the RTC Wakeup timer
+ *
+ * @return	Status of stopping the Wakeup timer
+ */
+RTC_Status RTC_Stop_WakeUp_Timer(void);
+
+/**
+ * Read the RTC calendar time of the day in milliseconds. The calendar keeps
+ * running in Stop mode, unlike the HAL tick
+ *
+ * @return	Milliseconds since the start of the day, with the resolution of
+ * 			RTC sub-seconds counter
+ */
+uint32_t RTC_Get_Time_Ms(void);
+
 /**
  * Read a backup register from RTC peripheral
  *
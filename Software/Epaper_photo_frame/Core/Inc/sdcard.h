@@ -2,12 +2,17 @@
 #define INC_SDCARD_H_
 
 #include <stdint.h>
+#include "block_device.h"
 
 /*
- * Sector size used commonly for SD card and FAT filesystem. Most new
- * cards will use 512 as sector size and FAT32 also supports it
+ * Latency histograms in SD card telemetry use power of two buckets in
+ * microseconds. Bucket i counts latencies in [2^i, 2^(i+1)) us, bucket 0 also
+ * counts latencies below 1 us and the last bucket counts all longer latencies
  */
-#define SECTOR_SIZE	(512)
+#define SDC_HISTOGRAM_BUCKETS	(12)
+
+// Number of SD card commands used by the driver, which have their own counters
+#define SDC_TELEMETRY_COMMANDS	(11)
 
 /**
  * Return codes to expect from SD card APIs
@@ -46,8 +51,104 @@ typedef enum {
 	SDC_READ_START_ERR,							/**< SDC_READ_START_ERR */
 	SDC_READ_END_ERR,							/**< SDC_READ_END_ERR */
 	SDC_POWEROFF_IO_DEINIT_ERR,					/**< SDC_POWEROFF_IO_DEINIT_ERR */
+	SDC_READ_STOP_CMD_ERR,						/**< SDC_READ_STOP_CMD_ERR */
+	SDC_READ_STOP_BUSY_TIMEOUT,					/**< SDC_READ_STOP_BUSY_TIMEOUT */
+	SDC_READ_DMA_START_ERR,						/**< SDC_READ_DMA_START_ERR */
+	SDC_READ_DMA_TRANSFER_ERR,					/**< SDC_READ_DMA_TRANSFER_ERR */
+	SDC_READ_DATA_CRC_MISMATCH,					/**< SDC_READ_DATA_CRC_MISMATCH */
+	SDC_INIT_CSD_READ_ERR,						/**< SDC_INIT_CSD_READ_ERR */
+	SDC_INIT_SWITCH_FUNC_ERR,					/**< SDC_INIT_SWITCH_FUNC_ERR */
+	SDC_INIT_CLOCK_CALIBRATION_ERR,				/**< SDC_INIT_CLOCK_CALIBRATION_ERR */
+	SDC_INIT_CRC_INIT_ERR,						/**< SDC_INIT_CRC_INIT_ERR */
+	SDC_POWEROFF_BUSY_TIMEOUT,					/**< SDC_POWEROFF_BUSY_TIMEOUT */
+	SDC_POWEROFF_CARD_STATUS_ERR,				/**< SDC_POWEROFF_CARD_STATUS_ERR */
+	SDC_READ_QUEUE_FULL,						/**< SDC_READ_QUEUE_FULL */
+	SDC_READ_BUSY,								/**< SDC_READ_BUSY */
 } SDC_Status;
 
+/**
+ * Ways to receive the payload of a data block from SD card
+ */
+typedef enum {
+	SDC_TRANSFER_MODE_BLOCKING,	/**< CPU polls SPI for every payload byte */
+	SDC_TRANSFER_MODE_DMA,		/**< DMA receives payload while CPU sleeps */
+	SDC_TRANSFER_MODE_COUNT,	/**< Number of transfer modes */
+} SDC_Transfer_Mode;
+
+/**
+ * Function to call when an asynchronous read submitted with SDC_Submit_Read
+ * finishes. It is called from thread context, while waiting for reads or when
+ * submitting the next one
+ *
+ * @param status	(IN)	Status of the read operation
+ * @param ctx		(IN)	Context pointer provided when the read was submitted
+ */
+typedef void (*SDC_Read_Callback)(const SDC_Status status, void *ctx);
+
+/**
+ * Accumulated cost of receiving data block payloads with a transfer mode
+ */
+typedef struct {
+	uint32_t sectors;		// Number of payloads received
+	uint32_t wall_time_us;	// Time elapsed while receiving the payloads
+	uint32_t active_cycles;	// Core cycles spent, excluding time in WFI
+} SDC_Transfer_Stats;
+
+/**
+ * Accumulated cost of single byte exchanges used for commands, responses and
+ * token/busy polling
+ */
+typedef struct {
+	uint32_t bytes;		// Number of bytes exchanged one at a time
+	uint32_t cycles;	// Core cycles spent in those exchanges
+	uint32_t timeouts;	// Exchanges abandoned because SPI did not complete
+} SDC_Byte_Exchange_Stats;
+
+/**
+ * Counters for CRC verification of data blocks
+ */
+typedef struct {
+	uint32_t blocks_checked;	// Number of data blocks whose CRC was checked
+	uint32_t crc_failures;		// Number of data blocks failing the check
+	uint32_t retries;			// Number of reads retried after a failure
+} SDC_CRC_Stats;
+
+/**
+ * Counters for one SD card command
+ */
+typedef struct {
+	uint8_t cmd;		// Command index, e.g. 17 for CMD17
+	uint32_t count;		// Number of times the command was sent
+	uint32_t errors;	// Responses with error bits set, or no response at all
+	uint32_t latency_histogram[SDC_HISTOGRAM_BUCKETS];	// Time from sending the
+														// command until R1
+} SDC_Command_Stats;
+
+/**
+ * Telemetry for SD card transactions, to find out where the time goes with a
+ * card
+ */
+typedef struct {
+	SDC_Command_Stats commands[SDC_TELEMETRY_COMMANDS];
+	uint32_t token_wait_histogram[SDC_HISTOGRAM_BUCKETS];	// Time from end of
+															// command or block
+															// until data token
+	uint32_t token_timeouts;	// Data tokens which did not arrive in time
+	uint32_t error_tokens;		// Data error tokens received instead of data
+	uint32_t busy_bytes;		// Bytes clocked while card signaled busy
+	uint32_t payload_bytes;		// Bytes received in sector payloads
+	uint32_t register_bytes;	// Bytes received in CSD/switch status blocks
+} SDC_Telemetry;
+
+/**
+ * Time taken to bring up and shut down the SD card
+ */
+typedef struct {
+	uint32_t init_time_us;		// From power on until card is ready for reads
+	uint32_t power_off_time_us;	// From power off request until power is removed
+	uint32_t acmd41_polls;		// ACMD41 commands sent until card left idle state
+} SDC_Latency_Stats;
+
 
 /**
  * Initialize the SD card and IO channels to communicate with it
@@ -67,6 +168,114 @@ SDC_Status SDC_Init(void);
  */
 SDC_Status SDC_Read_Sector(uint32_t start_addr, uint8_t *restrict const buffer);
 
+/**
+ * Read consecutive sectors starting from given address in SD card to the
+ * provided buffer. All the sectors are streamed using a single multiple block
+ * read command, which avoids paying the command overhead for every sector
+ *
+ * @param start_addr (IN)	Address of the first sector to read
+ * @param count		 (IN)	Number of consecutive sectors to read
+ * @param buffer	 (OUT)	Buffer to read the sectors into. It should be at least
+ * 							count * SECTOR_SIZE in size
+ *
+ * @return	Status of multiple sector read operation
+ */
+SDC_Status SDC_Read_Sectors(uint32_t start_addr, const uint32_t count,
+		uint8_t *restrict const buffer);
+
+/**
+ * Queue a read of consecutive sectors and return without waiting for the data.
+ * Requests are served in order. Each data block is received with DMA and the
+ * next step is started from PendSV at the lowest interrupt priority, so the
+ * caller can do other work or sleep in the meantime
+ *
+ * @param start_addr (IN)	Address of the first sector to read
+ * @param count		 (IN)	Number of consecutive sectors to read
+ * @param buffer	 (OUT)	Buffer to read the sectors into. It should be at least
+ * 							count * SECTOR_SIZE in size and must not be used
+ * 							until cb is called
+ * @param cb		 (IN)	Function to call when the read finishes. Can be NULL
+ * @param ctx		 (IN)	Context pointer to pass to cb
+ *
+ * @return	Status of queuing the read. Failures after the read is queued are
+ * 			reported through cb
+ */
+SDC_Status SDC_Submit_Read(const uint32_t start_addr, const uint32_t count,
+		uint8_t *restrict const buffer, SDC_Read_Callback cb, void *ctx);
+
+/**
+ * Sleep until all the reads submitted with SDC_Submit_Read have finished
+ */
+void SDC_Wait_For_Idle(void);
+
+/**
+ * Select how the payload of data blocks is received from SD card. DMA mode is
+ * used by default
+ *
+ * @param mode	(IN)	Transfer mode to use for subsequent sector reads
+ */
+void SDC_Set_Transfer_Mode(const SDC_Transfer_Mode mode);
+
+/**
+ * Get the accumulated cost of payload transfers done with a transfer mode, so
+ * that throughput and energy per sector can be compared between modes
+ *
+ * @param mode	(IN)	Transfer mode to get the statistics for
+ * @param stats	(OUT)	Variable to store the statistics in
+ */
+void SDC_Get_Transfer_Stats(const SDC_Transfer_Mode mode,
+		SDC_Transfer_Stats *restrict const stats);
+
+/**
+ * Get the accumulated cost of single byte exchanges with SD card
+ *
+ * @param stats	(OUT)	Variable to store the statistics in
+ */
+void SDC_Get_Byte_Exchange_Stats(SDC_Byte_Exchange_Stats *restrict const stats);
+
+/**
+ * Get the counters for CRC verification of data blocks
+ *
+ * @param stats	(OUT)	Variable to store the counters in
+ */
+void SDC_Get_CRC_Stats(SDC_CRC_Stats *restrict const stats);
+
+/**
+ * Get the block device interface backed by the SD card. Reads go through
+ * SDC_Read_Sectors and SDC_Submit_Read, and the block count is taken from the
+ * card's CSD register
+ *
+ * @return	Block device for the SD card. Only usable after SDC_Init succeeds
+ */
+const Block_Device* SDC_Get_Block_Device(void);
+
+/**
+ * Get the time taken by the last initialization and power off operations
+ *
+ * @param stats	(OUT)	Variable to store the latency values in
+ */
+void SDC_Get_Latency_Stats(SDC_Latency_Stats *restrict const stats);
+
+/**
+ * Get the telemetry collected for SD card transactions
+ *
+ * @param telemetry	(OUT)	Variable to store the telemetry in
+ */
+void SDC_Get_Telemetry(SDC_Telemetry *restrict const telemetry);
+
+/**
+ * Log all the statistics and telemetry collected by the SD card driver over
+ * the logger, one line per group of counters
+ */
+void SDC_Dump_Stats(void);
+
+/**
+ * Get the SPI clock frequency selected for communicating with SD card
+ *
+ * @return	SPI clock frequency in Hz
+ */
+uint32_t SDC_Get_Bus_Frequency(void);
+
 /**
  * De-initialize the SD card and power it off
  *
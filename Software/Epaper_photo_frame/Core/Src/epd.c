@@ -1,5 +1,9 @@
+#include <assert.h>
+#include <string.h>
 #include "stm32l4xx_hal.h"
 #include "epd.h"
+#include "profiling.h"
+#include "rtc_and_pwr.h"
 
 /*
  * Use SPI1 for communication with E-paper display: PB10(NSS), PA1(SCK),
@@ -11,6 +15,22 @@
  */
 static SPI_HandleTypeDef hspi1;
 
+/*
+ * Use DMA1 Channel3 for SPI1_TX - Table 41 in reference manual
+ */
+static DMA_HandleTypeDef hdma_spi1_tx;
+
+/*
+ * State of the DMA transfer on SPI1. Updated from interrupt context
+ */
+typedef enum {
+    EPD_DMA_IDLE,
+    EPD_DMA_BUSY,
+    EPD_DMA_ERROR,
+} EPD_DMA_State;
+
+static volatile EPD_DMA_State spi1_dma_state = EPD_DMA_IDLE;
+
 /*
  * E-paper display commands - Section 6-1 in datasheet
  */
@@ -23,6 +43,20 @@ static SPI_HandleTypeDef hspi1;
 #define EPD_COMMAND_DATA_REFRESH    (0x12)
 #define EPD_DATA_DATA_REFRESH       (0x00)
 
+/*
+ * Number of data bytes in a full frame, and most bytes HAL can send in one
+ * SPI transfer
+ */
+#define EPD_FRAME_SIZE              (EPD_WIDTH * EPD_HEIGHT)
+#define EPD_SPI_MAX_TRANSFER_SIZE   (0xFFFF)
+
+/*
+ * Longest time to wait for the display to release BUSY line. A 7-color refresh
+ * takes tens of seconds
+ */
+#define EPD_BUSY_TIMEOUT_SECONDS    (60)
+#define MS_PER_DAY                  (24 * 60 * 60 * 1000)
+
 /*
  * Some helpful macros
  */
@@ -42,13 +76,45 @@ static EPD_Status EPD_Init_internal(void);
 static void EPD_GPIOs_Init(void);
 static void EPD_GPIOs_De_Init(void);
 static void EPD_Reset(void);
-static void EPD_Wait_While_Busy(void);
+static HAL_StatusTypeDef EPD_Wait_While_Busy(void);
 static HAL_StatusTypeDef EPD_Send_Command(uint8_t cmd);
-static HAL_StatusTypeDef EPD_Send_Data(uint8_t data);
+static HAL_StatusTypeDef EPD_Send_Data_Burst(const uint8_t *restrict const data,
+        const uint32_t data_size);
+static HAL_StatusTypeDef EPD_Send_Frame_Data(const uint8_t *restrict const data,
+        const uint32_t data_size);
+static HAL_StatusTypeDef EPD_Send_Frame_Pattern(const uint8_t pattern,
+        const uint32_t count);
+static HAL_StatusTypeDef EPD_Send_Pattern_Blocking(const uint8_t pattern,
+        const uint32_t count);
+static HAL_StatusTypeDef EPD_Send_Pattern_DMA(const uint8_t pattern,
+        const uint32_t count);
+static HAL_StatusTypeDef EPD_Set_DMA_Memory_Increment(const uint32_t mem_inc);
+static EPD_Status EPD_Start_Frame(void);
+static HAL_StatusTypeDef EPD_Queue_Frame_Data_DMA(
+        const uint8_t *restrict const data, const uint32_t data_size);
+static HAL_StatusTypeDef EPD_Send_Fill_Buffer_DMA(void);
+static HAL_StatusTypeDef EPD_Wait_For_DMA(void);
+static HAL_StatusTypeDef EPD_Finish_Frame_Data(void);
+static void EPD_Abort_Frame_Data(void);
+static void EPD_DMA_De_Init(void);
 static EPD_Status EPD_Refresh_Display_Image(void);
 static EPD_Status EPD_Send_Command_And_Data(const uint8_t cmd,
         const uint8_t *restrict const data, const uint8_t data_size);
 
+static EPD_Transfer_Stats transfer_stats;
+static EPD_Refresh_Stats refresh_stats;
+static uint32_t frame_start_us;
+
+static EPD_Transfer_Mode transfer_mode = EPD_TRANSFER_MODE_DMA;
+// Mode used for the frame being sent, so that changing the mode does not
+// affect it
+static EPD_Transfer_Mode frame_transfer_mode = EPD_TRANSFER_MODE_BLOCKING;
+
+// Frame data is copied into one buffer while DMA sends the other one
+static uint8_t dma_buffers[2][EPD_DMA_BUFFER_SIZE];
+static uint8_t dma_fill_buffer;
+static uint32_t dma_fill_size;
+
 EPD_Status EPD_Init(void) {
     if (SPI1_Init() != HAL_OK) {
         return EPD_INIT_IO_INIT_ERR;
@@ -59,17 +125,31 @@ EPD_Status EPD_Init(void) {
 }
 
 EPD_Status EPD_Display_Clear(const EPD_Color_t color) {
-    const uint8_t display_color = (color << 4) | color;
+    const EPD_Color_Band band = { color, EPD_HEIGHT };
 
-    if (EPD_Send_Command(EPD_COMMAND_DATA_TX_START) != HAL_OK) {
+    return EPD_Display_Color_Bands(&band, 1);
+}
+
+EPD_Status EPD_Display_Color_Bands(const EPD_Color_Band *restrict const bands,
+        const uint8_t band_count) {
+    uint32_t rows = 0;
+
+    for (uint8_t i = 0; i < band_count; i++) {
+        rows += bands[i].rows;
+    }
+    if (rows != EPD_HEIGHT) {
+        return EPD_BANDS_SIZE_ERR;
+    }
+
+    if (EPD_Start_Frame() != EPD_OK) {
         return EPD_SEND_CMD_ERR;
     }
 
-    for (uint16_t i = 0; i < EPD_HEIGHT; i++) {
-        for (uint16_t j = 0; j < EPD_WIDTH; j++) {
-            if (EPD_Send_Data(display_color) != HAL_OK) {
-                return EPD_SEND_DATA_ERR;
-            }
+    // Both pixels of a byte have the color of the band
+    for (uint8_t i = 0; i < band_count; i++) {
+        if (EPD_Send_Frame_Pattern((bands[i].color << 4) | bands[i].color,
+                (uint32_t) bands[i].rows * EPD_WIDTH) != HAL_OK) {
+            return EPD_SEND_DATA_ERR;
         }
     }
 
@@ -77,16 +157,12 @@ EPD_Status EPD_Display_Clear(const EPD_Color_t color) {
 }
 
 EPD_Status EPD_Display_Full_Image(const uint8_t *restrict const img) {
-    if (EPD_Send_Command(EPD_COMMAND_DATA_TX_START) != HAL_OK) {
+    if (EPD_Start_Frame() != EPD_OK) {
         return EPD_SEND_CMD_ERR;
     }
 
-    for (uint16_t i = 0; i < EPD_HEIGHT; i++) {
-        for (uint16_t j = 0; j < EPD_WIDTH; j++) {
-            if (EPD_Send_Data(img[i * EPD_WIDTH + j]) != HAL_OK) {
-                return EPD_SEND_DATA_ERR;
-            }
-        }
+    if (EPD_Send_Frame_Data(img, EPD_FRAME_SIZE) != HAL_OK) {
+        return EPD_SEND_DATA_ERR;
     }
 
     return EPD_Refresh_Display_Image();
@@ -105,28 +181,33 @@ EPD_Status EPD_Put_To_Sleep(void) {
 
 DataProcessingStatus EPD_Display_Image_Callback(const uint32_t data_offset,
         const uint8_t *restrict const image_buffer, const uint32_t buffer_size) {
-    uint32_t i;
+    uint32_t data_size = buffer_size;
 
     // If we receive the partial image data which represent start of full image
     // data, start TX
     if (data_offset == 0) {
-        if (EPD_Send_Command(EPD_COMMAND_DATA_TX_START) != HAL_OK) {
+        if (EPD_Start_Frame() != EPD_OK) {
             return DATA_PROCESSING_PROCESS_ERR;
         }
     }
 
-    for (i = 0; i < buffer_size; i++) {
-        if (EPD_Send_Data(image_buffer[i]) != HAL_OK) {
-            return DATA_PROCESSING_PROCESS_ERR;
-        }
-        if ((data_offset + i) >= (EPD_WIDTH * EPD_HEIGHT)) {
-            return DATA_PROCESSING_MORE_THAN_EXPECTED_DATA;
-        }
+    if (data_offset >= EPD_FRAME_SIZE) {
+        return DATA_PROCESSING_MORE_THAN_EXPECTED_DATA;
+    }
+    if ((data_offset + data_size) > EPD_FRAME_SIZE) {
+        data_size = EPD_FRAME_SIZE - data_offset;
+    }
+
+    if (EPD_Send_Frame_Data(image_buffer, data_size) != HAL_OK) {
+        return DATA_PROCESSING_PROCESS_ERR;
+    }
+    if (data_size < buffer_size) {
+        return DATA_PROCESSING_MORE_THAN_EXPECTED_DATA;
     }
 
     // When all the data has been sent (in single call or multiple calls),
     // refresh the display to update the image on E-paper display
-    if ((data_offset + i) == (EPD_WIDTH * EPD_HEIGHT)) {
+    if ((data_offset + data_size) == EPD_FRAME_SIZE) {
         if (EPD_Refresh_Display_Image() != EPD_OK) {
             return DATA_PROCESSING_PROCESS_ERR;
         }
@@ -135,12 +216,28 @@ DataProcessingStatus EPD_Display_Image_Callback(const uint32_t data_offset,
     return DATA_PROCESSING_OK;
 }
 
+void EPD_Set_Transfer_Mode(const EPD_Transfer_Mode mode) {
+    if (mode < EPD_TRANSFER_MODE_COUNT) {
+        transfer_mode = mode;
+    }
+}
+
+void EPD_Get_Transfer_Stats(EPD_Transfer_Stats *restrict const stats) {
+    *stats = transfer_stats;
+}
+
+void EPD_Get_Refresh_Stats(EPD_Refresh_Stats *restrict const stats) {
+    *stats = refresh_stats;
+}
+
 EPD_Status EPD_De_Init(void) {
 //    if (HAL_SPI_DeInit(&hspi1) != HAL_OK) {
 //        return EPD_DEINIT_IO_DEINIT_ERR;
 //    }
 //
 //    EPD_GPIOs_De_Init();
+    HAL_NVIC_DisableIRQ(EXTI9_5_IRQn);
+    EPD_DMA_De_Init();
     __HAL_RCC_SPI1_CLK_DISABLE();
     return EPD_OK;
 }
@@ -197,17 +294,80 @@ void EPD_SPI_Msp_Init(void) {
     // De-select the chip as soon as GPIO initialization
     // is done
     EPD_CS_DESELECT();
+
+    // Initialize DMA channel used to send frame data
+    __HAL_RCC_DMA1_CLK_ENABLE();
+
+    hdma_spi1_tx.Instance = DMA1_Channel3;
+    hdma_spi1_tx.Init.Request = DMA_REQUEST_1;
+    hdma_spi1_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    hdma_spi1_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_spi1_tx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_spi1_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_spi1_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_spi1_tx.Init.Mode = DMA_NORMAL;
+    hdma_spi1_tx.Init.Priority = DMA_PRIORITY_LOW;
+    // Return value should be HAL_OK since the handle is fully configured
+    assert(HAL_DMA_Init(&hdma_spi1_tx) == HAL_OK);
+    __HAL_LINKDMA(&hspi1, hdmatx, hdma_spi1_tx);
+
+    HAL_NVIC_SetPriority(DMA1_Channel3_IRQn, 2, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Channel3_IRQn);
+    HAL_NVIC_SetPriority(SPI1_IRQn, 2, 0);
+    HAL_NVIC_EnableIRQ(SPI1_IRQn);
 }
 
 /**
  * Low-level SPI1 peripheral de-initialization for IO channels
  */
 void EPD_SPI_Msp_Deinit(void) {
+    EPD_DMA_De_Init();
     __HAL_RCC_SPI1_CLK_DISABLE();
     HAL_GPIO_DeInit(GPIOA, GPIO_PIN_1 | GPIO_PIN_7);
     HAL_GPIO_DeInit(GPIOB, GPIO_PIN_10);
 }
 
+/**
+ * De-initialize DMA channel used to send frame data. DMA1 clock is left
+ * enabled since the channels of SD card share it
+ */
+static void EPD_DMA_De_Init(void) {
+    HAL_NVIC_DisableIRQ(SPI1_IRQn);
+    HAL_NVIC_DisableIRQ(DMA1_Channel3_IRQn);
+    HAL_DMA_DeInit(&hdma_spi1_tx);
+}
+
+/**
+ * Handle interrupts from DMA channel transmitting data for SPI1
+ */
+void EPD_SPI_DMA_Tx_IRQ_Handler(void) {
+    HAL_DMA_IRQHandler(&hdma_spi1_tx);
+}
+
+/**
+ * Handle interrupts from SPI1 peripheral
+ */
+void EPD_SPI_IRQ_Handler(void) {
+    HAL_SPI_IRQHandler(&hspi1);
+}
+
+/**
+ * Mark the DMA transfer on SPI1 as complete. HAL leaves the channel enabled
+ * after a transfer, so disable it to let MCU enter Stop mode
+ */
+void EPD_SPI_Transfer_Complete_Callback(void) {
+    __HAL_DMA_DISABLE(&hdma_spi1_tx);
+    spi1_dma_state = EPD_DMA_IDLE;
+}
+
+/**
+ * Mark the DMA transfer on SPI1 as failed
+ */
+void EPD_SPI_Transfer_Error_Callback(void) {
+    __HAL_DMA_DISABLE(&hdma_spi1_tx);
+    spi1_dma_state = EPD_DMA_ERROR;
+}
+
 /**
  * Initialize GPIOs for control signals to E-paper display
  */
@@ -230,10 +390,21 @@ static void EPD_GPIOs_Init(void) {
     gpio_epd.Speed = GPIO_SPEED_FREQ_LOW;
     HAL_GPIO_Init(GPIOA, &gpio_epd);
 
+    // Rising edge of BUSY wakes up MCU from Stop mode
     gpio_epd.Pin = GPIO_PIN_5;
-    gpio_epd.Mode = GPIO_MODE_INPUT;
+    gpio_epd.Mode = GPIO_MODE_IT_RISING;
     gpio_epd.Pull = GPIO_NOPULL;
     HAL_GPIO_Init(GPIOA, &gpio_epd);
+
+    HAL_NVIC_SetPriority(EXTI9_5_IRQn, 2, 0);
+    HAL_NVIC_EnableIRQ(EXTI9_5_IRQn);
+}
+
+/**
+ * Handle interrupts from EXTI line of BUSY signal
+ */
+void EPD_BUSY_IRQ_Handler(void) {
+    HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_5);
 }
 
 /**
@@ -241,6 +412,7 @@ static void EPD_GPIOs_Init(void) {
  * display
  */
 static void EPD_GPIOs_De_Init(void) {
+    HAL_NVIC_DisableIRQ(EXTI9_5_IRQn);
     HAL_GPIO_DeInit(GPIOA, GPIO_PIN_1 | GPIO_PIN_3 | GPIO_PIN_5 | GPIO_PIN_7);
     HAL_GPIO_DeInit(GPIOB, GPIO_PIN_1 | GPIO_PIN_10);
 }
@@ -254,7 +426,9 @@ static EPD_Status EPD_Init_internal(void) {
     uint8_t data[6];
     EPD_Reset();
     HAL_Delay(20);
-    EPD_Wait_While_Busy();
+    if (EPD_Wait_While_Busy() != HAL_OK) {
+        return EPD_INIT_INTERNAL_INIT_ERR;
+    }
     HAL_Delay(30);
 
     // CMDH
@@ -397,12 +571,55 @@ static void EPD_Reset(void) {
 }
 
 /**
- * Wait until the BUSY line becomes high
+ * Wait until the BUSY line becomes high. MCU sleeps in Stop mode until the
+ * rising edge of BUSY or the timeout of RTC Wakeup timer wakes it up
+ *
+ * @return  Status of waiting for the display, HAL_TIMEOUT if BUSY line stayed
+ *          low for EPD_BUSY_TIMEOUT_SECONDS
  */
-static void EPD_Wait_While_Busy(void) {
-    while (EPD_BUSY_READ() == GPIO_PIN_RESET) {
-        HAL_Delay(1);
+static HAL_StatusTypeDef EPD_Wait_While_Busy(void) {
+    const uint32_t start_cycles = Profiling_Get_Cycles();
+    const uint32_t start_ms = RTC_Get_Time_Ms();
+    HAL_StatusTypeDef ret = HAL_OK;
+    Boolean is_clock_restored = TRUE;
+    Boolean is_stop_entered = FALSE;
+
+    if (EPD_BUSY_READ() == GPIO_PIN_RESET) {
+        if (RTC_Set_WakeUp_Timer(EPD_BUSY_TIMEOUT_SECONDS) != RTC_OK) {
+            return HAL_ERROR;
+        }
+
+        // Check BUSY with interrupts masked so that its rising edge cannot slip
+        // in between the check and entering Stop mode. A pending interrupt
+        // still wakes up the core and gets serviced as soon as it is unmasked
+        __disable_irq();
+        while ((EPD_BUSY_READ() == GPIO_PIN_RESET)
+                && (RTC_Has_WakeUp_Timer_Elapsed() == FALSE)
+                && (is_clock_restored == TRUE)) {
+            is_clock_restored = PWR_Enter_Stop_Mode(&is_stop_entered);
+            if (is_stop_entered == TRUE) {
+                refresh_stats.stop_entries++;
+            }
+            __enable_irq();
+            __disable_irq();
+        }
+        __enable_irq();
+
+        if (is_clock_restored != TRUE) {
+            ret = HAL_ERROR;
+        } else if (EPD_BUSY_READ() == GPIO_PIN_RESET) {
+            ret = HAL_TIMEOUT;
+        }
+        if (RTC_Stop_WakeUp_Timer() != RTC_OK) {
+            ret = HAL_ERROR;
+        }
     }
+
+    refresh_stats.busy_time_ms += (RTC_Get_Time_Ms() + MS_PER_DAY - start_ms)
+            % MS_PER_DAY;
+    refresh_stats.active_time_us += Profiling_Cycles_To_Us(
+            Profiling_Get_Cycles() - start_cycles);
+    return ret;
 }
 
 /**
@@ -427,26 +644,345 @@ static HAL_StatusTypeDef EPD_Send_Command(uint8_t cmd) {
 }
 
 /**
- * Send a data byte to E-paper display
+ * Send data bytes to E-paper display in one burst, keeping the chip selected
+ * and D/C set for data during the whole transfer
  *
- * @param data  (IN)    Data byte to send
+ * @param data      (IN)    Data bytes to send
+ * @param data_size (IN)    Number of data bytes to send
  *
- * @return  Status of sending a byte over IO channels to E-paper display
+ * @return  Status of sending the bytes over IO channels to E-paper display
  */
-static HAL_StatusTypeDef EPD_Send_Data(uint8_t data) {
+static HAL_StatusTypeDef EPD_Send_Data_Burst(const uint8_t *restrict const data,
+        const uint32_t data_size) {
+    HAL_StatusTypeDef ret = HAL_OK;
+    uint32_t bytes_sent = 0;
+    uint16_t chunk_size;
+
+    EPD_CS_SELECT();
+    EPD_DC_DATA();
+    while ((bytes_sent < data_size) && (ret == HAL_OK)) {
+        chunk_size = ((data_size - bytes_sent) > EPD_SPI_MAX_TRANSFER_SIZE) ?
+                EPD_SPI_MAX_TRANSFER_SIZE : (data_size - bytes_sent);
+        ret = HAL_SPI_Transmit(&hspi1, (uint8_t*) &data[bytes_sent],
+                chunk_size, HAL_MAX_DELAY);
+        bytes_sent += chunk_size;
+    }
+    EPD_CS_DESELECT();
+    return ret;
+}
+
+/**
+ * Send a part of the frame's image data to E-paper display in one burst, and
+ * account for it in the stats of the frame
+ *
+ * @param data      (IN)    Image data bytes to send
+ * @param data_size (IN)    Number of image data bytes to send
+ *
+ * @return  Status of sending the bytes over IO channels to E-paper display
+ */
+static HAL_StatusTypeDef EPD_Send_Frame_Data(const uint8_t *restrict const data,
+        const uint32_t data_size) {
+    const uint32_t start_us = Profiling_Get_Time_Us();
     HAL_StatusTypeDef ret;
-    uint16_t edata = (0x0100 | data);
+
+    if (frame_transfer_mode == EPD_TRANSFER_MODE_DMA) {
+        ret = EPD_Queue_Frame_Data_DMA(data, data_size);
+        if (ret != HAL_OK) {
+            EPD_Abort_Frame_Data();
+        }
+    } else {
+        ret = EPD_Send_Data_Burst(data, data_size);
+    }
+
+    transfer_stats.transfer_time_us += Profiling_Get_Time_Us() - start_us;
+    transfer_stats.bytes += data_size;
+    transfer_stats.bursts++;
+    return ret;
+}
+
+/**
+ * Send the same data byte repeatedly as a part of the frame, and account for it
+ * in the stats of the frame
+ *
+ * @param pattern   (IN)    Data byte to send
+ * @param count     (IN)    Number of times to send the data byte
+ *
+ * @return  Status of sending the bytes over IO channels to E-paper display
+ */
+static HAL_StatusTypeDef EPD_Send_Frame_Pattern(const uint8_t pattern,
+        const uint32_t count) {
+    const uint32_t start_us = Profiling_Get_Time_Us();
+    HAL_StatusTypeDef ret;
+
+    if (frame_transfer_mode == EPD_TRANSFER_MODE_DMA) {
+        ret = EPD_Send_Pattern_DMA(pattern, count);
+        if (ret != HAL_OK) {
+            EPD_Abort_Frame_Data();
+        }
+    } else {
+        ret = EPD_Send_Pattern_Blocking(pattern, count);
+    }
+
+    transfer_stats.transfer_time_us += Profiling_Get_Time_Us() - start_us;
+    transfer_stats.bytes += count;
+    transfer_stats.bursts++;
+    return ret;
+}
+
+/**
+ * Send the same data byte repeatedly in one burst, writing it to SPI data
+ * register as soon as there is room in TX FIFO
+ *
+ * @param pattern   (IN)    Data byte to send
+ * @param count     (IN)    Number of times to send the data byte
+ *
+ * @return  Status of sending the bytes over IO channels to E-paper display
+ */
+static HAL_StatusTypeDef EPD_Send_Pattern_Blocking(const uint8_t pattern,
+        const uint32_t count) {
+    SPI_TypeDef *const spi = hspi1.Instance;
+
     EPD_CS_SELECT();
     EPD_DC_DATA();
-    if ((ret = HAL_SPI_Transmit(&hspi1, (uint8_t*) &edata, 1, HAL_MAX_DELAY))
-            != HAL_OK) {
-        EPD_CS_DESELECT();
-        return ret;
+    __HAL_SPI_ENABLE(&hspi1);
+    for (uint32_t i = 0; i < count; i++) {
+        while ((spi->SR & SPI_SR_TXE) == 0) {
+        }
+        // 8 bit access so that only one byte is packed in TX FIFO
+        *((__IO uint8_t*) &spi->DR) = pattern;
+    }
+
+    // Wait for the last byte to leave the shift register before de-selecting
+    while ((spi->SR & SPI_SR_FTLVL) != 0) {
+    }
+    while ((spi->SR & SPI_SR_BSY) != 0) {
     }
     EPD_CS_DESELECT();
+
+    // Bytes received while transmitting are not used
+    while ((spi->SR & SPI_SR_FRLVL) != 0) {
+        (void) *((__IO uint8_t*) &spi->DR);
+    }
+    __HAL_SPI_CLEAR_OVRFLAG(&hspi1);
+    return HAL_OK;
+}
+
+/**
+ * Send the same data byte repeatedly with DMA reading it from a fixed memory
+ * address, after the frame data queued before it. Chip stays selected for data
+ * during the whole frame
+ *
+ * @param pattern   (IN)    Data byte to send
+ * @param count     (IN)    Number of times to send the data byte
+ *
+ * @return  Status of the DMA transfers
+ */
+static HAL_StatusTypeDef EPD_Send_Pattern_DMA(const uint8_t pattern,
+        const uint32_t count) {
+    // Read by DMA, so it has to stay in place until the transfer finishes
+    static uint8_t dma_pattern;
+    uint32_t bytes_sent = 0;
+    uint16_t chunk_size;
+    HAL_StatusTypeDef ret;
+
+    // Data queued before the pattern has to reach the display first
+    ret = EPD_Send_Fill_Buffer_DMA();
+    if (ret == HAL_OK) {
+        ret = EPD_Wait_For_DMA();
+    }
+    if (ret == HAL_OK) {
+        ret = EPD_Set_DMA_Memory_Increment(DMA_MINC_DISABLE);
+    }
+    if (ret != HAL_OK) {
+        return ret;
+    }
+
+    dma_pattern = pattern;
+    while ((bytes_sent < count) && (ret == HAL_OK)) {
+        chunk_size = ((count - bytes_sent) > EPD_SPI_MAX_TRANSFER_SIZE) ?
+                EPD_SPI_MAX_TRANSFER_SIZE : (count - bytes_sent);
+        spi1_dma_state = EPD_DMA_BUSY;
+        ret = HAL_SPI_Transmit_DMA(&hspi1, &dma_pattern, chunk_size);
+        if (ret != HAL_OK) {
+            spi1_dma_state = EPD_DMA_IDLE;
+            break;
+        }
+        ret = EPD_Wait_For_DMA();
+        bytes_sent += chunk_size;
+    }
+
+    if (EPD_Set_DMA_Memory_Increment(DMA_MINC_ENABLE) != HAL_OK) {
+        ret = HAL_ERROR;
+    }
+    return ret;
+}
+
+/**
+ * Change if DMA channel sending frame data increments the memory address after
+ * each byte. Channel should be idle
+ *
+ * @param mem_inc   (IN)    DMA_MINC_ENABLE or DMA_MINC_DISABLE
+ *
+ * @return  Status of re-initializing the DMA channel
+ */
+static HAL_StatusTypeDef EPD_Set_DMA_Memory_Increment(const uint32_t mem_inc) {
+    hdma_spi1_tx.Init.MemInc = mem_inc;
+    return HAL_DMA_Init(&hdma_spi1_tx);
+}
+
+/**
+ * Copy frame data into the buffer being filled, and start sending each buffer
+ * with DMA as soon as it is full. Chip stays selected for data during the
+ * whole frame
+ *
+ * @param data      (IN)    Image data bytes to send
+ * @param data_size (IN)    Number of image data bytes to send
+ *
+ * @return  Status of starting the DMA transfers
+ */
+static HAL_StatusTypeDef EPD_Queue_Frame_Data_DMA(
+        const uint8_t *restrict const data, const uint32_t data_size) {
+    uint32_t bytes_queued = 0;
+    uint32_t chunk_size;
+    HAL_StatusTypeDef ret;
+
+    while (bytes_queued < data_size) {
+        chunk_size = EPD_DMA_BUFFER_SIZE - dma_fill_size;
+        if (chunk_size > (data_size - bytes_queued)) {
+            chunk_size = data_size - bytes_queued;
+        }
+        memcpy(&dma_buffers[dma_fill_buffer][dma_fill_size],
+                &data[bytes_queued], chunk_size);
+        dma_fill_size += chunk_size;
+        bytes_queued += chunk_size;
+
+        if (dma_fill_size == EPD_DMA_BUFFER_SIZE) {
+            ret = EPD_Send_Fill_Buffer_DMA();
+            if (ret != HAL_OK) {
+                return ret;
+            }
+        }
+    }
     return HAL_OK;
 }
 
+/**
+ * Start sending the buffer being filled with DMA once the transfer of the
+ * other buffer has finished, and continue filling the other buffer
+ *
+ * @return  Status of the previous DMA transfer and starting the next one
+ */
+static HAL_StatusTypeDef EPD_Send_Fill_Buffer_DMA(void) {
+    HAL_StatusTypeDef ret;
+
+    ret = EPD_Wait_For_DMA();
+    if ((ret != HAL_OK) || (dma_fill_size == 0)) {
+        return ret;
+    }
+
+    spi1_dma_state = EPD_DMA_BUSY;
+    ret = HAL_SPI_Transmit_DMA(&hspi1, dma_buffers[dma_fill_buffer],
+            dma_fill_size);
+    if (ret != HAL_OK) {
+        spi1_dma_state = EPD_DMA_IDLE;
+        return ret;
+    }
+    dma_fill_buffer ^= 1;
+    dma_fill_size = 0;
+    return HAL_OK;
+}
+
+/**
+ * Sleep until the DMA transfer on SPI1 has finished
+ *
+ * @return  Status of the DMA transfer
+ */
+static HAL_StatusTypeDef EPD_Wait_For_DMA(void) {
+    const uint32_t start_us = Profiling_Get_Time_Us();
+
+    // Check the state with interrupts masked so that the completion interrupt
+    // cannot slip in between the check and WFI
+    __disable_irq();
+    while (spi1_dma_state == EPD_DMA_BUSY) {
+        __WFI();
+        __enable_irq();
+        __disable_irq();
+    }
+    __enable_irq();
+    transfer_stats.dma_wait_time_us += Profiling_Get_Time_Us() - start_us;
+
+    if (spi1_dma_state == EPD_DMA_ERROR) {
+        spi1_dma_state = EPD_DMA_IDLE;
+        return HAL_ERROR;
+    }
+    return HAL_OK;
+}
+
+/**
+ * Send the frame data left in the buffer being filled, and wait for all of it
+ * to reach the display
+ *
+ * @return  Status of sending the rest of the frame data
+ */
+static HAL_StatusTypeDef EPD_Finish_Frame_Data(void) {
+    const uint32_t start_us = Profiling_Get_Time_Us();
+    HAL_StatusTypeDef ret;
+
+    if (frame_transfer_mode != EPD_TRANSFER_MODE_DMA) {
+        return HAL_OK;
+    }
+
+    ret = EPD_Send_Fill_Buffer_DMA();
+    if (ret == HAL_OK) {
+        ret = EPD_Wait_For_DMA();
+    }
+    EPD_Abort_Frame_Data();
+    transfer_stats.transfer_time_us += Profiling_Get_Time_Us() - start_us;
+    return ret;
+}
+
+/**
+ * Wait for the DMA transfer in progress, drop the frame data not sent yet and
+ * de-select the chip
+ */
+static void EPD_Abort_Frame_Data(void) {
+    (void) EPD_Wait_For_DMA();
+    dma_fill_size = 0;
+    EPD_CS_DESELECT();
+}
+
+/**
+ * Start sending a frame of image data to E-paper display, and reset the stats
+ * of the last frame
+ *
+ * @return  Status of sending the data start command
+ */
+static EPD_Status EPD_Start_Frame(void) {
+    // Previous frame may have been abandoned in the middle
+    if (frame_transfer_mode == EPD_TRANSFER_MODE_DMA) {
+        EPD_Abort_Frame_Data();
+    }
+
+    transfer_stats.bytes = 0;
+    transfer_stats.bursts = 0;
+    transfer_stats.transfer_time_us = 0;
+    transfer_stats.wall_time_us = 0;
+    transfer_stats.dma_wait_time_us = 0;
+    frame_start_us = Profiling_Get_Time_Us();
+    frame_transfer_mode = transfer_mode;
+
+    if (EPD_Send_Command(EPD_COMMAND_DATA_TX_START) != HAL_OK) {
+        return EPD_SEND_CMD_ERR;
+    }
+
+    // Data of the whole frame is sent with the chip selected once
+    if (frame_transfer_mode == EPD_TRANSFER_MODE_DMA) {
+        EPD_CS_SELECT();
+        EPD_DC_DATA();
+    }
+    return EPD_OK;
+}
+
 /**
  * Power on EPD, refresh the image on display, and then power off
  *
@@ -455,23 +991,42 @@ static HAL_StatusTypeDef EPD_Send_Data(uint8_t data) {
 static EPD_Status EPD_Refresh_Display_Image(void) {
     uint8_t data;
 
+    if (EPD_Finish_Frame_Data() != HAL_OK) {
+        return EPD_REFRESH_DISPLAY_ERR;
+    }
+
+    // All the frame's data has been sent by now
+    transfer_stats.wall_time_us = Profiling_Get_Time_Us() - frame_start_us;
+    transfer_stats.frames++;
+
+    refresh_stats.busy_time_ms = 0;
+    refresh_stats.active_time_us = 0;
+    refresh_stats.stop_entries = 0;
+    refresh_stats.refreshes++;
+
     if (EPD_Send_Command(EPD_COMMAND_POWER_ON) != HAL_OK) {
         return EPD_REFRESH_DISPLAY_ERR;
     }
-    EPD_Wait_While_Busy();
+    if (EPD_Wait_While_Busy() != HAL_OK) {
+        return EPD_REFRESH_DISPLAY_ERR;
+    }
 
     data = EPD_DATA_DATA_REFRESH;
     if (EPD_Send_Command_And_Data(EPD_COMMAND_DATA_REFRESH, &data, 1)
             != EPD_OK) {
         return EPD_REFRESH_DISPLAY_ERR;
     }
-    EPD_Wait_While_Busy();
+    if (EPD_Wait_While_Busy() != HAL_OK) {
+        return EPD_REFRESH_DISPLAY_ERR;
+    }
 
     data = EPD_DATA_POWER_OFF;
     if (EPD_Send_Command_And_Data(EPD_COMMAND_POWER_OFF, &data, 1) != EPD_OK) {
         return EPD_REFRESH_DISPLAY_ERR;
     }
-    EPD_Wait_While_Busy();
+    if (EPD_Wait_While_Busy() != HAL_OK) {
+        return EPD_REFRESH_DISPLAY_ERR;
+    }
 
     return EPD_OK;
 }
@@ -491,10 +1046,8 @@ static EPD_Status EPD_Send_Command_And_Data(const uint8_t cmd,
         return EPD_SEND_CMD_DATA_ERR;
     }
 
-    for (uint8_t i = 0; i < data_size; i++) {
-        if (EPD_Send_Data(data[i]) != HAL_OK) {
-            return EPD_SEND_CMD_DATA_ERR;
-        }
+    if (EPD_Send_Data_Burst(data, data_size) != HAL_OK) {
+        return EPD_SEND_CMD_DATA_ERR;
     }
     return EPD_OK;
 }
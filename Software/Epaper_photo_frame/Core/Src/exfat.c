@@ -0,0 +1,561 @@
+#include <stddef.h>
+#include <string.h>
+#include "block_device.h"
+#include "exfat.h"
+
+/*
+ * Magic constants to use when working with exFAT filesystem, from
+ * https://learn.microsoft.com/en-us/windows/win32/fileio/exfat-specification
+ */
+#define MAX_PRIMARY_PARTITIONS              (4)
+#define PARTITION_TABLE_FIRST_ENTRY_OFFSET  (0x1BE)
+#define PARTITION_TYPE_EXFAT                (0x7)
+#define BOOT_SIGNATURE                      (0xAA55)
+#define EXFAT_FILESYSTEM_NAME               "EXFAT   "
+#define SUPPORTED_BYTES_PER_SECTOR_SHIFT    (9)
+// Clusters can be at most 32 MB
+#define MAX_SECTORS_PER_CLUSTER_SHIFT       (25 - SUPPORTED_BYTES_PER_SECTOR_SHIFT)
+#define VOLUME_FLAG_ACTIVE_FAT              (1 << 0)
+#define FIRST_DATA_CLUSTER                  (2)
+
+/*
+ * Directory entry types. Bit 7 marks entries in use and bit 6 marks secondary
+ * entries, which follow a primary entry as part of its entry set
+ */
+#define DIR_ENTRY_SIZE                      (32)
+#define DIR_ENTRIES_PER_SECTOR              (SECTOR_SIZE / DIR_ENTRY_SIZE)
+#define DIR_ENTRY_TYPE_END_OF_DIR           (0x00)
+#define DIR_ENTRY_TYPE_FILE                 (0x85)
+#define DIR_ENTRY_TYPE_STREAM_EXTENSION     (0xC0)
+#define DIR_ENTRY_TYPE_FILE_NAME            (0xC1)
+#define DIR_ENTRY_IN_USE_SECONDARY_MASK     (0xC0)
+#define FILE_NAME_CHARS_PER_ENTRY           (15)
+#define MAX_FILE_NAME_LENGTH                (255)
+#define FILE_ATTR_DIR                       (1 << 4)
+#define STREAM_FLAG_NO_FAT_CHAIN            (1 << 1)
+
+#define FAT_ENTRIES_PER_SECTOR              (SECTOR_SIZE / sizeof(uint32_t))
+
+/**
+ * Data structure to access partition table entry fields
+ */
+typedef struct {
+    uint8_t boot_indicator;
+    uint8_t starting_head;
+    uint16_t starting_sector_and_cylinder;
+    uint8_t system_id;
+    uint8_t ending_head;
+    uint16_t ending_sector_and_cylinder;
+    uint32_t starting_lba;
+    uint32_t total_sectors;
+} Partition_Table_Entry;
+
+/**
+ * Data structure to access exFAT boot sector fields
+ */
+typedef struct {
+    uint8_t jmp[3];
+    uint8_t filesystem_name[8];
+    uint8_t must_be_zero[53];
+    uint64_t partition_offset;
+    uint64_t volume_length;
+    uint32_t fat_offset;
+    uint32_t fat_length;
+    uint32_t cluster_heap_offset;
+    uint32_t cluster_count;
+    uint32_t root_dir_first_cluster;
+    uint32_t volume_serial_number;
+    uint16_t filesystem_revision;
+    uint16_t volume_flags;
+    uint8_t bytes_per_sector_shift;
+    uint8_t sectors_per_cluster_shift;
+    uint8_t number_of_fats;
+    uint8_t drive_select;
+    uint8_t percent_in_use;
+    uint8_t __reserved[7];
+    uint8_t boot_code[390];
+    uint16_t boot_signature;
+} __attribute__((packed)) EXFAT_Boot_Sector;
+
+/**
+ * Data structure to access fields of file directory entry, the primary entry
+ * of a file's entry set
+ */
+typedef struct {
+    uint8_t entry_type;
+    uint8_t secondary_count;
+    uint16_t set_checksum;
+    uint16_t file_attributes;
+    uint8_t __timestamps_and_reserved[26];
+} __attribute__((packed)) EXFAT_File_Dir_Entry;
+
+/**
+ * Data structure to access fields of stream extension directory entry, which
+ * describes where a file's data is
+ */
+typedef struct {
+    uint8_t entry_type;
+    uint8_t general_secondary_flags;
+    uint8_t __reserved1;
+    uint8_t name_length;
+    uint16_t name_hash;
+    uint16_t __reserved2;
+    uint64_t valid_data_length;
+    uint32_t __reserved3;
+    uint32_t first_cluster;
+    uint64_t data_length;
+} __attribute__((packed)) EXFAT_Stream_Dir_Entry;
+
+/**
+ * Data structure to access fields of file name directory entry, holding a
+ * part of a file's name in UTF-16
+ */
+typedef struct {
+    uint8_t entry_type;
+    uint8_t general_secondary_flags;
+    uint16_t file_name[FILE_NAME_CHARS_PER_ENTRY];
+} __attribute__((packed)) EXFAT_Name_Dir_Entry;
+
+/**
+ * Where a file's data is, as found in its directory entry set
+ */
+typedef struct {
+    uint32_t first_cluster;
+    uint32_t size;
+    uint8_t no_fat_chain;   // Non-zero if the clusters are contiguous
+} EXFAT_File;
+
+/**
+ * Progress of streaming a file's data to the data processing callback
+ */
+typedef struct {
+    uint32_t data_offset;   // Offset of the next data byte in the file
+    uint32_t bytes_left;    // Bytes of the file not processed yet
+} File_Read_State;
+
+/*
+ * Internal data structures to use when working with exFAT filesystem
+ */
+static const Block_Device *block_device;
+static uint32_t fat_begin_lba;
+static uint32_t cluster_heap_lba;
+static uint32_t cluster_count;
+static uint8_t sectors_per_cluster_shift;
+static uint32_t root_dir_first_cluster;
+static uint8_t sector_buffer[SECTOR_SIZE];
+
+// Last FAT sector read, since consecutive clusters share FAT sectors
+static uint8_t fat_cache_valid;
+static uint32_t fat_cache_lba;
+static uint32_t fat_cache[FAT_ENTRIES_PER_SECTOR];
+
+static EXFAT_Read_Stats read_stats;
+
+static uint32_t Find_Volume_LBA(void);
+static EXFAT_Status Find_File(const char *restrict const filename,
+        EXFAT_File *restrict const file);
+static EXFAT_Status Get_Next_Cluster(const uint32_t cluster,
+        uint32_t *restrict const next_cluster);
+static EXFAT_Status Read_Extent(const uint32_t cluster, const uint32_t sectors,
+        uint8_t *restrict const buffer, const uint32_t buffer_size,
+        DataBufferProcessingCallback cb, File_Read_State *restrict const state);
+static inline uint8_t Is_Data_Cluster(const uint32_t cluster);
+static inline uint32_t Cluster_To_LBA(const uint32_t cluster);
+static inline uint32_t Min(const uint32_t a, const uint32_t b);
+static inline char to_upper(const char c);
+
+EXFAT_Status EXFAT_Init(const Block_Device *restrict const dev) {
+    block_device = dev;
+    fat_cache_valid = 0;
+
+    const uint32_t volume_lba = Find_Volume_LBA();
+    if (volume_lba == UINT32_MAX) {
+        return EXFAT_INIT_PARTITION_DISCOVERY_ERR;
+    }
+
+    if (Block_Device_Read_Blocks(block_device, volume_lba, 1, sector_buffer)
+            != BLOCK_DEVICE_OK) {
+        return EXFAT_INIT_PARTITION_READ_ERR;
+    }
+
+    const EXFAT_Boot_Sector *restrict const boot_sector =
+            (EXFAT_Boot_Sector*) sector_buffer;
+    if ((memcmp(boot_sector->filesystem_name, EXFAT_FILESYSTEM_NAME,
+            sizeof(boot_sector->filesystem_name)) != 0)
+            || (boot_sector->boot_signature != BOOT_SIGNATURE)
+            || (boot_sector->number_of_fats == 0)
+            || (boot_sector->number_of_fats > 2)) {
+        return EXFAT_INIT_INVALID_BOOT_SECTOR;
+    }
+    if (boot_sector->bytes_per_sector_shift
+            != SUPPORTED_BYTES_PER_SECTOR_SHIFT) {
+        return EXFAT_INIT_UNSUPPORTED_SECTOR_SIZE;
+    }
+    if (boot_sector->sectors_per_cluster_shift
+            > MAX_SECTORS_PER_CLUSTER_SHIFT) {
+        return EXFAT_INIT_UNSUPPORTED_SECTORS_PER_CLUSTER;
+    }
+
+    // With 2 FATs, the volume flags tell which one is in use
+    fat_begin_lba = volume_lba + boot_sector->fat_offset;
+    if ((boot_sector->number_of_fats == 2)
+            && (boot_sector->volume_flags & VOLUME_FLAG_ACTIVE_FAT)) {
+        fat_begin_lba += boot_sector->fat_length;
+    }
+    cluster_heap_lba = volume_lba + boot_sector->cluster_heap_offset;
+    cluster_count = boot_sector->cluster_count;
+    sectors_per_cluster_shift = boot_sector->sectors_per_cluster_shift;
+    root_dir_first_cluster = boot_sector->root_dir_first_cluster;
+    if (!Is_Data_Cluster(root_dir_first_cluster)) {
+        return EXFAT_INIT_INVALID_BOOT_SECTOR;
+    }
+
+    return EXFAT_OK;
+}
+
+EXFAT_Status EXFAT_Read_File_From_Root_Dir_And_Process_Data(
+        const char *restrict const filename, uint8_t *restrict const buffer,
+        const uint32_t buffer_size, DataBufferProcessingCallback cb) {
+    const uint32_t cluster_size = SECTOR_SIZE << sectors_per_cluster_shift;
+    EXFAT_File file;
+    File_Read_State state = { 0 };
+    uint32_t current_cluster;
+    uint32_t next_cluster;
+    uint32_t clusters;
+    EXFAT_Status ret;
+
+    if (buffer_size < SECTOR_SIZE) {
+        return EXFAT_READ_BUFFER_TOO_SMALL;
+    }
+
+    ret = Find_File(filename, &file);
+    if (ret != EXFAT_OK) {
+        return ret;
+    }
+    read_stats.files++;
+    state.bytes_left = file.size;
+    if (state.bytes_left == 0) {
+        return EXFAT_OK;
+    }
+    if (!Is_Data_Cluster(file.first_cluster)) {
+        return EXFAT_READ_FILE_ERR;
+    }
+
+    // Contiguous files are read in one go from their first sector, without
+    // looking at FAT. Their clusters must all lie within the cluster heap
+    if (file.no_fat_chain) {
+        clusters = ((uint64_t) file.size + cluster_size - 1) / cluster_size;
+        if (clusters > (cluster_count - (file.first_cluster
+                - FIRST_DATA_CLUSTER))) {
+            return EXFAT_READ_FILE_ERR;
+        }
+        read_stats.contiguous_files++;
+        return Read_Extent(file.first_cluster,
+                ((uint64_t) file.size + SECTOR_SIZE - 1) / SECTOR_SIZE, buffer,
+                buffer_size, cb, &state);
+    }
+
+    current_cluster = file.first_cluster;
+    do {
+        // Follow the cluster chain as long as clusters are physically
+        // contiguous and the file still has data left
+        clusters = 1;
+        if (Get_Next_Cluster(current_cluster, &next_cluster) != EXFAT_OK) {
+            return EXFAT_READ_FAT_READ_ERR;
+        }
+        while ((next_cluster == (current_cluster + clusters))
+                && (((uint64_t) clusters * cluster_size) < state.bytes_left)) {
+            clusters++;
+            if (Get_Next_Cluster(next_cluster, &next_cluster) != EXFAT_OK) {
+                return EXFAT_READ_FAT_READ_ERR;
+            }
+        }
+
+        ret = Read_Extent(current_cluster, clusters << sectors_per_cluster_shift,
+                buffer, buffer_size, cb, &state);
+        if (ret != EXFAT_OK) {
+            return ret;
+        }
+
+        // Continue with the cluster which ended the extent
+        current_cluster = next_cluster;
+    } while (Is_Data_Cluster(current_cluster) && (state.bytes_left > 0));
+
+    return EXFAT_OK;
+}
+
+void EXFAT_Get_Read_Stats(EXFAT_Read_Stats *restrict const stats) {
+    *stats = read_stats;
+}
+
+/**
+ * Find the first sector of the exFAT volume. Cards are normally partitioned,
+ * but can also be formatted without a partition table
+ *
+ * @return  LBA of the volume's boot sector. UINT32_MAX indicates error.
+ */
+static uint32_t Find_Volume_LBA(void) {
+    uint32_t volume_lba = UINT32_MAX;
+
+    if (Block_Device_Read_Blocks(block_device, 0, 1, sector_buffer)
+            != BLOCK_DEVICE_OK) {
+        return UINT32_MAX;
+    }
+    if (memcmp(&sector_buffer[offsetof(EXFAT_Boot_Sector, filesystem_name)],
+            EXFAT_FILESYSTEM_NAME, strlen(EXFAT_FILESYSTEM_NAME)) == 0) {
+        return 0;
+    }
+
+    // Iterate over all primary partition entries and use the lowest one
+    const Partition_Table_Entry *pentry =
+            (const Partition_Table_Entry*) (sector_buffer
+                    + PARTITION_TABLE_FIRST_ENTRY_OFFSET);
+    for (uint8_t i = 0; i < MAX_PRIMARY_PARTITIONS; i++) {
+        if ((pentry->system_id == PARTITION_TYPE_EXFAT)
+                && (pentry->starting_lba < volume_lba)) {
+            volume_lba = pentry->starting_lba;
+        }
+        pentry++;
+    }
+    return volume_lba;
+}
+
+/**
+ * Find a file in the root directory by walking the entry sets. An entry set
+ * starts with a file entry, followed by a stream extension entry and file name
+ * entries, which can be split across sectors and clusters
+ *
+ * @param filename  (IN)    Name of file to find
+ * @param file      (OUT)   Variable to store where the file's data is
+ *
+ * @return  Status of finding the file
+ */
+static EXFAT_Status Find_File(const char *restrict const filename,
+        EXFAT_File *restrict const file) {
+    const uint32_t filename_length = strlen(filename);
+    uint32_t current_cluster = root_dir_first_cluster;
+    uint8_t entries_left = 0;   // Secondary entries left in the entry set
+    uint8_t name_matches = 0;
+    uint8_t has_stream = 0;
+    uint8_t is_too_large = 0;
+    uint32_t name_offset = 0;
+    const uint8_t *restrict entry = NULL;
+
+    if ((filename_length == 0) || (filename_length > MAX_FILE_NAME_LENGTH)) {
+        return EXFAT_READ_FILE_NOT_FOUND;
+    }
+
+    do {
+        for (uint32_t sector = 0; sector < (1UL << sectors_per_cluster_shift);
+                sector++) {
+            if (Block_Device_Read_Blocks(block_device,
+                    Cluster_To_LBA(current_cluster) + sector, 1, sector_buffer)
+                    != BLOCK_DEVICE_OK) {
+                return EXFAT_READ_DIR_ERR;
+            }
+
+            entry = sector_buffer;
+            for (uint32_t i = 0; i < DIR_ENTRIES_PER_SECTOR;
+                    i++, entry += DIR_ENTRY_SIZE) {
+                if (entry[0] == DIR_ENTRY_TYPE_END_OF_DIR) {
+                    return EXFAT_READ_FILE_NOT_FOUND;
+                }
+
+                if ((entries_left == 0)
+                        || ((entry[0] & DIR_ENTRY_IN_USE_SECONDARY_MASK)
+                                != DIR_ENTRY_IN_USE_SECONDARY_MASK)) {
+                    // Any entry other than an in use secondary entry ends the
+                    // current entry set
+                    entries_left = 0;
+                    if (entry[0] == DIR_ENTRY_TYPE_FILE) {
+                        const EXFAT_File_Dir_Entry *restrict const file_entry =
+                                (const EXFAT_File_Dir_Entry*) entry;
+                        entries_left = file_entry->secondary_count;
+                        name_matches = !(file_entry->file_attributes
+                                & FILE_ATTR_DIR);
+                        has_stream = 0;
+                        name_offset = 0;
+                    }
+                    continue;
+                }
+
+                entries_left--;
+                if (entry[0] == DIR_ENTRY_TYPE_STREAM_EXTENSION) {
+                    const EXFAT_Stream_Dir_Entry *restrict const stream =
+                            (const EXFAT_Stream_Dir_Entry*) entry;
+                    if (stream->name_length != filename_length) {
+                        name_matches = 0;
+                    }
+                    has_stream = 1;
+                    is_too_large = (stream->valid_data_length > UINT32_MAX);
+                    file->first_cluster = stream->first_cluster;
+                    file->size = (uint32_t) stream->valid_data_length;
+                    file->no_fat_chain = ((stream->general_secondary_flags
+                            & STREAM_FLAG_NO_FAT_CHAIN) != 0);
+                } else if (entry[0] == DIR_ENTRY_TYPE_FILE_NAME) {
+                    const EXFAT_Name_Dir_Entry *restrict const name =
+                            (const EXFAT_Name_Dir_Entry*) entry;
+                    for (uint8_t j = 0; (j < FILE_NAME_CHARS_PER_ENTRY)
+                            && (name_offset < filename_length); j++) {
+                        // Only ASCII characters are compared without case
+                        if ((name->file_name[j] >= 0x80)
+                                || (to_upper((char) name->file_name[j])
+                                        != to_upper(filename[name_offset]))) {
+                            name_matches = 0;
+                        }
+                        name_offset++;
+                    }
+                }
+
+                if ((entries_left == 0) && name_matches && has_stream
+                        && (name_offset == filename_length)) {
+                    if (is_too_large) {
+                        return EXFAT_READ_FILE_TOO_LARGE;
+                    }
+                    return EXFAT_OK;
+                }
+            }
+        }
+
+        // Directories are always followed through FAT
+        if (Get_Next_Cluster(current_cluster, &current_cluster) != EXFAT_OK) {
+            return EXFAT_READ_FAT_READ_ERR;
+        }
+    } while (Is_Data_Cluster(current_cluster));
+
+    return EXFAT_READ_FILE_NOT_FOUND;
+}
+
+/**
+ * Look up the cluster following the given one in the cluster chain
+ *
+ * @param cluster       (IN)    Cluster to find the next cluster for
+ * @param next_cluster  (OUT)   Variable to store the next cluster in
+ *
+ * @return  Status of reading the FAT entry
+ */
+static EXFAT_Status Get_Next_Cluster(const uint32_t cluster,
+        uint32_t *restrict const next_cluster) {
+    const uint32_t lba = fat_begin_lba + (cluster / FAT_ENTRIES_PER_SECTOR);
+
+    if (!fat_cache_valid || (fat_cache_lba != lba)) {
+        fat_cache_valid = 0;
+        read_stats.fat_reads++;
+        if (Block_Device_Read_Blocks(block_device, lba, 1,
+                (uint8_t*) fat_cache) != BLOCK_DEVICE_OK) {
+            return EXFAT_READ_FAT_READ_ERR;
+        }
+        fat_cache_valid = 1;
+        fat_cache_lba = lba;
+    }
+    *next_cluster = fat_cache[cluster % FAT_ENTRIES_PER_SECTOR];
+    return EXFAT_OK;
+}
+
+/**
+ * Stream sectors of file data starting at a cluster into user provided
+ * buffer, in chunks as large as the buffer allows, and call the data
+ * processing callback with each chunk
+ *
+ * @param cluster       (IN)    First cluster of the data
+ * @param sectors       (IN)    Number of contiguous sectors to read
+ * @param buffer        (OUT)   Buffer to read the chunks into
+ * @param buffer_size   (IN)    Size of the buffer
+ * @param cb            (IN)    Function to call to process each chunk
+ * @param state         (IN/OUT)    Progress of reading the file
+ *
+ * @return  Status of reading and processing the data
+ */
+static EXFAT_Status Read_Extent(const uint32_t cluster, const uint32_t sectors,
+        uint8_t *restrict const buffer, const uint32_t buffer_size,
+        DataBufferProcessingCallback cb, File_Read_State *restrict const state) {
+    const uint32_t max_chunk_sectors = buffer_size / SECTOR_SIZE;
+    uint32_t lba = Cluster_To_LBA(cluster);
+    uint32_t sectors_left = sectors;
+    uint32_t chunk_sectors;
+    uint32_t data_size;
+
+    read_stats.extents++;
+
+    // Nothing after the extent or the end of the file is going to be read
+    Block_Device_Hint_Sequential_Read(block_device, lba,
+            lba + Min(sectors,
+                    (state->bytes_left + SECTOR_SIZE - 1) / SECTOR_SIZE));
+
+    while ((sectors_left > 0) && (state->bytes_left > 0)) {
+        chunk_sectors = Min(Min(sectors_left, max_chunk_sectors),
+                (state->bytes_left + SECTOR_SIZE - 1) / SECTOR_SIZE);
+        if (Block_Device_Read_Blocks(block_device, lba, chunk_sectors, buffer)
+                != BLOCK_DEVICE_OK) {
+            return EXFAT_READ_FILE_ERR;
+        }
+
+        // Process the chunk's data using user provided callback
+        data_size = Min(chunk_sectors * SECTOR_SIZE, state->bytes_left);
+        if ((*cb)(state->data_offset, buffer, data_size)
+                != DATA_PROCESSING_OK) {
+            return EXFAT_READ_FILE_DATA_PROCESS_ERR;
+        }
+
+        state->bytes_left -= data_size;
+        state->data_offset += data_size;
+        lba += chunk_sectors;
+        sectors_left -= chunk_sectors;
+    }
+    return EXFAT_OK;
+}
+
+/**
+ * Check if a cluster number refers to a cluster in the cluster heap, rather
+ * than marking the end of a chain or a bad cluster
+ *
+ * @param cluster   (IN)    Cluster number
+ *
+ * @return  Non-zero if the cluster holds data
+ */
+static inline uint8_t Is_Data_Cluster(const uint32_t cluster) {
+    return ((cluster >= FIRST_DATA_CLUSTER)
+            && ((cluster - FIRST_DATA_CLUSTER) < cluster_count));
+}
+
+/**
+ * Get the logical block address of the first sector of a cluster
+ *
+ * @param cluster   (IN)    Cluster number
+ *
+ * @return  LBA of the cluster's first sector
+ */
+static inline uint32_t Cluster_To_LBA(const uint32_t cluster) {
+    return cluster_heap_lba
+            + ((cluster - FIRST_DATA_CLUSTER) << sectors_per_cluster_shift);
+}
+
+/**
+ * Helper function to compare two integers and find the minimum one
+ *
+ * @param a (IN)    Integer to compare
+ * @param b (IN)    Integer to compare
+ *
+ * @return  Minimum value out of the provided integers
+ */
+static inline uint32_t Min(const uint32_t a, const uint32_t b) {
+    if (a < b) {
+        return a;
+    }
+    return b;
+}
+
+/**
+ * Helper function to convert lowercase character to uppercase character
+ *
+ * @param c (IN)    Character to convert to uppercase
+ *
+ * @return  Uppercase character if input is a lowercase character. Otherwise the
+ *             input character is returned as it is.
+ */
+static inline char to_upper(const char c) {
+    if ((c >= 'a') && (c <= 'z')) {
+        return (c + ('A' - 'a'));
+    }
+    return c;
+}
@@ -1,5 +1,6 @@
 #include <stddef.h>
-#include "sdcard.h"
+#include <string.h>
+#include "block_device.h"
 #include "fat32.h"
 #include "main.h"
 
@@ -14,29 +15,123 @@
 #define FAT32_EBPB_SIGNATURE2                   (0x29)
 #define FAT32_BOOT_PARTITION_SIGNATURE          (0xAA55)
 #define UNUSED_DIR_ENTRY_NAME_FIRST_BYTE        (0xE5)
+#define ESCAPED_E5_DIR_ENTRY_NAME_FIRST_BYTE    (0x05)
+#define DOT_DIR_ENTRY_NAME_FIRST_BYTE           ('.')
+#define PATH_SEPARATOR                          ('/')
 #define EXPECTED_FAT_COUNT                      (2)
 
 /*
- * File attribute values from https://wiki.osdev.org/FAT32#Standard_8.3_format
+ * Number of FAT sectors kept in cache. One FAT sector holds the entries for
+ * 128 consecutive clusters. A second entry keeps the cluster chain of the
+ * root directory cached while a file is being read
  */
-#define FAT32_FILE_ATTR_RD_ONLY         (1 << 0)
-#define FAT32_FILE_ATTR_HIDDEN          (1 << 1)
-#define FAT32_FILE_ATTR_SYSTEM          (1 << 2)
-#define FAT32_FILE_ATTR_VOL_ID          (1 << 3)
-#define FAT32_FILE_ATTR_DIR             (1 << 4)
-#define FAT32_FILE_ATTR_ARCHIVE         (1 << 5)
-#define FAT32_FILE_ATTR_LONG_FILENAME   (0xF)
+#define FAT_CACHE_ENTRIES               (2)
+
+// FAT entries with this value or above mark the end of a cluster chain
+#define FAT32_CLUSTER_CHAIN_END         (0x0FFFFFF8)
+
+// Directory entries in one sector
+#define DIR_ENTRIES_PER_SECTOR          (SECTOR_SIZE / sizeof(DIR_8_3_Record))
+
+// Image names are decimal numbers which fit in the 8 characters of 8.3 names
+#define IMAGE_NUMBER_MAX_DIGITS         (8)
+
+// Largest cluster size supported by FAT32 is 128 sectors of 512 bytes
+#define MAX_SECTORS_PER_CLUSTER         (128)
+#define FAT_ENTRIES_PER_SECTOR          (SECTOR_SIZE / sizeof(uint32_t))
 
 /*
  * Internal data structures to use when working with FAT32 filesystem
  */
+static const Block_Device *block_device;
+static uint32_t partition_lba;
+static uint32_t volume_id;
 static uint32_t fat_begin_lba;
+static uint32_t fat_sectors;
 static uint32_t cluster_begin_lba;
-// We can skip this since we check that it should be a fixed value during
-// initialization
-// static uint32_t sectors_per_cluster;
+static uint32_t sectors_per_cluster;
 static uint32_t root_dir_first_cluster;
-static uint8_t cluster_cache[SECTORS_PER_CLUSTER * SECTOR_SIZE];
+// Clusters can be up to 64 KB, so metadata is read one sector at a time
+static uint8_t sector_buffer[SECTOR_SIZE];
+
+/**
+ * FAT sector cached in memory, tagged by its LBA
+ */
+typedef struct {
+    uint8_t valid;
+    uint32_t lba;
+    uint32_t last_used;
+    uint32_t entries[FAT_ENTRIES_PER_SECTOR];
+} FAT_Cache_Entry;
+
+static FAT_Cache_Entry fat_cache[FAT_CACHE_ENTRIES];
+static uint32_t fat_cache_lookups;
+static FAT32_Cache_Stats fat_cache_stats;
+static FAT32_Read_Stats read_stats;
+
+/**
+ * Position of a file's entry in a directory
+ */
+typedef struct {
+    uint32_t lba;           // LBA of the directory sector holding the entry
+    uint32_t index;         // Index of the entry in the sector
+} Dir_Entry_Location;
+
+/**
+ * Numerically named image in the root directory
+ */
+typedef struct {
+    uint32_t number;        // N for file N.bin
+    uint32_t first_cluster;
+    uint32_t file_size;
+    Dir_Entry_Location entry_location;
+} Image_Index_Entry;
+
+/**
+ * Root directory index of images sorted by their number. If the directory has
+ * more images than fit, the ones with the smallest numbers are kept
+ */
+typedef struct {
+    uint8_t built;
+    uint8_t complete;       // Zero if some images did not fit in the index
+    uint32_t count;
+    Image_Index_Entry entries[FAT32_IMAGE_INDEX_ENTRIES];
+} Image_Index;
+
+static Image_Index image_index;
+static FAT32_Index_Stats index_stats;
+
+/**
+ * Position of a sector in a directory
+ */
+typedef struct {
+    uint32_t cluster;
+    uint32_t sector;        // Sector inside the cluster
+} Dir_Position;
+
+/**
+ * Directory resolved from a path. Lookups in the directory start from the
+ * sector where the previous lookup found its file, since images in an album are
+ * usually looked up in the order they were written
+ */
+typedef struct {
+    uint8_t valid;
+    uint32_t last_used;
+    char path[FAT32_PATH_MAX_LENGTH];   // Path without leading or trailing '/'
+    uint32_t first_cluster;
+    Dir_Position resume;
+} Dir_Cache_Entry;
+
+static Dir_Cache_Entry dir_cache[FAT32_DIR_CACHE_ENTRIES];
+static uint32_t dir_cache_lookups;
+
+/**
+ * Progress of streaming a file's data to the data processing callback
+ */
+typedef struct {
+    uint32_t data_offset;   // Offset of the next data byte in the file
+    uint32_t bytes_left;    // Bytes of the file not processed yet
+} File_Read_State;
 
 /**
  * Data structure to access partition table entry fields
@@ -113,27 +208,558 @@ typedef struct {
     uint32_t file_size;
 } __attribute__((packed)) DIR_8_3_Record;
 
+/**
+ * Function called for each file entry found while scanning a directory
+ *
+ * @param dir_record        (IN)    Directory entry of the file
+ * @param entry_location    (IN)    Position of the entry in the directory
+ * @param ctx               (IN)    Context pointer provided for the scan
+ *
+ * @return  True to stop the scan. False to continue with the next entry.
+ */
+typedef Boolean (*Dir_Entry_Visitor)(
+        const DIR_8_3_Record *restrict const dir_record,
+        const Dir_Entry_Location *restrict const entry_location, void *ctx);
+
+/**
+ * Context for finding a file by its name while scanning a directory
+ */
+typedef struct {
+    const char *filename;
+    uint32_t *file_begin_cluster;
+    uint32_t *file_size;
+    Dir_Entry_Location *entry_location; // NULL if not needed
+} Filename_Match_Ctx;
+
+/**
+ * Kind of entries passed to the visitor while scanning a directory
+ */
+typedef enum {
+    SCAN_FILES,
+    SCAN_DIRS,
+} Dir_Scan_Kind;
+
+/**
+ * Context for enumerating a directory through the public API
+ */
+typedef struct {
+    FAT32_Dir_Entry_Callback cb;
+    void *cb_ctx;
+    uint8_t indexing;       // Non-zero if the scan also builds the image index
+    uint8_t stopped;        // Non-zero if the callback stopped the scan
+} Enumerate_Ctx;
+
 static uint32_t Get_Lowest_Partition_LBA(void);
+static FAT32_Status Mount_Partition(const uint32_t partition_begin_lba);
+static FAT32_Status Find_Extent(const uint32_t cluster, const uint32_t bytes_left,
+        uint32_t *restrict const clusters,
+        uint32_t *restrict const next_cluster);
+static FAT32_Status Read_Extent(const uint32_t cluster, const uint32_t clusters,
+        uint8_t *restrict const buffer, const uint32_t buffer_size,
+        DataBufferProcessingCallback cb, File_Read_State *restrict const state);
+static FAT32_Status Read_Cluster_Chain(const uint32_t cluster,
+        uint8_t *restrict const buffer, const uint32_t buffer_size,
+        DataBufferProcessingCallback cb, File_Read_State *restrict const state);
 static void Get_File_Begin_Cluster_And_Size(const char *restrict const filename,
         uint32_t *restrict const file_begin_cluster,
-        uint32_t *restrict const file_size);
+        uint32_t *restrict const file_size,
+        Dir_Entry_Location *restrict const entry_location);
 static Boolean Filenames_Match(
         const char *restrict const fat32_direntry_filename,
         const char *restrict const filename);
+static FAT32_Status Scan_Dir(const uint32_t first_cluster,
+        Dir_Position *restrict const position, const Dir_Scan_Kind kind,
+        Dir_Entry_Visitor visitor, void *ctx);
+static FAT32_Status Find_File_At_Path(const char *restrict const path,
+        uint32_t *restrict const file_begin_cluster,
+        uint32_t *restrict const file_size,
+        Dir_Entry_Location *restrict const entry_location);
+static FAT32_Status Resolve_Dir(const char *restrict const path,
+        const uint32_t length, Dir_Cache_Entry **const dir);
+static Dir_Cache_Entry* Insert_Dir_Cache_Entry(const char *restrict const path,
+        const uint32_t length, const uint32_t first_cluster);
+static void Find_File_In_Cached_Dir(Dir_Cache_Entry *restrict const dir,
+        const char *restrict const filename,
+        uint32_t *restrict const file_begin_cluster,
+        uint32_t *restrict const file_size,
+        Dir_Entry_Location *restrict const entry_location);
+static FAT32_Status Locate_File(const uint32_t file_begin_cluster,
+        const uint32_t file_size,
+        const Dir_Entry_Location *restrict const entry_location,
+        FAT32_File_Location *restrict const location);
+static FAT32_Status Seek_To_Cluster(FAT32_File *restrict const file,
+        const uint32_t index);
+static Boolean Match_Filename_Visitor(
+        const DIR_8_3_Record *restrict const dir_record,
+        const Dir_Entry_Location *restrict const entry_location, void *ctx);
+static Boolean Index_Image_Visitor(
+        const DIR_8_3_Record *restrict const dir_record,
+        const Dir_Entry_Location *restrict const entry_location, void *ctx);
+static Boolean Enumerate_Visitor(
+        const DIR_8_3_Record *restrict const dir_record,
+        const Dir_Entry_Location *restrict const entry_location, void *ctx);
+static void Reset_Image_Index(void);
+static void Format_Dir_Entry_Filename(
+        const DIR_8_3_Record *restrict const dir_record,
+        char *restrict const filename);
+static void Build_Image_Index(void);
+static const Image_Index_Entry* Find_In_Image_Index(const uint32_t number);
+static Boolean Parse_Image_Filename(const char *restrict const filename,
+        uint32_t *restrict const number);
+static Boolean Parse_Image_Dir_Entry(
+        const DIR_8_3_Record *restrict const dir_record,
+        uint32_t *restrict const number);
+static FAT32_Status Read_File_Data(const uint32_t cluster,
+        uint8_t *restrict const buffer, const uint32_t buffer_size,
+        DataBufferProcessingCallback cb, File_Read_State *restrict const state);
+static FAT32_Status Check_Chain_Contiguous(const uint32_t cluster,
+        const uint32_t clusters, Boolean *restrict const is_contiguous);
+static FAT32_Status Get_FAT_Sector(const uint32_t lba,
+        const uint32_t **restrict const entries);
+static FAT32_Status Get_Next_Cluster(const uint32_t cluster,
+        uint32_t *restrict const next_cluster);
+static inline uint32_t Cluster_To_LBA(const uint32_t cluster);
 static inline uint32_t Min(const uint32_t a, const uint32_t b);
 static inline char to_upper(char c);
 
-FAT32_Status FAT32_Init(void) {
+FAT32_Status FAT32_Init(const Block_Device *restrict const dev) {
+    block_device = dev;
+
+    // Cached FAT sectors may belong to a different device
+    for (uint8_t i = 0; i < FAT_CACHE_ENTRIES; i++) {
+        fat_cache[i].valid = 0;
+    }
+
     const uint32_t lowest_partition_lba = Get_Lowest_Partition_LBA();
     if (lowest_partition_lba == 0) {
         return FAT32_INIT_PARTITION_DISCOVERY_ERR;
     }
 
-    if (SDC_Read_Sector(lowest_partition_lba, cluster_cache) != SDC_OK) {
+    return Mount_Partition(lowest_partition_lba);
+}
+
+FAT32_Status FAT32_Init_From_Location(const Block_Device *restrict const dev,
+        const FAT32_File_Location *restrict const location) {
+    const DIR_8_3_Record *restrict dir_record = NULL;
+    FAT32_Status ret;
+
+    block_device = dev;
+    for (uint8_t i = 0; i < FAT_CACHE_ENTRIES; i++) {
+        fat_cache[i].valid = 0;
+    }
+
+    // Partition table is skipped, and the BPB read is enough to check that the
+    // card still holds the volume the location was resolved on
+    ret = Mount_Partition(location->partition_lba);
+    if (ret != FAT32_OK) {
+        return ret;
+    }
+    if ((location->volume_id != volume_id) || (location->extent_count == 0)
+            || (location->extent_count > FAT32_LOCATION_MAX_EXTENTS)
+            || (location->dir_entry_index >= DIR_ENTRIES_PER_SECTOR)) {
+        return FAT32_INIT_VOLUME_MISMATCH;
+    }
+
+    // Same volume can have had the file replaced, moved or deleted since. Its
+    // directory entry has to still describe the data the location points to
+    if (Block_Device_Read_Blocks(block_device, location->dir_entry_lba, 1,
+            sector_buffer) != BLOCK_DEVICE_OK) {
+        return FAT32_READ_FILE_ERR;
+    }
+    dir_record = ((const DIR_8_3_Record*) sector_buffer)
+            + location->dir_entry_index;
+    if ((dir_record->filename_8_3[0] == '\0')
+            || (dir_record->filename_8_3[0] == UNUSED_DIR_ENTRY_NAME_FIRST_BYTE)
+            || ((((uint32_t) dir_record->first_cluster_high << 16)
+                    | (uint32_t) dir_record->first_cluster_low)
+                    != location->extents[0].first_cluster)
+            || (dir_record->file_size != location->file_size)) {
+        return FAT32_INIT_LOCATION_STALE;
+    }
+    return FAT32_OK;
+}
+
+FAT32_Status FAT32_Read_File_From_Root_Dir_And_Process_Data(
+        const char *restrict const filename, uint8_t *restrict const buffer,
+        const uint32_t buffer_size, DataBufferProcessingCallback cb) {
+    uint32_t file_begin_cluster;
+    File_Read_State state = { 0 };
+
+    if (buffer_size < SECTOR_SIZE) {
+        return FAT32_READ_BUFFER_TOO_SMALL;
+    }
+
+    // Find where the file starts and how long is it
+    Get_File_Begin_Cluster_And_Size(filename, &file_begin_cluster,
+            &state.bytes_left, NULL);
+    if (file_begin_cluster == 0) {
+        return FAT32_READ_FILE_NOT_FOUND;
+    }
+    read_stats.files++;
+
+    return Read_File_Data(file_begin_cluster, buffer, buffer_size, cb, &state);
+}
+
+FAT32_Status FAT32_Read_File_At_Path_And_Process_Data(
+        const char *restrict const path, uint8_t *restrict const buffer,
+        const uint32_t buffer_size, DataBufferProcessingCallback cb) {
+    uint32_t file_begin_cluster;
+    File_Read_State state = { 0 };
+    FAT32_Status ret;
+
+    if (buffer_size < SECTOR_SIZE) {
+        return FAT32_READ_BUFFER_TOO_SMALL;
+    }
+
+    ret = Find_File_At_Path(path, &file_begin_cluster, &state.bytes_left,
+            NULL);
+    if (ret != FAT32_OK) {
+        return ret;
+    }
+    if (file_begin_cluster == 0) {
+        return FAT32_READ_FILE_NOT_FOUND;
+    }
+    read_stats.files++;
+
+    return Read_File_Data(file_begin_cluster, buffer, buffer_size, cb, &state);
+}
+
+FAT32_Status FAT32_Locate_File_In_Root_Dir(const char *restrict const filename,
+        FAT32_File_Location *restrict const location) {
+    uint32_t file_begin_cluster;
+    uint32_t file_size;
+    Dir_Entry_Location entry_location;
+
+    Get_File_Begin_Cluster_And_Size(filename, &file_begin_cluster, &file_size,
+            &entry_location);
+    return Locate_File(file_begin_cluster, file_size, &entry_location,
+            location);
+}
+
+FAT32_Status FAT32_Locate_File_At_Path(const char *restrict const path,
+        FAT32_File_Location *restrict const location) {
+    uint32_t file_begin_cluster;
+    uint32_t file_size;
+    Dir_Entry_Location entry_location;
+    FAT32_Status ret;
+
+    ret = Find_File_At_Path(path, &file_begin_cluster, &file_size,
+            &entry_location);
+    if (ret != FAT32_OK) {
+        location->extent_count = 0;
+        return ret;
+    }
+    return Locate_File(file_begin_cluster, file_size, &entry_location,
+            location);
+}
+
+FAT32_Status FAT32_File_Open(const char *restrict const path,
+        FAT32_File *restrict const file) {
+    const uint32_t cluster_size = sectors_per_cluster * SECTOR_SIZE;
+    uint32_t file_begin_cluster;
+    uint32_t clusters;
+    FAT32_Status ret;
+
+    file->is_open = 0;
+    ret = Find_File_At_Path(path, &file_begin_cluster, &file->file_size,
+            NULL);
+    if (ret != FAT32_OK) {
+        return ret;
+    }
+    if (file_begin_cluster == 0) {
+        return FAT32_READ_FILE_NOT_FOUND;
+    }
+
+    // Spread the checkpoints over the whole file. They are recorded while the
+    // chain is followed by reads
+    clusters = (file->file_size + cluster_size - 1) / cluster_size;
+    if (clusters == 0) {
+        clusters = 1;
+    }
+    file->checkpoint_interval = (clusters + FAT32_FILE_CHECKPOINTS - 1)
+            / FAT32_FILE_CHECKPOINTS;
+    file->checkpoints[0] = file_begin_cluster & 0x0FFFFFFF;
+    file->checkpoint_count = 1;
+    file->current_cluster = file->checkpoints[0];
+    file->cluster_index = 0;
+    file->position = 0;
+    file->is_open = 1;
+    return FAT32_OK;
+}
+
+FAT32_Status FAT32_File_Seek(FAT32_File *restrict const file,
+        const uint32_t offset) {
+    if (!file->is_open) {
+        return FAT32_FILE_NOT_OPEN;
+    }
+    if (offset > file->file_size) {
+        return FAT32_FILE_SEEK_OUT_OF_RANGE;
+    }
+    file->position = offset;
+    return FAT32_OK;
+}
+
+FAT32_Status FAT32_File_Read(FAT32_File *restrict const file,
+        uint8_t *restrict const buffer, const uint32_t size,
+        uint32_t *restrict const bytes_read) {
+    const uint32_t cluster_size = sectors_per_cluster * SECTOR_SIZE;
+    uint32_t bytes_left;
+    uint32_t offset_in_cluster;
+    uint32_t offset_in_sector;
+    uint32_t cluster_lba;
+    uint32_t lba;
+    uint32_t sectors;
+    uint32_t chunk;
+    FAT32_Status ret;
+
+    *bytes_read = 0;
+    if (!file->is_open) {
+        return FAT32_FILE_NOT_OPEN;
+    }
+
+    bytes_left = Min(size, file->file_size - file->position);
+    while (bytes_left > 0) {
+        ret = Seek_To_Cluster(file, file->position / cluster_size);
+        if (ret != FAT32_OK) {
+            return ret;
+        }
+        offset_in_cluster = file->position % cluster_size;
+        offset_in_sector = offset_in_cluster % SECTOR_SIZE;
+        cluster_lba = Cluster_To_LBA(file->current_cluster);
+        lba = cluster_lba + (offset_in_cluster / SECTOR_SIZE);
+
+        // Next cluster may be anywhere, and the file may end inside this one
+        Block_Device_Hint_Sequential_Read(block_device, cluster_lba,
+                cluster_lba + Min(sectors_per_cluster,
+                        (file->file_size - (file->position - offset_in_cluster)
+                                + SECTOR_SIZE - 1) / SECTOR_SIZE));
+
+        if ((offset_in_sector != 0) || (bytes_left < SECTOR_SIZE)) {
+            // Partial sector goes through the sector buffer
+            if (Block_Device_Read_Blocks(block_device, lba, 1, sector_buffer)
+                    != BLOCK_DEVICE_OK) {
+                return FAT32_READ_FILE_ERR;
+            }
+            chunk = Min(SECTOR_SIZE - offset_in_sector, bytes_left);
+            memcpy(&buffer[*bytes_read], &sector_buffer[offset_in_sector],
+                    chunk);
+        } else {
+            // Whole sectors up to the end of the cluster go straight into the
+            // caller's buffer
+            sectors = Min(bytes_left / SECTOR_SIZE,
+                    (cluster_size - offset_in_cluster) / SECTOR_SIZE);
+            if (Block_Device_Read_Blocks(block_device, lba, sectors,
+                    &buffer[*bytes_read]) != BLOCK_DEVICE_OK) {
+                return FAT32_READ_FILE_ERR;
+            }
+            chunk = sectors * SECTOR_SIZE;
+        }
+
+        file->position += chunk;
+        *bytes_read += chunk;
+        bytes_left -= chunk;
+    }
+    return FAT32_OK;
+}
+
+void FAT32_File_Close(FAT32_File *restrict const file) {
+    file->is_open = 0;
+}
+
+FAT32_Status FAT32_Read_File_At_Location(
+        const FAT32_File_Location *restrict const location,
+        uint8_t *restrict const buffer, const uint32_t buffer_size,
+        DataBufferProcessingCallback cb) {
+    const FAT32_Extent *restrict extent = NULL;
+    uint32_t next_cluster;
+    File_Read_State state = { 0 };
+    FAT32_Status ret;
+
+    if (buffer_size < SECTOR_SIZE) {
+        return FAT32_READ_BUFFER_TOO_SMALL;
+    }
+    read_stats.files++;
+
+    state.bytes_left = location->file_size;
+    for (uint32_t i = 0; (i < location->extent_count) && (state.bytes_left > 0);
+            i++) {
+        extent = &location->extents[i];
+        ret = Read_Extent(extent->first_cluster, extent->clusters, buffer,
+                buffer_size, cb, &state);
+        if (ret != FAT32_OK) {
+            return ret;
+        }
+    }
+    if ((state.bytes_left == 0) || (extent == NULL)) {
+        return FAT32_OK;
+    }
+
+    // File has more extents than the location could hold. Continue with the
+    // cluster chain after the last recorded extent
+    if (Get_Next_Cluster(extent->first_cluster + extent->clusters - 1,
+            &next_cluster) != FAT32_OK) {
+        return FAT32_READ_FAT_READ_ERR;
+    }
+    if ((next_cluster & 0x0FFFFFFF) >= FAT32_CLUSTER_CHAIN_END) {
+        return FAT32_OK;
+    }
+    return Read_Cluster_Chain(next_cluster, buffer, buffer_size, cb, &state);
+}
+
+FAT32_Status FAT32_Enumerate_Root_Dir(FAT32_Dir_Entry_Callback cb,
+        void *ctx) {
+    Enumerate_Ctx enumerate = { cb, ctx, 0, 0 };
+    FAT32_Status ret;
+
+    // The same scan fills the image index if it is not built yet
+    if (!image_index.built) {
+        Reset_Image_Index();
+        enumerate.indexing = 1;
+    }
+    ret = Scan_Dir(root_dir_first_cluster, NULL, SCAN_FILES, &Enumerate_Visitor,
+            &enumerate);
+    if ((ret == FAT32_OK) && enumerate.indexing && !enumerate.stopped) {
+        image_index.built = 1;
+    }
+    return ret;
+}
+
+void FAT32_Get_Cache_Stats(FAT32_Cache_Stats *restrict const stats) {
+    *stats = fat_cache_stats;
+}
+
+void FAT32_Get_Read_Stats(FAT32_Read_Stats *restrict const stats) {
+    *stats = read_stats;
+}
+
+void FAT32_Get_Index_Stats(FAT32_Index_Stats *restrict const stats) {
+    *stats = index_stats;
+    stats->entries = image_index.count;
+}
+
+/**
+ * Get the logical block address of the first sector of a cluster
+ *
+ * @param cluster   (IN)    Cluster number
+ *
+ * @return  LBA of the cluster's first sector
+ */
+static inline uint32_t Cluster_To_LBA(const uint32_t cluster) {
+    return cluster_begin_lba
+            + ((cluster & 0x0FFFFFFF) - 2) * sectors_per_cluster;
+}
+
+/**
+ * Record where a file's data lives, with as many extents as fit in the
+ * location. Rest of the file is found from FAT while reading it
+ *
+ * @param file_begin_cluster    (IN)    Cluster where the file data starts. 0
+ *                                      if the file was not found
+ * @param file_size             (IN)    Number of bytes in the file
+ * @param entry_location        (IN)    Position of the file's directory entry
+ * @param location              (OUT)   Variable to store the location in
+ *
+ * @return  Status for following the file's cluster chain
+ */
+static FAT32_Status Locate_File(const uint32_t file_begin_cluster,
+        const uint32_t file_size,
+        const Dir_Entry_Location *restrict const entry_location,
+        FAT32_File_Location *restrict const location) {
+    uint32_t current_cluster = file_begin_cluster;
+    uint32_t next_cluster;
+    uint32_t clusters;
+    uint32_t bytes_left = file_size;
+
+    location->partition_lba = partition_lba;
+    location->volume_id = volume_id;
+    location->file_size = file_size;
+    location->extent_count = 0;
+    if (current_cluster == 0) {
+        return FAT32_READ_FILE_NOT_FOUND;
+    }
+    location->dir_entry_lba = entry_location->lba;
+    location->dir_entry_index = entry_location->index;
+
+    do {
+        if (Find_Extent(current_cluster, bytes_left, &clusters, &next_cluster)
+                != FAT32_OK) {
+            return FAT32_READ_FAT_READ_ERR;
+        }
+        location->extents[location->extent_count].first_cluster =
+                current_cluster & 0x0FFFFFFF;
+        location->extents[location->extent_count].clusters = clusters;
+        location->extent_count++;
+
+        bytes_left -= Min(bytes_left,
+                clusters * sectors_per_cluster * SECTOR_SIZE);
+        current_cluster = next_cluster;
+    } while (((current_cluster & 0x0FFFFFFF) < FAT32_CLUSTER_CHAIN_END)
+            && (bytes_left > 0)
+            && (location->extent_count < FAT32_LOCATION_MAX_EXTENTS));
+
+    return FAT32_OK;
+}
+
+/**
+ * Make the cluster at the given index in a file's chain the current one. The
+ * chain is followed from the current cluster or the closest checkpoint before
+ * the target, whichever is closer, and checkpoints are recorded on the way
+ *
+ * @param file  (IN/OUT)    Open file handle
+ * @param index (IN)        Index of the cluster in the file's chain
+ *
+ * @return  Status of following the cluster chain
+ */
+static FAT32_Status Seek_To_Cluster(FAT32_File *restrict const file,
+        const uint32_t index) {
+    const uint32_t interval = file->checkpoint_interval;
+    const uint32_t checkpoint = Min(index / interval,
+            file->checkpoint_count - 1);
+    uint32_t next_cluster;
+
+    if ((index < file->cluster_index)
+            || ((checkpoint * interval) > file->cluster_index)) {
+        file->cluster_index = checkpoint * interval;
+        file->current_cluster = file->checkpoints[checkpoint];
+    }
+
+    while (file->cluster_index < index) {
+        if (Get_Next_Cluster(file->current_cluster, &next_cluster)
+                != FAT32_OK) {
+            return FAT32_READ_FAT_READ_ERR;
+        }
+        if ((next_cluster & 0x0FFFFFFF) >= FAT32_CLUSTER_CHAIN_END) {
+            // Chain is shorter than the file size
+            return FAT32_READ_FILE_ERR;
+        }
+        file->current_cluster = next_cluster & 0x0FFFFFFF;
+        file->cluster_index++;
+
+        if (((file->cluster_index % interval) == 0)
+                && ((file->cluster_index / interval) == file->checkpoint_count)
+                && (file->checkpoint_count < FAT32_FILE_CHECKPOINTS)) {
+            file->checkpoints[file->checkpoint_count] = file->current_cluster;
+            file->checkpoint_count++;
+        }
+    }
+    return FAT32_OK;
+}
+
+/**
+ * Read the BPB of a FAT32 partition, check that it is supported and compute
+ * where the FAT and the data clusters begin
+ *
+ * @param partition_begin_lba   (IN)    LBA of the partition's first sector
+ *
+ * @return  Status of mounting the partition
+ */
+static FAT32_Status Mount_Partition(const uint32_t partition_begin_lba) {
+    if (Block_Device_Read_Blocks(block_device, partition_begin_lba, 1,
+            sector_buffer) != BLOCK_DEVICE_OK) {
         return FAT32_INIT_PARTITION_READ_ERR;
     }
 
-    const BPB_Record *restrict const bpb_record = (BPB_Record*) cluster_cache;
+    const BPB_Record *restrict const bpb_record = (BPB_Record*) sector_buffer;
     if (bpb_record->bytes_per_sector != SECTOR_SIZE) {
         return FAT32_INIT_UNSUPPORTED_SECTOR_SIZE;
     }
@@ -148,76 +774,303 @@ FAT32_Status FAT32_Init(void) {
     FAT32_BOOT_PARTITION_SIGNATURE) {
         return FAT32_INIT_INVALID_BOOT_PARTITION_SIGNATURE;
     }
-    if (bpb_record->sectors_per_cluster != SECTORS_PER_CLUSTER) {
+    // Cluster size has to be a power of 2 number of sectors
+    if ((bpb_record->sectors_per_cluster == 0)
+            || (bpb_record->sectors_per_cluster > MAX_SECTORS_PER_CLUSTER)
+            || (bpb_record->sectors_per_cluster
+                    & (bpb_record->sectors_per_cluster - 1))) {
         return FAT32_INIT_UNSUPPORTED_SECTORS_PER_CLUSTER;
     }
 
-    fat_begin_lba = lowest_partition_lba + bpb_record->reserved_sectors;
+    // Index and directories of a previously mounted volume may not describe
+    // this one
+    image_index.built = 0;
+    for (uint8_t i = 0; i < FAT32_DIR_CACHE_ENTRIES; i++) {
+        dir_cache[i].valid = 0;
+    }
+
+    partition_lba = partition_begin_lba;
+    volume_id = bpb_record->ebpb_rec.volume_id;
+    fat_begin_lba = partition_begin_lba + bpb_record->reserved_sectors;
+    fat_sectors = bpb_record->ebpb_rec.sectors_per_fat;
     cluster_begin_lba =
             fat_begin_lba
                     + (bpb_record->number_of_fat
                             * bpb_record->ebpb_rec.sectors_per_fat);
-    //sectors_per_cluster = bpb_record->sectors_per_cluster;
+    sectors_per_cluster = bpb_record->sectors_per_cluster;
     root_dir_first_cluster = bpb_record->ebpb_rec.root_dir_cluster;
 
     return FAT32_OK;
 }
 
-FAT32_Status FAT32_Read_File_From_Root_Dir_And_Process_Data(
-        const char *restrict const filename, uint8_t *restrict const buffer,
-        DataBufferProcessingCallback cb) {
-    uint32_t file_begin_cluster;
-    uint32_t current_cluster;
-    uint32_t current_lba;
-    uint32_t file_cluster_index = 0;
-    uint32_t file_size;
-    uint32_t data_size;
+/**
+ * Follow the cluster chain as long as clusters are physically contiguous and
+ * the file still has data left, to find the extent which can be read without
+ * looking at FAT again
+ *
+ * @param cluster       (IN)    First cluster of the extent
+ * @param bytes_left    (IN)    Bytes of the file starting at the cluster
+ * @param clusters      (OUT)   Variable to store the extent's length in
+ * @param next_cluster  (OUT)   Variable to store the cluster following the
+ *                              extent in the chain
+ *
+ * @return  Status of reading the FAT entries
+ */
+static FAT32_Status Find_Extent(const uint32_t cluster, const uint32_t bytes_left,
+        uint32_t *restrict const clusters,
+        uint32_t *restrict const next_cluster) {
+    const uint32_t cluster_size = sectors_per_cluster * SECTOR_SIZE;
 
-    // Find where the file starts and how long is it
-    Get_File_Begin_Cluster_And_Size(filename, &file_begin_cluster, &file_size);
-    if (file_begin_cluster == 0) {
-        return FAT32_READ_FILE_NOT_FOUND;
+    *clusters = 1;
+    if (Get_Next_Cluster(cluster, next_cluster) != FAT32_OK) {
+        return FAT32_READ_FAT_READ_ERR;
     }
-
-    // Start reading the file from the start position
-    current_cluster = file_begin_cluster;
-    do {
-        // Read the current cluster into user provided buffer
-        current_lba = cluster_begin_lba
-                + (current_cluster - 2) * SECTORS_PER_CLUSTER;
-        if (SDC_Read_Sector(current_lba, buffer) != SDC_OK) {
-            return FAT32_READ_FILE_ERR;
+    while (((*next_cluster & 0x0FFFFFFF) == ((cluster & 0x0FFFFFFF) + *clusters))
+            && ((*clusters * cluster_size) < bytes_left)) {
+        (*clusters)++;
+        if (Get_Next_Cluster(*next_cluster, next_cluster) != FAT32_OK) {
+            return FAT32_READ_FAT_READ_ERR;
         }
-        if (SDC_Read_Sector(current_lba + 1, buffer + SECTOR_SIZE) != SDC_OK) {
+    }
+    return FAT32_OK;
+}
+
+/**
+ * Stream an extent of file data into user provided buffer in chunks of whole
+ * sectors, so that RAM use does not depend on the cluster size, and call the
+ * data processing callback with each chunk
+ *
+ * @param cluster       (IN)    First cluster of the extent
+ * @param clusters      (IN)    Number of contiguous clusters in the extent
+ * @param buffer        (OUT)   Buffer to read the chunks into
+ * @param buffer_size   (IN)    Size of the buffer
+ * @param cb            (IN)    Function to call to process each chunk
+ * @param state         (IN/OUT)    Progress of reading the file
+ *
+ * @return  Status of reading and processing the extent's data
+ */
+static FAT32_Status Read_Extent(const uint32_t cluster, const uint32_t clusters,
+        uint8_t *restrict const buffer, const uint32_t buffer_size,
+        DataBufferProcessingCallback cb, File_Read_State *restrict const state) {
+    const uint32_t max_chunk_sectors = buffer_size / SECTOR_SIZE;
+    uint32_t extent_lba = Cluster_To_LBA(cluster);
+    uint32_t extent_sectors = clusters * sectors_per_cluster;
+    uint32_t chunk_sectors;
+    uint32_t data_size;
+
+    read_stats.extents++;
+    read_stats.clusters += clusters;
+
+    // Nothing after the extent or the end of the file is going to be read
+    Block_Device_Hint_Sequential_Read(block_device, extent_lba,
+            extent_lba + Min(extent_sectors,
+                    (state->bytes_left + SECTOR_SIZE - 1) / SECTOR_SIZE));
+
+    while ((extent_sectors > 0) && (state->bytes_left > 0)) {
+        chunk_sectors = Min(Min(extent_sectors, max_chunk_sectors),
+                (state->bytes_left + SECTOR_SIZE - 1) / SECTOR_SIZE);
+        if (Block_Device_Read_Blocks(block_device, extent_lba, chunk_sectors,
+                buffer) != BLOCK_DEVICE_OK) {
             return FAT32_READ_FILE_ERR;
         }
 
-        // Process 1 cluster worth of data using user provided callback
-        data_size = Min(SECTORS_PER_CLUSTER * SECTOR_SIZE, file_size);
-        if ((*cb)(file_cluster_index * SECTORS_PER_CLUSTER * SECTOR_SIZE,
-                buffer, data_size) != DATA_PROCESSING_OK) {
+        // Process the chunk's data using user provided callback
+        data_size = Min(chunk_sectors * SECTOR_SIZE, state->bytes_left);
+        if ((*cb)(state->data_offset, buffer, data_size)
+                != DATA_PROCESSING_OK) {
             return FAT32_READ_FILE_DATA_PROCESS_ERR;
         }
 
-        // Update the length of data left to be read and calculate the next
-        // cluster to read
-        file_size -= data_size;
-        current_cluster &= 0x0FFFFFFF;
-        if (SDC_Read_Sector(fat_begin_lba + (current_cluster >> 7),
-                cluster_cache) != SDC_OK) {
+        // Update the length of data left to be read
+        state->bytes_left -= data_size;
+        state->data_offset += data_size;
+        extent_lba += chunk_sectors;
+        extent_sectors -= chunk_sectors;
+    }
+    return FAT32_OK;
+}
+
+/**
+ * Read file data following the cluster chain from the given cluster, merging
+ * physically contiguous clusters into extents
+ *
+ * @param cluster       (IN)    Cluster to start reading from
+ * @param buffer        (OUT)   Buffer to read the data into
+ * @param buffer_size   (IN)    Size of the buffer
+ * @param cb            (IN)    Function to call to process each chunk
+ * @param state         (IN/OUT)    Progress of reading the file
+ *
+ * @return  Status of reading and processing the data
+ */
+static FAT32_Status Read_Cluster_Chain(const uint32_t cluster,
+        uint8_t *restrict const buffer, const uint32_t buffer_size,
+        DataBufferProcessingCallback cb, File_Read_State *restrict const state) {
+    uint32_t current_cluster = cluster;
+    uint32_t next_cluster;
+    uint32_t clusters;
+    FAT32_Status ret;
+
+    do {
+        if (Find_Extent(current_cluster, state->bytes_left, &clusters,
+                &next_cluster) != FAT32_OK) {
             return FAT32_READ_FAT_READ_ERR;
         }
-        current_cluster =
-                *((uint32_t*) cluster_cache + (current_cluster & 0x7F));
+        ret = Read_Extent(current_cluster, clusters, buffer, buffer_size, cb,
+                state);
+        if (ret != FAT32_OK) {
+            return ret;
+        }
 
-        // Change offset to calculate data offset for next call to callback
-        // function
-        file_cluster_index++;
-    } while (current_cluster != 0x0FFFFFFF);
+        // Continue with the cluster which ended the extent
+        current_cluster = next_cluster;
+    } while (((current_cluster & 0x0FFFFFFF) < FAT32_CLUSTER_CHAIN_END)
+            && (state->bytes_left > 0));
 
     return FAT32_OK;
 }
 
+/**
+ * Read file data starting from the given cluster. If the whole file is in one
+ * run of clusters, it is streamed from the data region without looking at FAT
+ * again, otherwise the cluster chain is followed
+ *
+ * @param cluster       (IN)    Cluster where the file data starts
+ * @param buffer        (OUT)   Buffer to read the data into
+ * @param buffer_size   (IN)    Size of the buffer
+ * @param cb            (IN)    Function to call to process each chunk
+ * @param state         (IN/OUT)    Progress of reading the file
+ *
+ * @return  Status of reading and processing the data
+ */
+static FAT32_Status Read_File_Data(const uint32_t cluster,
+        uint8_t *restrict const buffer, const uint32_t buffer_size,
+        DataBufferProcessingCallback cb, File_Read_State *restrict const state) {
+    const uint32_t cluster_size = sectors_per_cluster * SECTOR_SIZE;
+    const uint32_t clusters = (state->bytes_left + cluster_size - 1)
+            / cluster_size;
+    Boolean is_contiguous;
+
+    if (clusters == 0) {
+        return FAT32_OK;
+    }
+    if (Check_Chain_Contiguous(cluster, clusters, &is_contiguous)
+            != FAT32_OK) {
+        return FAT32_READ_FAT_READ_ERR;
+    }
+    if (is_contiguous == TRUE) {
+        read_stats.contiguous_files++;
+        return Read_Extent(cluster, clusters, buffer, buffer_size, cb, state);
+    }
+    return Read_Cluster_Chain(cluster, buffer, buffer_size, cb, state);
+}
+
+/**
+ * Check if the given number of clusters starting from a cluster form one run
+ * in the cluster chain. Entries are compared a FAT sector at a time, so the
+ * cost depends on the number of FAT sectors covering the run rather than the
+ * number of clusters
+ *
+ * @param cluster       (IN)    First cluster of the run
+ * @param clusters      (IN)    Number of clusters in the run
+ * @param is_contiguous (OUT)   Variable to store TRUE in if each cluster but
+ *                              the last one is followed by the next one
+ *
+ * @return  Status of reading the FAT sectors
+ */
+static FAT32_Status Check_Chain_Contiguous(const uint32_t cluster,
+        const uint32_t clusters, Boolean *restrict const is_contiguous) {
+    const uint32_t *entries;
+    uint32_t index = cluster & 0x0FFFFFFF;
+    const uint32_t last = index + clusters - 1;
+    uint32_t sector_end;
+
+    *is_contiguous = FALSE;
+    while (index < last) {
+        if ((index / FAT_ENTRIES_PER_SECTOR) >= fat_sectors) {
+            // Run would go past the end of FAT
+            return FAT32_OK;
+        }
+        if (Get_FAT_Sector(fat_begin_lba + (index / FAT_ENTRIES_PER_SECTOR),
+                &entries) != FAT32_OK) {
+            return FAT32_READ_FAT_READ_ERR;
+        }
+        sector_end = Min(last,
+                ((index / FAT_ENTRIES_PER_SECTOR) + 1) * FAT_ENTRIES_PER_SECTOR);
+        for (; index < sector_end; index++) {
+            if ((entries[index % FAT_ENTRIES_PER_SECTOR] & 0x0FFFFFFF)
+                    != (index + 1)) {
+                return FAT32_OK;
+            }
+        }
+    }
+    *is_contiguous = TRUE;
+    return FAT32_OK;
+}
+
+/**
+ * Look up the cluster following the given one in the cluster chain
+ *
+ * @param cluster       (IN)    Cluster to find the next cluster for
+ * @param next_cluster  (OUT)   Variable to store the next cluster in
+ *
+ * @return  Status of reading the FAT entry
+ */
+static FAT32_Status Get_Next_Cluster(const uint32_t cluster,
+        uint32_t *restrict const next_cluster) {
+    const uint32_t index = cluster & 0x0FFFFFFF;
+    const uint32_t *entries;
+
+    if (Get_FAT_Sector(fat_begin_lba + (index / FAT_ENTRIES_PER_SECTOR),
+            &entries) != FAT32_OK) {
+        return FAT32_READ_FAT_READ_ERR;
+    }
+    *next_cluster = entries[index % FAT_ENTRIES_PER_SECTOR];
+    return FAT32_OK;
+}
+
+/**
+ * Get the entries of a FAT sector. FAT sectors are read through a small cache,
+ * since consecutive clusters of a file have their entries in the same FAT
+ * sector
+ *
+ * @param lba       (IN)    LBA of the FAT sector
+ * @param entries   (OUT)   Variable to store a pointer to the sector's entries
+ *                          in. Valid until the next FAT sector is read
+ *
+ * @return  Status of reading the FAT sector
+ */
+static FAT32_Status Get_FAT_Sector(const uint32_t lba,
+        const uint32_t **restrict const entries) {
+    FAT_Cache_Entry *entry = &fat_cache[0];
+
+    fat_cache_lookups++;
+    for (uint8_t i = 0; i < FAT_CACHE_ENTRIES; i++) {
+        if (fat_cache[i].valid && (fat_cache[i].lba == lba)) {
+            fat_cache[i].last_used = fat_cache_lookups;
+            fat_cache_stats.hits++;
+            *entries = fat_cache[i].entries;
+            return FAT32_OK;
+        }
+        // Replace an invalid entry, or else the least recently used one
+        if (!fat_cache[i].valid || (entry->valid
+                && (fat_cache[i].last_used < entry->last_used))) {
+            entry = &fat_cache[i];
+        }
+    }
+
+    fat_cache_stats.misses++;
+    entry->valid = 0;
+    if (Block_Device_Read_Blocks(block_device, lba, 1,
+            (uint8_t*) entry->entries) != BLOCK_DEVICE_OK) {
+        return FAT32_READ_FAT_READ_ERR;
+    }
+    entry->valid = 1;
+    entry->lba = lba;
+    entry->last_used = fat_cache_lookups;
+    *entries = entry->entries;
+    return FAT32_OK;
+}
+
 /**
  * Get logical block address for the partition that has the lowest value for LBA
  *
@@ -225,12 +1078,13 @@ FAT32_Status FAT32_Read_File_From_Root_Dir_And_Process_Data(
  */
 static uint32_t Get_Lowest_Partition_LBA(void) {
     uint32_t lowest_partition_lba = 0;
-    if (SDC_Read_Sector(0, cluster_cache) != SDC_OK) {
+    if (Block_Device_Read_Blocks(block_device, 0, 1, sector_buffer)
+            != BLOCK_DEVICE_OK) {
         return 0;
     }
 
     // Iterate over all primary partition entries
-    Partition_Table_Entry *pentry = (Partition_Table_Entry*) (cluster_cache +
+    Partition_Table_Entry *pentry = (Partition_Table_Entry*) (sector_buffer +
     PARTITION_TABLE_FIRST_ENTRY_OFFSET);
     for (uint8_t i = 0; i < MAX_PRIMARY_PARTITIONS; i++) {
         if ((pentry->system_id == PARTITION_TYPE_WIN95_OSR2_FAT32)
@@ -247,72 +1101,589 @@ static uint32_t Get_Lowest_Partition_LBA(void) {
 
 /**
  * Find the user provided filename. If file exists, update variables to store
- * the cluster where the file's data begins and the size of file
+ * the cluster where the file's data begins and the size of file. Images named
+ * by their number are looked up in the root directory index, which is built
+ * with one scan of the directory on the first lookup after mounting
  *
  * @param filename              (IN)    Name of file to find
  * @param file_begin_cluster    (OUT)    Variable to store cluster value where the
  *                                         file data starts from. If file is not found,
  *                                         this will be 0
  * @param file_size             (OUT)    Variable to store number of bytes in the file
+ * @param entry_location        (OUT)   Variable to store the position of the
+ *                                      file's directory entry in. NULL if not
+ *                                      needed
  */
 static void Get_File_Begin_Cluster_And_Size(const char *restrict const filename,
         uint32_t *restrict const file_begin_cluster,
-        uint32_t *restrict const file_size) {
-
-    uint32_t current_cluster = root_dir_first_cluster;
-    uint32_t current_lba;
-    const DIR_8_3_Record *restrict dir_record = NULL;
+        uint32_t *restrict const file_size,
+        Dir_Entry_Location *restrict const entry_location) {
+    Filename_Match_Ctx ctx = { filename, file_begin_cluster, file_size,
+            entry_location };
+    const Image_Index_Entry *restrict entry = NULL;
+    uint32_t number;
 
     // Don't expect pre-initialized values
     *file_begin_cluster = 0;
     *file_size = 0;
 
+    if (Parse_Image_Filename(filename, &number) == TRUE) {
+        if (!image_index.built) {
+            Build_Image_Index();
+        }
+        if (image_index.built) {
+            entry = Find_In_Image_Index(number);
+            if (entry != NULL) {
+                index_stats.hits++;
+                *file_begin_cluster = entry->first_cluster;
+                *file_size = entry->file_size;
+                if (entry_location != NULL) {
+                    *entry_location = entry->entry_location;
+                }
+                return;
+            }
+            // Only images numbered past the ones which fit in the index can
+            // be missing from it
+            if (image_index.complete || (image_index.count == 0)
+                    || (number
+                            < image_index.entries[image_index.count - 1].number)) {
+                return;
+            }
+        }
+    }
+
+    Scan_Dir(root_dir_first_cluster, NULL, SCAN_FILES, &Match_Filename_Visitor,
+            &ctx);
+}
+
+/**
+ * Call the visitor with each file or subdirectory entry in a directory, until
+ * it asks to stop or the directory ends. Entries for deleted files, long
+ * filenames, volume ID and system files are skipped, along with "." and ".."
+ *
+ * @param first_cluster (IN)    First cluster of the directory
+ * @param position      (IN/OUT)    Sector to start the scan from, updated with
+ *                                  the sector of the entry which stopped the
+ *                                  scan. NULL to scan from the beginning
+ * @param kind          (IN)    Kind of entries to pass to the visitor
+ * @param visitor       (IN)    Function to call with each entry
+ * @param ctx           (IN)    Context pointer to pass to the visitor
+ *
+ * @return  Status of reading the directory
+ */
+static FAT32_Status Scan_Dir(const uint32_t first_cluster,
+        Dir_Position *restrict const position, const Dir_Scan_Kind kind,
+        Dir_Entry_Visitor visitor, void *ctx) {
+    uint32_t current_cluster = first_cluster;
+    uint32_t first_sector = 0;
+    const DIR_8_3_Record *restrict dir_record = NULL;
+    Dir_Entry_Location entry_location;
+    uint8_t is_dir;
+
+    if (position != NULL) {
+        current_cluster = position->cluster;
+        first_sector = position->sector;
+    }
+
+    index_stats.dir_scans++;
     do {
-        // Read the cluster containing the directory/file entries
-        current_lba = cluster_begin_lba
-                + (current_cluster - 2) * SECTORS_PER_CLUSTER;
-        if (SDC_Read_Sector(current_lba, cluster_cache) != SDC_OK) {
-            return;
-        }
-        if (SDC_Read_Sector(current_lba + 1, cluster_cache + SECTOR_SIZE)
-                != SDC_OK) {
-            return;
-        }
-
-        // Iterate through all the directory/file entries and find the one
-        // matching the given filename
-        dir_record = (DIR_8_3_Record*) cluster_cache;
-        while ((((uint8_t*) dir_record - cluster_cache) < sizeof(cluster_cache))
-                && (dir_record->filename_8_3[0] != '\0')) {
-            if ((dir_record->filename_8_3[0] != UNUSED_DIR_ENTRY_NAME_FIRST_BYTE)
-                    && (dir_record->file_attrs != FAT32_FILE_ATTR_LONG_FILENAME)
-                    && (dir_record->file_attrs != FAT32_FILE_ATTR_VOL_ID)
-                    && (dir_record->file_attrs != FAT32_FILE_ATTR_SYSTEM)
-                    && (dir_record->file_attrs != FAT32_FILE_ATTR_DIR)) {
-                if (Filenames_Match((const char*) dir_record->filename_8_3,
-                        filename) == TRUE) {
-                    // If we found the file, update the provided variables and
-                    // return
-                    *file_begin_cluster =
-                            ((dir_record->first_cluster_high << 16)
-                                    | (dir_record->first_cluster_low));
-                    *file_size = dir_record->file_size;
-                    return;
+        for (uint32_t sector = first_sector; sector < sectors_per_cluster;
+                sector++) {
+            // Read the sector containing the directory/file entries
+            entry_location.lba = Cluster_To_LBA(current_cluster) + sector;
+            if (Block_Device_Read_Blocks(block_device, entry_location.lba, 1,
+                    sector_buffer) != BLOCK_DEVICE_OK) {
+                return FAT32_READ_FILE_ERR;
+            }
+
+            // Iterate through all the directory/file entries
+            dir_record = (const DIR_8_3_Record*) sector_buffer;
+            for (uint32_t i = 0; i < DIR_ENTRIES_PER_SECTOR; i++) {
+                if (dir_record->filename_8_3[0] == '\0') {
+                    // No more entries in the directory
+                    return FAT32_OK;
+                }
+                is_dir = ((dir_record->file_attrs & FAT32_FILE_ATTR_DIR) != 0);
+                if ((dir_record->filename_8_3[0]
+                        != UNUSED_DIR_ENTRY_NAME_FIRST_BYTE)
+                        && (dir_record->filename_8_3[0]
+                                != DOT_DIR_ENTRY_NAME_FIRST_BYTE)
+                        && (dir_record->file_attrs
+                                != FAT32_FILE_ATTR_LONG_FILENAME)
+                        && (dir_record->file_attrs != FAT32_FILE_ATTR_VOL_ID)
+                        && (dir_record->file_attrs != FAT32_FILE_ATTR_SYSTEM)
+                        && (is_dir == (kind == SCAN_DIRS))) {
+                    entry_location.index = i;
+                    if ((*visitor)(dir_record, &entry_location, ctx) == TRUE) {
+                        if (position != NULL) {
+                            position->cluster = current_cluster;
+                            position->sector = sector;
+                        }
+                        return FAT32_OK;
+                    }
                 }
+                dir_record++;
             }
-            dir_record++;
         }
+        first_sector = 0;
 
         // Compute the next cluster to read
-        current_cluster &= 0x0FFFFFFF;
-        if (SDC_Read_Sector(fat_begin_lba + (current_cluster >> 7),
-                cluster_cache) != SDC_OK) {
-            return;
+        if (Get_Next_Cluster(current_cluster, &current_cluster) != FAT32_OK) {
+            return FAT32_READ_FAT_READ_ERR;
         }
-        current_cluster =
-                *((uint32_t*) cluster_cache + (current_cluster & 0x7F));
-    } while (current_cluster != 0x0FFFFFFF);
-    return;
+    } while ((current_cluster & 0x0FFFFFFF) < FAT32_CLUSTER_CHAIN_END);
+    return FAT32_OK;
+}
+
+/**
+ * Find a file by its path. Files without a directory in the path are looked up
+ * in the root directory. Directories in the path are resolved through the
+ * directory cache, so only the ones not looked up recently are scanned
+ *
+ * @param path                  (IN)    Path of the file, like
+ *                                      "albums/summer/3.bin"
+ * @param file_begin_cluster    (OUT)   Variable to store cluster value where the
+ *                                      file data starts from. If file is not
+ *                                      found, this will be 0
+ * @param file_size             (OUT)   Variable to store number of bytes in the
+ *                                      file
+ * @param entry_location        (OUT)   Variable to store the position of the
+ *                                      file's directory entry in. NULL if not
+ *                                      needed
+ *
+ * @return  Status of resolving the directories in the path
+ */
+static FAT32_Status Find_File_At_Path(const char *restrict const path,
+        uint32_t *restrict const file_begin_cluster,
+        uint32_t *restrict const file_size,
+        Dir_Entry_Location *restrict const entry_location) {
+    const char *restrict dir_path = path;
+    const char *restrict filename = NULL;
+    Dir_Cache_Entry *dir = NULL;
+    FAT32_Status ret;
+
+    *file_begin_cluster = 0;
+    *file_size = 0;
+
+    while (*dir_path == PATH_SEPARATOR) {
+        dir_path++;
+    }
+    filename = strrchr(dir_path, PATH_SEPARATOR);
+    if (filename == NULL) {
+        Get_File_Begin_Cluster_And_Size(dir_path, file_begin_cluster,
+                file_size, entry_location);
+        return FAT32_OK;
+    }
+    if ((uint32_t) (filename - dir_path) >= FAT32_PATH_MAX_LENGTH) {
+        return FAT32_READ_PATH_TOO_LONG;
+    }
+
+    ret = Resolve_Dir(dir_path, filename - dir_path, &dir);
+    if (ret != FAT32_OK) {
+        return ret;
+    }
+    Find_File_In_Cached_Dir(dir, filename + 1, file_begin_cluster, file_size,
+            entry_location);
+    return FAT32_OK;
+}
+
+/**
+ * Find the directory at a path, starting from the longest part of the path
+ * which is already in the directory cache. Every directory resolved on the way
+ * is added to the cache
+ *
+ * @param path      (IN)    Path of the directory. Does not need to be NULL
+ *                          terminated
+ * @param length    (IN)    Length of the path
+ * @param dir       (OUT)   Variable to store the directory's cache entry in
+ *
+ * @return  Status of finding the directory
+ */
+static FAT32_Status Resolve_Dir(const char *restrict const path,
+        const uint32_t length, Dir_Cache_Entry **const dir) {
+    char name[FAT32_DIR_ENTRY_NAME_LENGTH];
+    uint32_t dir_cluster = root_dir_first_cluster;
+    uint32_t found_cluster;
+    uint32_t unused_size;
+    uint32_t resolved_length = 0;
+    uint32_t start = 0;
+    uint32_t end;
+    Filename_Match_Ctx ctx = { name, &found_cluster, &unused_size, NULL };
+    Dir_Cache_Entry *parent = NULL;
+
+    // Find the longest cached directory which contains the requested one
+    dir_cache_lookups++;
+    for (uint8_t i = 0; i < FAT32_DIR_CACHE_ENTRIES; i++) {
+        const uint32_t cached_length = strlen(dir_cache[i].path);
+        if (dir_cache[i].valid && (cached_length <= length)
+                && (cached_length > resolved_length)
+                && (strncmp(dir_cache[i].path, path, cached_length) == 0)
+                && ((cached_length == length)
+                        || (path[cached_length] == PATH_SEPARATOR))) {
+            parent = &dir_cache[i];
+            resolved_length = cached_length;
+        }
+    }
+    if (parent != NULL) {
+        parent->last_used = dir_cache_lookups;
+        if (resolved_length == length) {
+            index_stats.dir_cache_hits++;
+            *dir = parent;
+            return FAT32_OK;
+        }
+        dir_cluster = parent->first_cluster;
+        start = resolved_length + 1;
+    }
+    index_stats.dir_cache_misses++;
+
+    // Scan for each remaining directory in the path
+    while (start < length) {
+        for (end = start; (end < length) && (path[end] != PATH_SEPARATOR);
+                end++) {
+        }
+        if ((end - start) >= FAT32_DIR_ENTRY_NAME_LENGTH) {
+            return FAT32_READ_FILE_NOT_FOUND;
+        }
+        memcpy(name, &path[start], end - start);
+        name[end - start] = '\0';
+
+        found_cluster = 0;
+        if (Scan_Dir(dir_cluster, NULL, SCAN_DIRS, &Match_Filename_Visitor,
+                &ctx) != FAT32_OK) {
+            return FAT32_READ_FILE_ERR;
+        }
+        if (found_cluster == 0) {
+            return FAT32_READ_FILE_NOT_FOUND;
+        }
+
+        dir_cluster = found_cluster;
+        *dir = Insert_Dir_Cache_Entry(path, end, dir_cluster);
+        start = end + 1;
+    }
+    return FAT32_OK;
+}
+
+/**
+ * Add a resolved directory to the cache, replacing the least recently used
+ * entry
+ *
+ * @param path          (IN)    Path of the directory
+ * @param length        (IN)    Length of the path
+ * @param first_cluster (IN)    First cluster of the directory
+ *
+ * @return  Cache entry of the directory
+ */
+static Dir_Cache_Entry* Insert_Dir_Cache_Entry(const char *restrict const path,
+        const uint32_t length, const uint32_t first_cluster) {
+    Dir_Cache_Entry *entry = &dir_cache[0];
+
+    for (uint8_t i = 0; i < FAT32_DIR_CACHE_ENTRIES; i++) {
+        if (!dir_cache[i].valid || (entry->valid
+                && (dir_cache[i].last_used < entry->last_used))) {
+            entry = &dir_cache[i];
+        }
+    }
+
+    memcpy(entry->path, path, length);
+    entry->path[length] = '\0';
+    entry->first_cluster = first_cluster;
+    entry->resume.cluster = first_cluster;
+    entry->resume.sector = 0;
+    entry->last_used = dir_cache_lookups;
+    entry->valid = 1;
+    return entry;
+}
+
+/**
+ * Find a file in a cached directory, starting from the sector where the
+ * previous lookup found its file and wrapping around to the beginning
+ *
+ * @param dir                   (IN)    Cache entry of the directory
+ * @param filename              (IN)    Name of file to find
+ * @param file_begin_cluster    (OUT)   Variable to store cluster value where the
+ *                                      file data starts from. If file is not
+ *                                      found, this will be 0
+ * @param file_size             (OUT)   Variable to store number of bytes in the
+ *                                      file
+ * @param entry_location        (OUT)   Variable to store the position of the
+ *                                      file's directory entry in. NULL if not
+ *                                      needed
+ */
+static void Find_File_In_Cached_Dir(Dir_Cache_Entry *restrict const dir,
+        const char *restrict const filename,
+        uint32_t *restrict const file_begin_cluster,
+        uint32_t *restrict const file_size,
+        Dir_Entry_Location *restrict const entry_location) {
+    Filename_Match_Ctx ctx = { filename, file_begin_cluster, file_size,
+            entry_location };
+    Dir_Position position = dir->resume;
+
+    Scan_Dir(dir->first_cluster, &position, SCAN_FILES, &Match_Filename_Visitor,
+            &ctx);
+    if ((*file_begin_cluster == 0)
+            && ((dir->resume.cluster != dir->first_cluster)
+                    || (dir->resume.sector != 0))) {
+        position.cluster = dir->first_cluster;
+        position.sector = 0;
+        Scan_Dir(dir->first_cluster, &position, SCAN_FILES,
+                &Match_Filename_Visitor, &ctx);
+    }
+    if (*file_begin_cluster != 0) {
+        dir->resume = position;
+    }
+}
+
+/**
+ * Directory scan visitor which stops at the entry matching a filename
+ *
+ * @param dir_record        (IN)    Directory entry of the file
+ * @param entry_location    (IN)    Position of the entry in the directory
+ * @param ctx               (IN)    Filename to find and variables to store the
+ *                                  file's first cluster, size and entry
+ *                                  position in
+ *
+ * @return  True if the entry matches the filename. False otherwise.
+ */
+static Boolean Match_Filename_Visitor(
+        const DIR_8_3_Record *restrict const dir_record,
+        const Dir_Entry_Location *restrict const entry_location, void *ctx) {
+    const Filename_Match_Ctx *restrict const match = ctx;
+
+    if (Filenames_Match((const char*) dir_record->filename_8_3, match->filename)
+            != TRUE) {
+        return FALSE;
+    }
+    *match->file_begin_cluster = (((uint32_t) dir_record->first_cluster_high
+            << 16) | (uint32_t) dir_record->first_cluster_low);
+    *match->file_size = dir_record->file_size;
+    if (match->entry_location != NULL) {
+        *match->entry_location = *entry_location;
+    }
+    return TRUE;
+}
+
+/**
+ * Directory scan visitor which inserts images into the index, keeping it
+ * sorted by the image number. Once the index is full, images with numbers
+ * larger than all indexed ones are left out
+ *
+ * @param dir_record        (IN)    Directory entry of the file
+ * @param entry_location    (IN)    Position of the entry in the directory
+ * @param ctx               (IN)    Unused
+ *
+ * @return  False, to scan the whole directory
+ */
+static Boolean Index_Image_Visitor(
+        const DIR_8_3_Record *restrict const dir_record,
+        const Dir_Entry_Location *restrict const entry_location, void *ctx) {
+    uint32_t number;
+    uint32_t i;
+    (void) ctx;
+
+    if (Parse_Image_Dir_Entry(dir_record, &number) != TRUE) {
+        return FALSE;
+    }
+
+    // Images are usually written in order, so look for the insert position
+    // from the end
+    i = image_index.count;
+    while ((i > 0) && (image_index.entries[i - 1].number > number)) {
+        i--;
+    }
+    if (image_index.count == FAT32_IMAGE_INDEX_ENTRIES) {
+        image_index.complete = 0;
+        if (i == FAT32_IMAGE_INDEX_ENTRIES) {
+            return FALSE;
+        }
+        // Drop the image with the largest number to make space
+        image_index.count--;
+    }
+    memmove(&image_index.entries[i + 1], &image_index.entries[i],
+            (image_index.count - i) * sizeof(Image_Index_Entry));
+    image_index.entries[i].number = number;
+    image_index.entries[i].first_cluster = (((uint32_t)
+            dir_record->first_cluster_high << 16)
+            | (uint32_t) dir_record->first_cluster_low);
+    image_index.entries[i].file_size = dir_record->file_size;
+    image_index.entries[i].entry_location = *entry_location;
+    image_index.count++;
+    return FALSE;
+}
+
+/**
+ * Directory scan visitor which passes file entries to the enumeration callback
+ *
+ * @param dir_record        (IN)    Directory entry of the file
+ * @param entry_location    (IN)    Position of the entry in the directory
+ * @param ctx               (IN)    Enumeration callback and its state
+ *
+ * @return  True if the callback asked to stop. False otherwise.
+ */
+static Boolean Enumerate_Visitor(
+        const DIR_8_3_Record *restrict const dir_record,
+        const Dir_Entry_Location *restrict const entry_location, void *ctx) {
+    Enumerate_Ctx *restrict const enumerate = ctx;
+    FAT32_Dir_Entry entry;
+
+    if (enumerate->indexing) {
+        Index_Image_Visitor(dir_record, entry_location, NULL);
+    }
+
+    Format_Dir_Entry_Filename(dir_record, entry.filename);
+    entry.attributes = dir_record->file_attrs;
+    entry.first_cluster = (((uint32_t) dir_record->first_cluster_high << 16)
+            | (uint32_t) dir_record->first_cluster_low);
+    entry.file_size = dir_record->file_size;
+    if ((*enumerate->cb)(&entry, enumerate->cb_ctx) == FAT32_ENUMERATE_STOP) {
+        enumerate->stopped = 1;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/**
+ * Empty the image index before filling it with a directory scan
+ */
+static void Reset_Image_Index(void) {
+    image_index.built = 0;
+    image_index.count = 0;
+    image_index.complete = 1;
+}
+
+/**
+ * Scan the root directory once and index the images in it
+ */
+static void Build_Image_Index(void) {
+    Reset_Image_Index();
+    if (Scan_Dir(root_dir_first_cluster, NULL, SCAN_FILES, &Index_Image_Visitor,
+            NULL) == FAT32_OK) {
+        image_index.built = 1;
+    }
+}
+
+/**
+ * Convert the space padded name of a directory entry to a filename, like
+ * "1       BIN" to "1.BIN"
+ *
+ * @param dir_record    (IN)    Directory entry of the file
+ * @param filename      (OUT)   Buffer of FAT32_DIR_ENTRY_NAME_LENGTH bytes to
+ *                              store the filename in
+ */
+static void Format_Dir_Entry_Filename(
+        const DIR_8_3_Record *restrict const dir_record,
+        char *restrict const filename) {
+    const uint8_t *restrict const name = dir_record->filename_8_3;
+    uint8_t i;
+    uint8_t j = 0;
+
+    for (i = 0; (i < 8) && (name[i] != ' '); i++) {
+        filename[j++] = (char) name[i];
+    }
+    // First byte of 0xE5 is stored escaped, since it marks deleted entries
+    if (name[0] == ESCAPED_E5_DIR_ENTRY_NAME_FIRST_BYTE) {
+        filename[0] = (char) UNUSED_DIR_ENTRY_NAME_FIRST_BYTE;
+    }
+    if (name[8] != ' ') {
+        filename[j++] = '.';
+        for (i = 8; (i < 11) && (name[i] != ' '); i++) {
+            filename[j++] = (char) name[i];
+        }
+    }
+    filename[j] = '\0';
+}
+
+/**
+ * Binary search the index for an image
+ *
+ * @param number    (IN)    Number of the image
+ *
+ * @return  Index entry of the image, or NULL if it is not in the index
+ */
+static const Image_Index_Entry* Find_In_Image_Index(const uint32_t number) {
+    uint32_t low = 0;
+    uint32_t high = image_index.count;
+    uint32_t mid;
+
+    while (low < high) {
+        mid = low + ((high - low) / 2);
+        if (image_index.entries[mid].number == number) {
+            return &image_index.entries[mid];
+        }
+        if (image_index.entries[mid].number < number) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Check if a filename names an image, as N.bin where N is a decimal number
+ * without leading zeros which fits in an 8.3 name
+ *
+ * @param filename  (IN)    Filename provided by the user
+ * @param number    (OUT)   Variable to store the image number in
+ *
+ * @return  True if the filename names an image. False otherwise.
+ */
+static Boolean Parse_Image_Filename(const char *restrict const filename,
+        uint32_t *restrict const number) {
+    uint8_t i = 0;
+
+    *number = 0;
+    while ((filename[i] >= '0') && (filename[i] <= '9')) {
+        if ((i == IMAGE_NUMBER_MAX_DIGITS) || ((i == 1) && (*number == 0))) {
+            return FALSE;
+        }
+        *number = (*number * 10) + (filename[i] - '0');
+        i++;
+    }
+    if ((i == 0) || (filename[i] != '.') || (to_upper(filename[i + 1]) != 'B')
+            || (to_upper(filename[i + 2]) != 'I')
+            || (to_upper(filename[i + 3]) != 'N') || (filename[i + 4] != '\0')) {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * Check if a directory entry is an image, named the way Parse_Image_Filename
+ * accepts
+ *
+ * @param dir_record    (IN)    Directory entry of the file
+ * @param number        (OUT)   Variable to store the image number in
+ *
+ * @return  True if the entry is an image. False otherwise.
+ */
+static Boolean Parse_Image_Dir_Entry(
+        const DIR_8_3_Record *restrict const dir_record,
+        uint32_t *restrict const number) {
+    const uint8_t *restrict const name = dir_record->filename_8_3;
+    uint8_t i = 0;
+
+    *number = 0;
+    while ((i < IMAGE_NUMBER_MAX_DIGITS) && (name[i] >= '0')
+            && (name[i] <= '9')) {
+        if ((i == 1) && (*number == 0)) {
+            return FALSE;
+        }
+        *number = (*number * 10) + (name[i] - '0');
+        i++;
+    }
+    if (i == 0) {
+        return FALSE;
+    }
+    for (; i < IMAGE_NUMBER_MAX_DIGITS; i++) {
+        if (name[i] != ' ') {
+            return FALSE;
+        }
+    }
+    if ((to_upper(name[8]) != 'B') || (to_upper(name[9]) != 'I')
+            || (to_upper(name[10]) != 'N')) {
+        return FALSE;
+    }
+    return TRUE;
 }
 
 /**
@@ -347,6 +1718,10 @@ static Boolean Filenames_Match(
             return FALSE;
         }
     }
+    // Names without extension, like directory names, end with padding
+    while ((i < 11) && (fat32_direntry_filename[i] == ' ')) {
+        i++;
+    }
     if ((filename[j] == '\0') && (i == 11)) {
         return TRUE;
     }
@@ -1,5 +1,18 @@
 #include "stm32l4xx_hal.h"
 
+extern void SDC_SPI_DMA_Rx_IRQ_Handler(void);
+extern void SDC_SPI_DMA_Tx_IRQ_Handler(void);
+extern void SDC_SPI_IRQ_Handler(void);
+extern void SDC_SPI_Transfer_Complete_Callback(void);
+extern void SDC_SPI_Transfer_Error_Callback(void);
+extern void SDC_Async_IRQ_Handler(void);
+extern void EPD_SPI_DMA_Tx_IRQ_Handler(void);
+extern void EPD_SPI_IRQ_Handler(void);
+extern void EPD_SPI_Transfer_Complete_Callback(void);
+extern void EPD_SPI_Transfer_Error_Callback(void);
+extern void EPD_BUSY_IRQ_Handler(void);
+extern void RTC_WakeUp_IRQ_Handler(void);
+
 /**
  * Handle SysTick for proper HAL operation
  */
@@ -7,3 +20,94 @@ void SysTick_Handler(void) {
     HAL_SYSTICK_IRQHandler();
     HAL_IncTick();
 }
+
+/**
+ * Handle PendSV, used to continue queued SD card reads at the lowest priority
+ */
+void PendSV_Handler(void) {
+    SDC_Async_IRQ_Handler();
+}
+
+/**
+ * Handle EXTI interrupts for BUSY signal of E-paper display
+ */
+void EXTI9_5_IRQHandler(void) {
+    EPD_BUSY_IRQ_Handler();
+}
+
+/**
+ * Handle RTC Wakeup timer interrupts
+ */
+void RTC_WKUP_IRQHandler(void) {
+    RTC_WakeUp_IRQ_Handler();
+}
+
+/**
+ * Handle DMA interrupts for SPI1 TX used by E-paper display
+ */
+void DMA1_Channel3_IRQHandler(void) {
+    EPD_SPI_DMA_Tx_IRQ_Handler();
+}
+
+/**
+ * Handle DMA interrupts for SPI2 RX used by SD card
+ */
+void DMA1_Channel4_IRQHandler(void) {
+    SDC_SPI_DMA_Rx_IRQ_Handler();
+}
+
+/**
+ * Handle DMA interrupts for SPI2 TX used by SD card
+ */
+void DMA1_Channel5_IRQHandler(void) {
+    SDC_SPI_DMA_Tx_IRQ_Handler();
+}
+
+/**
+ * Handle SPI1 interrupts used by E-paper display
+ */
+void SPI1_IRQHandler(void) {
+    EPD_SPI_IRQ_Handler();
+}
+
+/**
+ * Handle SPI2 interrupts used by SD card
+ */
+void SPI2_IRQHandler(void) {
+    SDC_SPI_IRQ_Handler();
+}
+
+/**
+ * Handle completion of simultaneous transmit and receive on SPI peripherals
+ *
+ * @param hspi  (IN)    Handle to SPI peripheral
+ */
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi) {
+    if (hspi->Instance == SPI2) {
+        SDC_SPI_Transfer_Complete_Callback();
+    }
+}
+
+/**
+ * Handle completion of transmit-only transfers on SPI peripherals
+ *
+ * @param hspi  (IN)    Handle to SPI peripheral
+ */
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi) {
+    if (hspi->Instance == SPI1) {
+        EPD_SPI_Transfer_Complete_Callback();
+    }
+}
+
+/**
+ * Handle errors reported during interrupt/DMA based SPI transfers
+ *
+ * @param hspi  (IN)    Handle to SPI peripheral
+ */
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi) {
+    if (hspi->Instance == SPI1) {
+        EPD_SPI_Transfer_Error_Callback();
+    } else if (hspi->Instance == SPI2) {
+        SDC_SPI_Transfer_Error_Callback();
+    }
+}
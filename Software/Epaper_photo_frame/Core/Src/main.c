@@ -5,23 +5,56 @@
 #include "epd.h"
 #include "sdcard.h"
 #include "fat32.h"
+#include "exfat.h"
+#include "readahead.h"
 #include "led.h"
 #include "rtc_and_pwr.h"
 #include "logging.h"
+#include "profiling.h"
+#include "refresh_policy.h"
 
 static Boolean SystemClockConfig(void);
 static void Early_Stage_Error_Handler(void);
 static void Configure_For_Low_Power(void);
-
-// Data buffer to store 1 cluster worth of data when reading file from SD card
-// and processing it
-static uint8_t data_buffer[SECTOR_SIZE * SECTORS_PER_CLUSTER];
+static void Log_SD_Transfer_Stats(void);
+static void Log_SD_Latency_Stats(void);
+static void Log_EPD_Transfer_Stats(void);
+static FAT32_Status Display_Image_From_Root_Dir(void);
+static void Save_Next_File_Location(const uint32_t filename_counter,
+        const FAT32_File_Location *restrict const location);
+static Boolean Load_Next_File_Location(const uint32_t filename_counter,
+        FAT32_File_Location *restrict const location);
+static uint32_t Next_File_Location_Checksum(const uint32_t filename_counter,
+        const FAT32_File_Location *restrict const location);
+
+// Data buffer to store contiguous clusters read from SD card in one go and
+// process them. Images written in one go to the card are mostly contiguous, so
+// a larger buffer means fewer reads and fewer calls to the display callback
+#define DATA_BUFFER_SIZE	(8 * 1024)
+static uint8_t data_buffer[DATA_BUFFER_SIZE];
 
 static char filename_buffer[FILENAME_MAX_LENGTH];
 
+// Next file location is stored word by word after the checksum and the
+// filename counter, and has to fit in the remaining backup registers
+#define NEXT_FILE_LOCATION_WORDS	\
+    (sizeof(FAT32_File_Location) / sizeof(uint32_t))
+#define NEXT_FILE_LOCATION_CHECKSUM_SEED	(0x46415433)
+_Static_assert((NEXT_FILE_LOCATION_BKUP_REG + 2 + NEXT_FILE_LOCATION_WORDS)
+        <= REFRESH_POLICY_BKUP_REG,
+        "Next file location does not fit in backup registers");
+
+static FAT32_File_Location next_file_location;
+
+// Cards larger than 32 GB come formatted with exFAT instead of FAT32
+static Boolean is_exfat_volume = FALSE;
+
 int main(void) {
     Boolean is_bootup_from_lpm;
     uint32_t filename_counter;
+    Boolean is_next_file_located = FALSE;
+    Boolean is_display_cleared;
+    const Block_Device *block_device;
     FAT32_Status fat32_ret;
 
     if (HAL_Init() != HAL_OK) {
@@ -38,6 +71,8 @@ int main(void) {
 
     Log_Msg("Log init success!!!\n");
 
+    Profiling_Init();
+
     if (RTC_Init() != RTC_OK) {
         Log_Msg("Error initializing RTC peripheral");
         Error_Handler();
@@ -52,12 +87,17 @@ int main(void) {
     if (is_bootup_from_lpm == TRUE) {
         Log_Msg("Booting up from low power mode");
         filename_counter = RTC_Read_Backup_Register(FILENAME_COUNTER_BKUP_REG);
+        is_next_file_located = Load_Next_File_Location(filename_counter,
+                &next_file_location);
     } else {
         filename_counter = 0;    // Start with filenames from 0.bin
     }
 
     snprintf(filename_buffer, FILENAME_MAX_LENGTH, "%lu.bin", filename_counter);
 
+    Refresh_Policy_Init(is_bootup_from_lpm);
+    is_display_cleared = Refresh_Policy_Should_Clear();
+
     // Light up the LED to indicate that the chip is starting main work
     Busy_LED_Indicate_Work_Start();
 
@@ -67,43 +107,106 @@ int main(void) {
     }
     Log_Msg("E-paper display initialized");
 
-    if (EPD_Display_Clear(WHITE) != EPD_OK) {
-        Log_Msg("Error clearing E-paper display screen");
-        Error_Handler();
+    // Clearing takes a full refresh of its own, so only do it when the refresh
+    // policy asks for it
+    if (is_display_cleared == TRUE) {
+        if (EPD_Display_Clear(WHITE) != EPD_OK) {
+            Log_Msg("Error clearing E-paper display screen");
+            Error_Handler();
+        }
+        Log_Msg("E-paper display cleared");
     }
 
     if (SDC_Init() != SDC_OK) {
         Log_Msg("Error initializing SD card");
         Error_Handler();
     }
-    Log_Msg("SD card initialized!!");
-
-    if (FAT32_Init() != FAT32_OK) {
-        Log_Msg("Error initializing FAT32 module");
-        Error_Handler();
+    Log_Msg("SD card initialized!! Bus clock %lu Hz", SDC_Get_Bus_Frequency());
+
+    block_device = Readahead_Init(SDC_Get_Block_Device());
+    if (is_next_file_located == TRUE) {
+        // Card still holds the file the image was located in before sleeping,
+        // so stream it right away
+        fat32_ret = FAT32_Init_From_Location(block_device,
+                &next_file_location);
+        if (fat32_ret == FAT32_OK) {
+            Log_Msg("FAT32 initialized from saved location of %s",
+                    filename_buffer);
+            fat32_ret = FAT32_Read_File_At_Location(&next_file_location,
+                    data_buffer, sizeof(data_buffer),
+                    &EPD_Display_Image_Callback);
+        }
+        if (fat32_ret != FAT32_OK) {
+            // Frame sent so far is restarted when the image is read again
+            Log_Msg("Saved location of %s not usable (%d). Mounting filesystem",
+                    filename_buffer, fat32_ret);
+            is_next_file_located = FALSE;
+        }
     }
-    Log_Msg("FAT32 initialized!!");
-
-    fat32_ret = FAT32_Read_File_From_Root_Dir_And_Process_Data(filename_buffer,
-            data_buffer, &EPD_Display_Image_Callback);
-    if ((filename_counter > 0) && (fat32_ret == FAT32_READ_FILE_NOT_FOUND)) {
-        // We ran out of all the files to display. Restart from 0.bin
-        filename_counter = 0;
-        snprintf(filename_buffer, FILENAME_MAX_LENGTH, "%lu.bin",
-                filename_counter);
-        fat32_ret = FAT32_Read_File_From_Root_Dir_And_Process_Data(
-                filename_buffer, data_buffer, &EPD_Display_Image_Callback);
+    if (is_next_file_located != TRUE) {
+        if (FAT32_Init(block_device) == FAT32_OK) {
+            Log_Msg("FAT32 initialized!!");
+        } else if (EXFAT_Init(block_device) == EXFAT_OK) {
+            is_exfat_volume = TRUE;
+            Log_Msg("exFAT initialized!!");
+        } else {
+            Log_Msg("Error initializing FAT32 and exFAT modules");
+            Error_Handler();
+        }
+
+        fat32_ret = Display_Image_From_Root_Dir();
+        if ((filename_counter > 0)
+                && (fat32_ret == FAT32_READ_FILE_NOT_FOUND)) {
+            // We ran out of all the files to display. Restart from 0.bin
+            filename_counter = 0;
+            snprintf(filename_buffer, FILENAME_MAX_LENGTH, "%lu.bin",
+                    filename_counter);
+            fat32_ret = Display_Image_From_Root_Dir();
+        }
     }
     if (fat32_ret != FAT32_OK) {
         Log_Msg("Error reading file %s and displaying image!", filename_buffer);
         Error_Handler();
     }
+    Refresh_Policy_Record_Image(is_display_cleared);
+    Log_EPD_Transfer_Stats();
+
+    // Find the next file to display while the filesystem is mounted, so that
+    // the next wake can start streaming it without mounting again
+    filename_counter++;
+    snprintf(filename_buffer, FILENAME_MAX_LENGTH, "%lu.bin", filename_counter);
+    if (is_exfat_volume == TRUE) {
+        // Locations are only resolved on FAT32 volumes. Location without
+        // extents makes the next wake mount the filesystem
+        next_file_location.extent_count = 0;
+    } else {
+        fat32_ret = FAT32_Locate_File_In_Root_Dir(filename_buffer,
+                &next_file_location);
+        if (fat32_ret == FAT32_READ_FILE_NOT_FOUND) {
+            // We ran out of all the files to display. Restart from 0.bin
+            filename_counter = 0;
+            snprintf(filename_buffer, FILENAME_MAX_LENGTH, "%lu.bin",
+                    filename_counter);
+            fat32_ret = FAT32_Locate_File_In_Root_Dir(filename_buffer,
+                    &next_file_location);
+        }
+        if (fat32_ret != FAT32_OK) {
+            Log_Msg("Could not locate next file %s", filename_buffer);
+            next_file_location.extent_count = 0;
+        }
+    }
+
+    // Sectors read ahead past the last image are not needed anymore
+    Readahead_Flush();
+    Log_SD_Transfer_Stats();
 
     if (SDC_Power_Off() != SDC_OK) {
         Log_Msg("Error powering off SD card");
         Error_Handler();
     }
 
+    Log_SD_Latency_Stats();
+
     HAL_Delay(2000);
 
     if (EPD_Put_To_Sleep() != EPD_OK) {
@@ -121,9 +224,10 @@ int main(void) {
 
     Busy_LED_De_Init();
 
-    // Increment the filename counter for reading the next file after exiting
-    // sleep mode and store it in corresponding backup register
-    RTC_Write_Backup_Register(FILENAME_COUNTER_BKUP_REG, filename_counter + 1);
+    // Store the filename counter and location of the next file for reading it
+    // after exiting sleep mode in corresponding backup registers
+    RTC_Write_Backup_Register(FILENAME_COUNTER_BKUP_REG, filename_counter);
+    Save_Next_File_Location(filename_counter, &next_file_location);
 
     if (RTC_Set_WakeUp_Timer(SECONDS_TO_SPEND_IN_LOW_POWER_MODE) != RTC_OK) {
         Log_Msg("Could not set up RTC Wakeup timer for %d seconds",
@@ -211,6 +315,199 @@ void Error_Handler(void) {
         ;
 }
 
+/**
+ * Read the file named in filename buffer from root directory of the mounted
+ * volume and display it
+ *
+ * @return  Status for finding, reading and displaying the file. exFAT errors are
+ *             reported with the matching FAT32 status
+ */
+static FAT32_Status Display_Image_From_Root_Dir(void) {
+    EXFAT_Status exfat_ret;
+
+    if (is_exfat_volume == FALSE) {
+        return FAT32_Read_File_From_Root_Dir_And_Process_Data(filename_buffer,
+                data_buffer, sizeof(data_buffer), &EPD_Display_Image_Callback);
+    }
+
+    exfat_ret = EXFAT_Read_File_From_Root_Dir_And_Process_Data(filename_buffer,
+            data_buffer, sizeof(data_buffer), &EPD_Display_Image_Callback);
+    if (exfat_ret == EXFAT_OK) {
+        return FAT32_OK;
+    } else if (exfat_ret == EXFAT_READ_FILE_NOT_FOUND) {
+        return FAT32_READ_FILE_NOT_FOUND;
+    }
+    Log_Msg("exFAT read failed: %d", exfat_ret);
+    return FAT32_READ_FILE_ERR;
+}
+
+/**
+ * Log how long sending the last frame of image data to E-paper display took,
+ * and how long MCU was active while waiting for the display to refresh
+ */
+static void Log_EPD_Transfer_Stats(void) {
+    EPD_Transfer_Stats stats;
+    EPD_Refresh_Stats refresh_stats;
+
+    EPD_Get_Transfer_Stats(&stats);
+    Log_Msg("EPD frame %lu: %lu bytes in %lu bursts, %lu us sending "
+            "(%lu us waiting for DMA), %lu us total", stats.frames, stats.bytes,
+            stats.bursts, stats.transfer_time_us, stats.dma_wait_time_us,
+            stats.wall_time_us);
+
+    // MCU used to be active for the whole busy time while polling BUSY line
+    EPD_Get_Refresh_Stats(&refresh_stats);
+    Log_Msg("EPD refresh %lu: busy for %lu ms, MCU active for %lu us with %lu "
+            "Stop mode entries", refresh_stats.refreshes,
+            refresh_stats.busy_time_ms, refresh_stats.active_time_us,
+            refresh_stats.stop_entries);
+}
+
+/**
+ * Log the cost of receiving sector payloads for every SD card transfer mode that
+ * was used, to compare throughput and energy per sector between them. Also log
+ * the cost of single byte exchanges used for commands and polling, and how well
+ * reads were served by the read-ahead layer, the FAT sector cache and the root
+ * directory index
+ */
+static void Log_SD_Transfer_Stats(void) {
+    static const char *const mode_names[SDC_TRANSFER_MODE_COUNT] = {
+            "blocking", "DMA" };
+    SDC_Transfer_Stats stats;
+    SDC_Byte_Exchange_Stats byte_stats;
+    Readahead_Stats readahead_stats;
+    FAT32_Cache_Stats fat_cache_stats;
+    FAT32_Read_Stats fat_read_stats;
+    FAT32_Index_Stats fat_index_stats;
+    EXFAT_Read_Stats exfat_read_stats;
+
+    for (uint8_t mode = 0; mode < SDC_TRANSFER_MODE_COUNT; mode++) {
+        SDC_Get_Transfer_Stats(mode, &stats);
+        if ((stats.sectors == 0) || (stats.wall_time_us == 0)) {
+            continue;
+        }
+        Log_Msg("SD %s reads: %lu sectors in %lu us (%lu KB/s), %lu us active",
+                mode_names[mode], stats.sectors, stats.wall_time_us,
+                (uint32_t) (((uint64_t) stats.sectors * SECTOR_SIZE * 1000000)
+                        / ((uint64_t) stats.wall_time_us * 1024)),
+                Profiling_Cycles_To_Us(stats.active_cycles));
+    }
+
+    SDC_Get_Byte_Exchange_Stats(&byte_stats);
+    if (byte_stats.bytes > 0) {
+        Log_Msg("SD byte exchanges: %lu bytes in %lu cycles (%lu cycles/byte)",
+                byte_stats.bytes, byte_stats.cycles,
+                byte_stats.cycles / byte_stats.bytes);
+    }
+
+    SDC_Dump_Stats();
+
+    Readahead_Get_Stats(&readahead_stats);
+    Log_Msg("SD read-ahead: %lu hits, %lu misses, %lu sectors prefetched, "
+            "%lu wasted", readahead_stats.hits, readahead_stats.misses,
+            readahead_stats.prefetched_blocks, readahead_stats.wasted_blocks);
+
+    FAT32_Get_Cache_Stats(&fat_cache_stats);
+    Log_Msg("FAT sector cache: %lu hits, %lu misses", fat_cache_stats.hits,
+            fat_cache_stats.misses);
+
+    FAT32_Get_Read_Stats(&fat_read_stats);
+    Log_Msg("FAT32 reads: %lu files, %lu clusters in %lu extents",
+            fat_read_stats.files, fat_read_stats.clusters,
+            fat_read_stats.extents);
+
+    FAT32_Get_Index_Stats(&fat_index_stats);
+    Log_Msg("FAT32 root directory: %lu images indexed, %lu index hits, "
+            "%lu scans", fat_index_stats.entries, fat_index_stats.hits,
+            fat_index_stats.dir_scans);
+
+    if (is_exfat_volume == TRUE) {
+        EXFAT_Get_Read_Stats(&exfat_read_stats);
+        Log_Msg("exFAT reads: %lu files (%lu contiguous), %lu extents, "
+                "%lu FAT sectors read", exfat_read_stats.files,
+                exfat_read_stats.contiguous_files, exfat_read_stats.extents,
+                exfat_read_stats.fat_reads);
+    }
+}
+
+/**
+ * Log the time spent bringing up and shutting down the SD card during this wake
+ */
+static void Log_SD_Latency_Stats(void) {
+    SDC_Latency_Stats stats;
+
+    SDC_Get_Latency_Stats(&stats);
+    Log_Msg("SD init took %lu us (%lu ACMD41 polls), power off took %lu us",
+            stats.init_time_us, stats.acmd41_polls, stats.power_off_time_us);
+}
+
+/**
+ * Store the location of the file to display after the next wake in backup
+ * registers, along with a checksum to detect registers which were not written
+ *
+ * @param filename_counter  (IN)    Filename counter of the file
+ * @param location          (IN)    Location of the file
+ */
+static void Save_Next_File_Location(const uint32_t filename_counter,
+        const FAT32_File_Location *restrict const location) {
+    const uint32_t *restrict const words = (const uint32_t*) location;
+
+    for (uint32_t i = 0; i < NEXT_FILE_LOCATION_WORDS; i++) {
+        RTC_Write_Backup_Register(NEXT_FILE_LOCATION_BKUP_REG + 2 + i,
+                words[i]);
+    }
+    RTC_Write_Backup_Register(NEXT_FILE_LOCATION_BKUP_REG + 1,
+            filename_counter);
+    RTC_Write_Backup_Register(NEXT_FILE_LOCATION_BKUP_REG,
+            Next_File_Location_Checksum(filename_counter, location));
+}
+
+/**
+ * Read the location of the file to display from backup registers
+ *
+ * @param filename_counter  (IN)    Filename counter of the file to display
+ * @param location          (OUT)   Variable to store the location in
+ *
+ * @return  True if a location was stored for the given file. False otherwise.
+ */
+static Boolean Load_Next_File_Location(const uint32_t filename_counter,
+        FAT32_File_Location *restrict const location) {
+    uint32_t *restrict const words = (uint32_t*) location;
+
+    if (RTC_Read_Backup_Register(NEXT_FILE_LOCATION_BKUP_REG + 1)
+            != filename_counter) {
+        return FALSE;
+    }
+    for (uint32_t i = 0; i < NEXT_FILE_LOCATION_WORDS; i++) {
+        words[i] = RTC_Read_Backup_Register(
+                NEXT_FILE_LOCATION_BKUP_REG + 2 + i);
+    }
+    if (RTC_Read_Backup_Register(NEXT_FILE_LOCATION_BKUP_REG)
+            != Next_File_Location_Checksum(filename_counter, location)) {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * Compute the checksum stored with the next file location
+ *
+ * @param filename_counter  (IN)    Filename counter of the file
+ * @param location          (IN)    Location of the file
+ *
+ * @return  Checksum over the filename counter and the location
+ */
+static uint32_t Next_File_Location_Checksum(const uint32_t filename_counter,
+        const FAT32_File_Location *restrict const location) {
+    const uint32_t *restrict const words = (const uint32_t*) location;
+    uint32_t checksum = NEXT_FILE_LOCATION_CHECKSUM_SEED ^ filename_counter;
+
+    for (uint32_t i = 0; i < NEXT_FILE_LOCATION_WORDS; i++) {
+        checksum = ((checksum << 5) | (checksum >> 27)) ^ words[i];
+    }
+    return checksum;
+}
+
 /**
  * Configure the MCU to consume the least amount of current when sleeping, in
  * order to extend battery life
@@ -224,4 +521,7 @@ static void Configure_For_Low_Power(void) {
     // Disable clock for GPIO peripherals
     __HAL_RCC_GPIOA_CLK_DISABLE();
     __HAL_RCC_GPIOB_CLK_DISABLE();
+
+    // DMA1 channels of SD card and E-paper display are de-initialized by now
+    __HAL_RCC_DMA1_CLK_DISABLE();
 }
@@ -6,6 +6,8 @@ extern void Logger_Msp_Init(void);
 extern void RTC_Msp_Init(void);
 extern void EPD_SPI_Msp_Deinit(void);
 extern void SDC_SPI_Msp_De_Init(void);
+extern void SDC_CRC_Msp_Init(void);
+extern void SDC_CRC_Msp_De_Init(void);
 
 /**
  * Low level initialization for STM32 HAL
@@ -58,3 +60,21 @@ void HAL_SPI_MspDeInit(SPI_HandleTypeDef *hspi)
         SDC_SPI_Msp_De_Init();
     }
 }
+
+/**
+ * Low level initialization for CRC peripheral
+ *
+ * @param hcrc  (UNUSED)    Handle to CRC peripheral
+ */
+void HAL_CRC_MspInit(CRC_HandleTypeDef *hcrc) {
+    SDC_CRC_Msp_Init();
+}
+
+/**
+ * Low level de-initialization for CRC peripheral
+ *
+ * @param hcrc  (UNUSED)    Handle to CRC peripheral
+ */
+void HAL_CRC_MspDeInit(CRC_HandleTypeDef *hcrc) {
+    SDC_CRC_Msp_De_Init();
+}
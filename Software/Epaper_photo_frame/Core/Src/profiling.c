@@ -0,0 +1,31 @@
+#include "stm32l4xx_hal.h"
+#include "profiling.h"
+
+void Profiling_Init(void) {
+    SET_BIT(CoreDebug->DEMCR, CoreDebug_DEMCR_TRCENA_Msk);
+    DWT->CYCCNT = 0;
+    SET_BIT(DWT->CTRL, DWT_CTRL_CYCCNTENA_Msk);
+}
+
+uint32_t Profiling_Get_Cycles(void) {
+    return DWT->CYCCNT;
+}
+
+uint32_t Profiling_Get_Time_Us(void) {
+    uint32_t tick;
+    uint32_t systick_val;
+
+    // Re-read if SysTick wrapped around between reading the tick and counter
+    do {
+        tick = HAL_GetTick();
+        systick_val = SysTick->VAL;
+    } while (tick != HAL_GetTick());
+
+    // SysTick counts down from LOAD to 0 once every tick (1 ms)
+    return (tick * 1000)
+            + (((SysTick->LOAD - systick_val) * 1000) / (SysTick->LOAD + 1));
+}
+
+uint32_t Profiling_Cycles_To_Us(const uint32_t cycles) {
+    return (uint32_t) (((uint64_t) cycles * 1000000) / SystemCoreClock);
+}
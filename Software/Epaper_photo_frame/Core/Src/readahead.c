@@ -0,0 +1,334 @@
+#include <stddef.h>
+#include <string.h>
+#include "readahead.h"
+
+/*
+ * Longest run of sectors which can be read ahead, and number of sequential
+ * streams tracked at the same time. FAT32 file reads interleave the data
+ * clusters with reads of FAT sectors, so two streams keep the data stream
+ * from being forgotten
+ */
+#define READAHEAD_MAX_RUN_BLOCKS    (READAHEAD_RAM_BUDGET \
+                                        / (READAHEAD_DEPTH * SECTOR_SIZE))
+#define READAHEAD_STREAMS           (2)
+
+#if READAHEAD_MAX_RUN_BLOCKS == 0
+#error "READAHEAD_RAM_BUDGET is too small for READAHEAD_DEPTH runs of sectors"
+#endif
+
+/**
+ * State of an asynchronous read, updated from its completion callback
+ */
+typedef struct {
+    volatile uint8_t done;
+    volatile Block_Device_Status status;
+} Readahead_Completion;
+
+/**
+ * Run of sectors read ahead of the caller
+ */
+typedef struct {
+    uint8_t in_use;
+    uint32_t lba;
+    uint32_t count;
+    Readahead_Completion completion;
+    uint8_t buffer[READAHEAD_MAX_RUN_BLOCKS * SECTOR_SIZE];
+} Readahead_Slot;
+
+/**
+ * Sequential access pattern seen in the reads
+ */
+typedef struct {
+    uint32_t next_lba;      // Address expected for the next sequential read
+    uint32_t last_used;     // Read number when the stream was last continued
+} Readahead_Stream;
+
+static const Block_Device *lower_device;
+static Readahead_Slot slots[READAHEAD_DEPTH];
+static Readahead_Stream streams[READAHEAD_STREAMS];
+static uint32_t reads_served;
+// Sequential reads announced by the caller. Streams inside them are not read
+// ahead past their end, which is usually the end of a file's extent
+static uint32_t hint_lba;
+static uint32_t hint_end_lba;
+static Readahead_Stats readahead_stats;
+
+static Block_Device_Status Readahead_Read(void *ctx, const uint32_t lba,
+        const uint32_t count, uint8_t *restrict const buffer);
+static uint32_t Readahead_Block_Count(void *ctx);
+static void Readahead_Hint_Sequential_Read(void *ctx, const uint32_t lba,
+        const uint32_t end_lba);
+static Block_Device_Status Read_Through(const uint32_t lba,
+        const uint32_t count, uint8_t *restrict const buffer);
+static Readahead_Slot* Find_Slot(const uint32_t lba, const uint32_t count);
+static void Release_Slot(Readahead_Slot *restrict const slot,
+        const uint8_t used);
+static uint8_t Continue_Stream(const uint32_t lba, const uint32_t count);
+static void Prefetch(const uint32_t lba, const uint32_t count);
+static void Read_Complete_Callback(const Block_Device_Status status,
+        void *cb_ctx);
+
+static const Block_Device readahead_device = {
+        .read_blocks = &Readahead_Read,
+        .read_blocks_async = NULL,
+        .wait_for_completion = NULL,
+        .get_block_count = &Readahead_Block_Count,
+        .hint_sequential_read = &Readahead_Hint_Sequential_Read,
+        .ctx = NULL,
+};
+
+const Block_Device* Readahead_Init(const Block_Device *restrict const dev) {
+    lower_device = dev;
+    memset(slots, 0, sizeof(slots));
+    memset(streams, 0, sizeof(streams));
+    reads_served = 0;
+    hint_lba = 0;
+    hint_end_lba = 0;
+    return &readahead_device;
+}
+
+void Readahead_Flush(void) {
+    for (uint8_t i = 0; i < READAHEAD_DEPTH; i++) {
+        if (slots[i].in_use) {
+            Release_Slot(&slots[i], 0);
+        }
+    }
+}
+
+void Readahead_Get_Stats(Readahead_Stats *restrict const stats) {
+    *stats = readahead_stats;
+}
+
+/**
+ * Serve a read from sectors read ahead when possible, and start reading the
+ * following sectors if the read continues a sequential stream
+ *
+ * @param ctx       (IN)    Unused
+ * @param lba       (IN)    Address of the first block to read
+ * @param count     (IN)    Number of consecutive blocks to read
+ * @param buffer    (OUT)   Buffer to read the blocks into
+ *
+ * @return  Status of the read operation
+ */
+static Block_Device_Status Readahead_Read(void *ctx, const uint32_t lba,
+        const uint32_t count, uint8_t *restrict const buffer) {
+    Block_Device_Status ret = BLOCK_DEVICE_READ_ERR;
+    (void) ctx;
+
+    // Nothing can be read ahead without asynchronous reads, and runs longer
+    // than a slot do not fit the budget
+    if ((lower_device->read_blocks_async == NULL)
+            || (count > READAHEAD_MAX_RUN_BLOCKS)) {
+        Readahead_Flush();
+        return Block_Device_Read_Blocks(lower_device, lba, count, buffer);
+    }
+
+    Readahead_Slot *const slot = Find_Slot(lba, count);
+    if (slot != NULL) {
+        Block_Device_Wait_For_Completion(lower_device, &slot->completion.done);
+        ret = slot->completion.status;
+        if (ret == BLOCK_DEVICE_OK) {
+            memcpy(buffer, slot->buffer + ((lba - slot->lba) * SECTOR_SIZE),
+                    count * SECTOR_SIZE);
+            readahead_stats.hits++;
+        }
+        Release_Slot(slot, (ret == BLOCK_DEVICE_OK));
+    }
+    if (ret != BLOCK_DEVICE_OK) {
+        readahead_stats.misses++;
+        ret = Read_Through(lba, count, buffer);
+        if (ret != BLOCK_DEVICE_OK) {
+            return ret;
+        }
+    }
+
+    reads_served++;
+    if (Continue_Stream(lba, count)) {
+        Prefetch(lba + count, count);
+    }
+    return BLOCK_DEVICE_OK;
+}
+
+/**
+ * Block count function of the read-ahead layer
+ *
+ * @param ctx   (IN)    Unused
+ *
+ * @return  Number of blocks on the underlying device
+ */
+static uint32_t Readahead_Block_Count(void *ctx) {
+    (void) ctx;
+    return Block_Device_Get_Block_Count(lower_device);
+}
+
+/**
+ * Record the sequential reads announced by the caller
+ *
+ * @param ctx       (IN)    Unused
+ * @param lba       (IN)    Address of the first block of the sequential reads
+ * @param end_lba   (IN)    Address of the first block after them
+ */
+static void Readahead_Hint_Sequential_Read(void *ctx, const uint32_t lba,
+        const uint32_t end_lba) {
+    (void) ctx;
+    hint_lba = lba;
+    hint_end_lba = end_lba;
+}
+
+/**
+ * Read sectors which were not read ahead. The read is queued behind the reads
+ * already in flight, since they own the underlying device until they finish
+ *
+ * @param lba       (IN)    Address of the first block to read
+ * @param count     (IN)    Number of consecutive blocks to read
+ * @param buffer    (OUT)   Buffer to read the blocks into
+ *
+ * @return  Status of the read operation
+ */
+static Block_Device_Status Read_Through(const uint32_t lba,
+        const uint32_t count, uint8_t *restrict const buffer) {
+    Readahead_Completion completion = { 0 };
+
+    if (Block_Device_Read_Blocks_Async(lower_device, lba, count, buffer,
+            &Read_Complete_Callback, &completion) == BLOCK_DEVICE_OK) {
+        Block_Device_Wait_For_Completion(lower_device, &completion.done);
+        return completion.status;
+    }
+
+    // Queue is full. Let it drain and read synchronously
+    Readahead_Flush();
+    return Block_Device_Read_Blocks(lower_device, lba, count, buffer);
+}
+
+/**
+ * Find the slot holding or reading all the requested sectors
+ *
+ * @param lba   (IN)    Address of the first block
+ * @param count (IN)    Number of consecutive blocks
+ *
+ * @return  Slot covering the sectors, or NULL if there is none
+ */
+static Readahead_Slot* Find_Slot(const uint32_t lba, const uint32_t count) {
+    for (uint8_t i = 0; i < READAHEAD_DEPTH; i++) {
+        if (slots[i].in_use && (slots[i].lba <= lba)
+                && ((lba + count) <= (slots[i].lba + slots[i].count))) {
+            return &slots[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Free a slot for reading other sectors ahead. A read still in flight is
+ * waited for, since it writes into the slot's buffer
+ *
+ * @param slot  (IN)    Slot to free
+ * @param used  (IN)    Non-zero if the sectors were handed to the caller
+ */
+static void Release_Slot(Readahead_Slot *restrict const slot,
+        const uint8_t used) {
+    Block_Device_Wait_For_Completion(lower_device, &slot->completion.done);
+    if (!used) {
+        readahead_stats.wasted_blocks += slot->count;
+    }
+    slot->in_use = 0;
+}
+
+/**
+ * Check if a read continues one of the tracked sequential streams, and update
+ * the streams with it. A read not continuing any stream replaces the least
+ * recently continued one
+ *
+ * @param lba   (IN)    Address of the first block read
+ * @param count (IN)    Number of consecutive blocks read
+ *
+ * @return  Non-zero if the read continues a stream
+ */
+static uint8_t Continue_Stream(const uint32_t lba, const uint32_t count) {
+    Readahead_Stream *oldest = &streams[0];
+
+    for (uint8_t i = 0; i < READAHEAD_STREAMS; i++) {
+        if ((streams[i].last_used != 0) && (streams[i].next_lba == lba)) {
+            streams[i].next_lba = lba + count;
+            streams[i].last_used = reads_served;
+            return 1;
+        }
+        if (streams[i].last_used < oldest->last_used) {
+            oldest = &streams[i];
+        }
+    }
+
+    oldest->next_lba = lba + count;
+    oldest->last_used = reads_served;
+    return 0;
+}
+
+/**
+ * Start reading up to READAHEAD_DEPTH runs of sectors following a sequential
+ * read. Sectors read ahead earlier and outside of the new window are dropped.
+ * Runs stop at the end of the device, and at the end of the announced
+ * sequential reads if the read was one of them, where the last run is cut
+ * short to match the last read
+ *
+ * @param lba   (IN)    Address of the first block after the sequential read
+ * @param count (IN)    Number of blocks in each run, same as the read
+ */
+static void Prefetch(const uint32_t lba, const uint32_t count) {
+    const uint32_t window_end = lba + (READAHEAD_DEPTH * count);
+    uint32_t end_lba = Block_Device_Get_Block_Count(lower_device);
+    uint32_t next_lba = lba;
+    uint32_t run;
+    uint8_t i;
+
+    if ((lba > hint_lba) && (lba <= hint_end_lba)
+            && (hint_end_lba < end_lba)) {
+        end_lba = hint_end_lba;
+    }
+
+    // Reclaim slots which finished reading sectors the stream moved away from
+    for (i = 0; i < READAHEAD_DEPTH; i++) {
+        if (slots[i].in_use && slots[i].completion.done
+                && ((slots[i].lba < lba) || (slots[i].lba >= window_end))) {
+            Release_Slot(&slots[i], 0);
+        }
+    }
+
+    while (((next_lba + count) <= window_end) && (next_lba < end_lba)) {
+        run = ((end_lba - next_lba) < count) ? (end_lba - next_lba) : count;
+        if (Find_Slot(next_lba, run) == NULL) {
+            for (i = 0; (i < READAHEAD_DEPTH) && slots[i].in_use; i++) {
+            }
+            if (i == READAHEAD_DEPTH) {
+                return;
+            }
+
+            Readahead_Slot *const slot = &slots[i];
+            slot->lba = next_lba;
+            slot->count = run;
+            slot->completion.done = 0;
+            slot->in_use = 1;
+            if (Block_Device_Read_Blocks_Async(lower_device, next_lba, run,
+                    slot->buffer, &Read_Complete_Callback, &slot->completion)
+                    != BLOCK_DEVICE_OK) {
+                // Device queue is full. Try again on the next read
+                slot->in_use = 0;
+                return;
+            }
+            readahead_stats.prefetched_blocks += run;
+        }
+        next_lba += count;
+    }
+}
+
+/**
+ * Record the completion of an asynchronous read
+ *
+ * @param status    (IN)    Status of the read
+ * @param cb_ctx    (IN)    Completion state of the read
+ */
+static void Read_Complete_Callback(const Block_Device_Status status,
+        void *cb_ctx) {
+    Readahead_Completion *const completion = cb_ctx;
+    completion->status = status;
+    completion->done = 1;
+}
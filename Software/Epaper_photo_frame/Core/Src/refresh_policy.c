@@ -0,0 +1,112 @@
+#include "stm32l4xx_hal.h"
+#include "refresh_policy.h"
+#include "rtc_and_pwr.h"
+
+/*
+ * Policy is stored in REFRESH_POLICY_BKUP_REG as a marker, the compiled
+ * defaults, the interval and the policy, and the number of images shown since
+ * the last clear in the next register. Marker tells a stored policy apart from
+ * registers reset by power loss. Compiled defaults tell if the firmware was
+ * updated with new defaults, which then replace the stored policy
+ */
+#define REFRESH_POLICY_MARKER           (0xE)
+#define REFRESH_POLICY_MARKER_SHIFT     (28)
+#define REFRESH_POLICY_DEFAULTS         ((REFRESH_POLICY_DEFAULT << 8) \
+                                            | REFRESH_POLICY_DEFAULT_INTERVAL)
+#define REFRESH_POLICY_DEFAULTS_SHIFT   (16)
+#define REFRESH_POLICY_DEFAULTS_MASK    (0xFFF)
+#define REFRESH_POLICY_INTERVAL_SHIFT   (8)
+#define REFRESH_POLICY_INTERVAL_MASK    (0xFF)
+#define REFRESH_POLICY_POLICY_MASK      (0xFF)
+#define IMAGES_SINCE_CLEAR_BKUP_REG     (REFRESH_POLICY_BKUP_REG + 1)
+#define SECONDS_PER_HOUR                (3600)
+
+_Static_assert((REFRESH_POLICY_BKUP_REG + 2) <= RTC_BKP_NUMBER,
+        "Refresh policy does not fit in backup registers");
+_Static_assert((REFRESH_POLICY_DEFAULT_INTERVAL >= 1)
+        && (REFRESH_POLICY_DEFAULT_INTERVAL <= REFRESH_POLICY_INTERVAL_MASK)
+        && (REFRESH_POLICY_DEFAULTS <= REFRESH_POLICY_DEFAULTS_MASK),
+        "Default refresh policy does not fit in backup register");
+
+static Refresh_Policy policy = REFRESH_POLICY_DEFAULT;
+static uint8_t interval = REFRESH_POLICY_DEFAULT_INTERVAL;
+static uint32_t images_since_clear;
+static Boolean is_power_lost = TRUE;
+
+static void Save_Policy(void);
+
+void Refresh_Policy_Init(const Boolean is_boot_from_lpm) {
+    const uint32_t value = RTC_Read_Backup_Register(REFRESH_POLICY_BKUP_REG);
+
+    is_power_lost = (is_boot_from_lpm == TRUE) ? FALSE : TRUE;
+    if ((value >> REFRESH_POLICY_MARKER_SHIFT) != REFRESH_POLICY_MARKER) {
+        // Contents of the display are unknown
+        policy = REFRESH_POLICY_DEFAULT;
+        interval = REFRESH_POLICY_DEFAULT_INTERVAL;
+        images_since_clear = 0;
+        is_power_lost = TRUE;
+        Save_Policy();
+        return;
+    }
+
+    images_since_clear = RTC_Read_Backup_Register(IMAGES_SINCE_CLEAR_BKUP_REG);
+    policy = value & REFRESH_POLICY_POLICY_MASK;
+    interval = (value >> REFRESH_POLICY_INTERVAL_SHIFT)
+            & REFRESH_POLICY_INTERVAL_MASK;
+    if ((((value >> REFRESH_POLICY_DEFAULTS_SHIFT)
+            & REFRESH_POLICY_DEFAULTS_MASK) != REFRESH_POLICY_DEFAULTS)
+            || (policy >= REFRESH_POLICY_COUNT) || (interval == 0)) {
+        // Stored policy was chosen under other defaults
+        policy = REFRESH_POLICY_DEFAULT;
+        interval = REFRESH_POLICY_DEFAULT_INTERVAL;
+        Save_Policy();
+    }
+}
+
+void Refresh_Policy_Set(const Refresh_Policy new_policy,
+        const uint8_t new_interval) {
+    if ((new_policy >= REFRESH_POLICY_COUNT) || (new_interval == 0)) {
+        return;
+    }
+    policy = new_policy;
+    interval = new_interval;
+    Save_Policy();
+}
+
+Boolean Refresh_Policy_Should_Clear(void) {
+    if (policy == REFRESH_POLICY_CLEAR_EVERY_N_IMAGES) {
+        return (images_since_clear >= interval) ? TRUE : FALSE;
+    } else if (policy == REFRESH_POLICY_CLEAR_AFTER_POWER_LOSS) {
+        return is_power_lost;
+    } else if (policy == REFRESH_POLICY_CLEAR_ON_GHOSTING_SCHEDULE) {
+        // Each image stays on the display for a sleep period
+        if ((is_power_lost == TRUE) || ((images_since_clear
+                * SECONDS_TO_SPEND_IN_LOW_POWER_MODE)
+                >= ((uint32_t) interval * SECONDS_PER_HOUR))) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+void Refresh_Policy_Record_Image(const Boolean is_cleared) {
+    if (is_cleared == TRUE) {
+        images_since_clear = 0;
+    }
+    images_since_clear++;
+    RTC_Write_Backup_Register(IMAGES_SINCE_CLEAR_BKUP_REG, images_since_clear);
+}
+
+/**
+ * Store the refresh policy and the number of images shown since the last clear
+ * in RTC backup registers
+ */
+static void Save_Policy(void) {
+    RTC_Write_Backup_Register(REFRESH_POLICY_BKUP_REG,
+            ((uint32_t) REFRESH_POLICY_MARKER << REFRESH_POLICY_MARKER_SHIFT)
+                    | ((uint32_t) REFRESH_POLICY_DEFAULTS
+                            << REFRESH_POLICY_DEFAULTS_SHIFT)
+                    | ((uint32_t) interval << REFRESH_POLICY_INTERVAL_SHIFT)
+                    | policy);
+    RTC_Write_Backup_Register(IMAGES_SINCE_CLEAR_BKUP_REG, images_since_clear);
+}
@@ -4,6 +4,22 @@
 // Use RTC peripheral for wakeup timer
 static RTC_HandleTypeDef  hrtc;
 
+// Set from interrupt context when the wakeup timer elapses
+static volatile Boolean is_wakeup_timer_elapsed = FALSE;
+
+#define MS_PER_SECOND       (1000)
+#define SECONDS_PER_MINUTE  (60)
+#define SECONDS_PER_HOUR    (3600)
+
+// Channels whose transfers would be cut off by Stop mode. Drivers disable their
+// channels when a transfer completes, so an enabled channel is in flight
+#define DMA1_CHANNEL_COUNT  (7)
+static DMA_Channel_TypeDef *const dma1_channels[DMA1_CHANNEL_COUNT] = {
+        DMA1_Channel1, DMA1_Channel2, DMA1_Channel3, DMA1_Channel4,
+        DMA1_Channel5, DMA1_Channel6, DMA1_Channel7 };
+
+static Boolean Restore_System_Clock(void);
+
 RTC_Status RTC_Init(void) {
     RCC_PeriphCLKInitTypeDef rtc_clk_init = {0};
 
@@ -26,6 +42,10 @@ RTC_Status RTC_Init(void) {
     if (HAL_RTC_Init(&hrtc) != HAL_OK) {
         return RTC_INIT_ERR;
     }
+
+    // Wakeup timer interrupt also wakes up MCU from Stop mode
+    HAL_NVIC_SetPriority(RTC_WKUP_IRQn, 2, 0);
+    HAL_NVIC_EnableIRQ(RTC_WKUP_IRQn);
     return RTC_OK;
 }
 
@@ -37,6 +57,28 @@ void PWR_Enter_Low_Power_Mode(void) {
 }
 
 
+Boolean PWR_Enter_Stop_Mode(Boolean *const is_stop_entered) {
+    *is_stop_entered = FALSE;
+    for (uint8_t i = 0; i < DMA1_CHANNEL_COUNT; i++) {
+        if (dma1_channels[i]->CCR & DMA_CCR_EN) {
+            __WFI();
+            return TRUE;
+        }
+    }
+
+    HAL_SuspendTick();
+    HAL_PWREx_EnterSTOP2Mode(PWR_STOPENTRY_WFI);
+    *is_stop_entered = TRUE;
+    // MCU wakes up running from MSI, without PLL
+    if (Restore_System_Clock() != TRUE) {
+        HAL_ResumeTick();
+        return FALSE;
+    }
+    HAL_ResumeTick();
+    return TRUE;
+}
+
+
 void PWR_Handle_Boot_From_Low_Power_Mode(
         Boolean *restrict const is_boot_from_lpm) {
     // Assume that MCU is not booting up from Low-power mode
@@ -53,6 +95,7 @@ void PWR_Handle_Boot_From_Low_Power_Mode(
 }
 
 RTC_Status RTC_Set_WakeUp_Timer(const uint32_t seconds_to_sleep) {
+    is_wakeup_timer_elapsed = FALSE;
     // 1s to 18 hrs with 16 bits counter
     if (HAL_RTCEx_SetWakeUpTimer_IT(&hrtc, seconds_to_sleep,
             RTC_WAKEUPCLOCK_CK_SPRE_16BITS) != HAL_OK) {
@@ -61,6 +104,37 @@ RTC_Status RTC_Set_WakeUp_Timer(const uint32_t seconds_to_sleep) {
     return RTC_OK;
 }
 
+Boolean RTC_Has_WakeUp_Timer_Elapsed(void) {
+    return is_wakeup_timer_elapsed;
+}
+
+RTC_Status RTC_Stop_WakeUp_Timer(void) {
+    if (HAL_RTCEx_DeactivateWakeUpTimer(&hrtc) != HAL_OK) {
+        return RTC_WAKEUP_TIMER_SETUP_ERR;
+    }
+    return RTC_OK;
+}
+
+uint32_t RTC_Get_Time_Ms(void) {
+    RTC_TimeTypeDef time;
+    RTC_DateTypeDef date;
+
+    // Calendar shadow registers are not updated in Stop mode, so wait for them
+    // to be synchronized again before reading
+    __HAL_RTC_WRITEPROTECTION_DISABLE(&hrtc);
+    (void) HAL_RTC_WaitForSynchro(&hrtc);
+    __HAL_RTC_WRITEPROTECTION_ENABLE(&hrtc);
+
+    (void) HAL_RTC_GetTime(&hrtc, &time, RTC_FORMAT_BIN);
+    // Reading the date unlocks the shadow registers for the next read
+    (void) HAL_RTC_GetDate(&hrtc, &date, RTC_FORMAT_BIN);
+
+    return (((time.Hours * SECONDS_PER_HOUR) + (time.Minutes * SECONDS_PER_MINUTE)
+            + time.Seconds) * MS_PER_SECOND)
+            + (((time.SecondFraction - time.SubSeconds) * MS_PER_SECOND)
+                    / (time.SecondFraction + 1));
+}
+
 uint32_t RTC_Read_Backup_Register(const uint32_t backup_register) {
     return HAL_RTCEx_BKUPRead(&hrtc, backup_register);
 }
@@ -69,6 +143,50 @@ void RTC_Write_Backup_Register(const uint32_t backup_register, const uint32_t va
     HAL_RTCEx_BKUPWrite(&hrtc, backup_register, value);
 }
 
+/**
+ * Handle the RTC Wakeup timer interrupt
+ */
+void RTC_WakeUp_IRQ_Handler(void) {
+    HAL_RTCEx_WakeUpTimerIRQHandler(&hrtc);
+}
+
+/**
+ * Record that the RTC Wakeup timer has elapsed
+ *
+ * @param hrtc  (UNUSED)    Handle to RTC peripheral
+ */
+void HAL_RTCEx_WakeUpTimerEventCallback(RTC_HandleTypeDef *hrtc) {
+    is_wakeup_timer_elapsed = TRUE;
+}
+
+/**
+ * Switch system clock back to PLL after waking up from Stop mode. PLL keeps
+ * its configuration, so it only has to be enabled again
+ *
+ * @return  TRUE if system clock is running from PLL again. FALSE otherwise
+ */
+static Boolean Restore_System_Clock(void) {
+    RCC_OscInitTypeDef osc_init = { 0 };
+    RCC_ClkInitTypeDef clk_init = { 0 };
+    uint32_t flash_latency;
+
+    HAL_RCC_GetOscConfig(&osc_init);
+    HAL_RCC_GetClockConfig(&clk_init, &flash_latency);
+
+    osc_init.OscillatorType = RCC_OSCILLATORTYPE_NONE;
+    osc_init.PLL.PLLState = RCC_PLL_ON;
+    if (HAL_RCC_OscConfig(&osc_init) != HAL_OK) {
+        return FALSE;
+    }
+
+    clk_init.ClockType = RCC_CLOCKTYPE_SYSCLK;
+    clk_init.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
+    if (HAL_RCC_ClockConfig(&clk_init, flash_latency) != HAL_OK) {
+        return FALSE;
+    }
+    return TRUE;
+}
+
 /**
  * Low-level RTC peripheral initialization
  */
@@ -1,6 +1,11 @@
 #include <assert.h>
+#include <stdio.h>
 #include "stm32l4xx_hal.h"
 #include "sdcard.h"
+#include "profiling.h"
+#include "main.h"
+#include "rtc_and_pwr.h"
+#include "logging.h"
 
 /*
  * Use SPI2 for communication with SD Card: NSS(PA9), SCK(PB13), MISO(PB14), MOSI(PB15)
@@ -8,13 +13,84 @@
  */
 static SPI_HandleTypeDef hspi2;
 
+/*
+ * Use DMA1 Channel4 for SPI2_RX and DMA1 Channel5 for SPI2_TX - Table 41 in
+ * reference manual. TX channel keeps sending the same 0xFF byte to keep MOSI
+ * high while receiving data
+ */
+static DMA_HandleTypeDef hdma_spi2_rx;
+static DMA_HandleTypeDef hdma_spi2_tx;
+static const uint8_t dma_dummy_tx_byte = 0xFF;
+
 /**
- * Speed to use for SPI when reading data from SD card
+ * State of the DMA transfer on SPI2. Updated from interrupt context
  */
 typedef enum {
-    SDC_SPI_SPEED_LOW,      // Low speed SPI clk for SD card initialization
-    SDC_SPI_SPEED_HIGH,     // High speed SPI clk for reading data
-} SDC_SPI_Speed;
+    SDC_DMA_IDLE,
+    SDC_DMA_BUSY,
+    SDC_DMA_ERROR,
+} SDC_DMA_State;
+
+static volatile SDC_DMA_State spi2_dma_state = SDC_DMA_IDLE;
+
+/*
+ * Exchange single bytes (command, response and token polling) through the
+ * SPI2 data register instead of a full HAL transfer for every byte. Set to 0
+ * to use HAL for comparing cycle counts between both implementations
+ */
+#define SDC_SPI_FAST_BYTE_EXCHANGE  (1)
+
+/*
+ * Check CRC16 of every data block using CRC peripheral. A block failing the
+ * check is read again, at most SDC_READ_MAX_RETRIES times per read request
+ */
+#define SDC_VERIFY_DATA_CRC         (1)
+#define SDC_READ_MAX_RETRIES        (3)
+
+/*
+ * Collect per-command counts, latency histograms and byte counters for SD card
+ * transactions. Set to 0 to leave only the basic statistics
+ */
+#define SDC_COLLECT_TELEMETRY       (1)
+
+/*
+ * Number of reads that can be queued with SDC_Submit_Read, including the one
+ * in progress
+ */
+#define SDC_READ_QUEUE_DEPTH        (4)
+
+/*
+ * CRC peripheral is used to compute CRC16 of data blocks
+ */
+static CRC_HandleTypeDef hcrc;
+
+/*
+ * Max SPI clock frequencies allowed during card identification, in default
+ * speed mode and in high speed mode
+ */
+#define SDC_IDENTIFICATION_MAX_HZ   (400000)
+#define SDC_DEFAULT_SPEED_MAX_HZ    (25000000)
+#define SDC_HIGH_SPEED_MAX_HZ       (50000000)
+
+/*
+ * Number of sectors to read, with CRC verification, to prove that a SPI clock
+ * rate works with the card
+ */
+#define SDC_CALIBRATION_PROBE_SECTORS   (4)
+
+/*
+ * Layout of the value stored in backup register after calibrating the SPI
+ * clock rate for a card:
+ *  [31:24] Magic value marking the register as valid
+ *  [23:8]  CRC16 of CSD register, to detect that a different card is used
+ *  [4]     Card was switched to high speed mode
+ *  [2:0]   SPI baud rate prescaler bits (BR[2:0])
+ */
+#define SDC_CALIBRATION_MAGIC           (0xA5)
+#define SDC_CALIBRATION_MAGIC_POS       (24)
+#define SDC_CALIBRATION_CSD_CRC_POS     (8)
+#define SDC_CALIBRATION_HIGH_SPEED      (1 << 4)
+#define SDC_CALIBRATION_BR_MSK          (0x7)
 
 /**
  *    Type of SD card
@@ -55,10 +131,112 @@ typedef enum {
 #define CMD17               (17)
 #define CMD17_CRC           (0)
 
+#define CMD18               (18)
+#define CMD18_CRC           (0)
+
+#define CMD12               (12)
+#define CMD12_ARGS          (0x00000000)
+#define CMD12_CRC           (0)
+
+#define CMD9                (9)
+#define CMD9_ARGS           (0x00000000)
+#define CMD9_CRC            (0)
+
+#define CMD6                (6)
+#define CMD6_ARGS_CHECK_HS  (0x00FFFFF1)    // Check function 1 in group 1
+#define CMD6_ARGS_SWITCH_HS (0x80FFFFF1)    // Switch to function 1 in group 1
+#define CMD6_CRC            (0)
+
+#define CMD13               (13)
+#define CMD13_ARGS          (0x00000000)
+#define CMD13_CRC           (0)
+
+// Sizes of data blocks returned for CMD9 and CMD6
+#define CSD_SIZE            (16)
+#define SWITCH_STATUS_SIZE  (64)
+
+// Data token sent by card before every data block
+#define DATA_TOKEN          (0xFE)
+
+// Max time in ms to wait for data token or for card to release busy signal
+#define DATA_TOKEN_TIMEOUT_MS   (200)
+#define STOP_BUSY_TIMEOUT_MS    (250)
+// Max time in ms for SPI to exchange a single byte. A byte takes well under
+// 100 us even at the initialization clock, so hitting this means SPI is stuck
+#define BYTE_EXCHANGE_TIMEOUT_MS    (2)
+
+// Time for supply to settle after powering the card, before clocking it
+#define POWER_UP_SETTLE_MS      (1)
+// Max time in ms for card to leave idle state while polling with ACMD41
+#define ACMD41_TIMEOUT_MS       (1000)
+// Max time in ms for card to finish internal operations before power off
+#define POWER_OFF_READY_TIMEOUT_MS  (500)
+
 // Store the SD card type to use when reading data from it
 static SDC_Type SD_card_type;
 
-static SDC_Status SPI2_Init(const SDC_SPI_Speed speed);
+// Mode to use for receiving the payload of data blocks and its running cost
+static SDC_Transfer_Mode transfer_mode = SDC_TRANSFER_MODE_DMA;
+
+// Verify CRC of received data blocks. Always done while probing clock rates
+static uint8_t verify_data_crc = SDC_VERIFY_DATA_CRC;
+static SDC_CRC_Stats crc_stats;
+static SDC_Latency_Stats latency_stats;
+
+// Telemetry for SD card transactions, and the command waiting for its response
+static SDC_Telemetry telemetry = {
+        .commands = {
+                { .cmd = CMD0 }, { .cmd = CMD6 }, { .cmd = CMD8 },
+                { .cmd = CMD9 }, { .cmd = CMD12 }, { .cmd = CMD13 },
+                { .cmd = CMD17 }, { .cmd = CMD18 }, { .cmd = CMD41 },
+                { .cmd = CMD55 }, { .cmd = CMD58 },
+        },
+};
+static SDC_Command_Stats *pending_command;
+static uint32_t pending_command_start_cycles;
+
+/**
+ * Read queued with SDC_Submit_Read. Only one of the callbacks is set, depending
+ * on whether the read came through the SD card or the block device API
+ */
+typedef struct {
+    uint32_t start_addr;
+    uint32_t count;
+    uint8_t *buffer;
+    SDC_Read_Callback cb;
+    Block_Device_Read_Callback block_device_cb;
+    void *ctx;
+    SDC_Status status;      // Set when the read finishes
+} SDC_Read_Request;
+
+// Circular queue of asynchronous reads. The first done reads from the head
+// have finished and wait for their callbacks, and the one after them is in
+// progress
+static SDC_Read_Request read_queue[SDC_READ_QUEUE_DEPTH];
+static volatile uint8_t read_queue_head;
+static volatile uint8_t read_queue_count;
+static volatile uint8_t read_queue_done;
+
+// Progress of the read in progress. Updated from PendSV, which runs at the
+// lowest interrupt priority so that waiting for the card never delays other
+// interrupts
+static uint32_t async_blocks_read;
+static uint8_t async_retries;
+static uint8_t async_multiple_blocks;
+static uint32_t async_payload_start_us;
+static volatile uint8_t async_dma_in_flight;
+
+// Card capacity in sectors, decoded from CSD register during initialization
+static uint32_t block_count;
+
+// Buffer for sectors read while probing SPI clock rates
+static uint8_t probe_buffer[SECTOR_SIZE];
+static SDC_Transfer_Stats transfer_stats[SDC_TRANSFER_MODE_COUNT];
+static SDC_Byte_Exchange_Stats byte_exchange_stats;
+
+static SDC_Status SPI2_Init(void);
+static uint32_t SPI2_Prescaler_For_Frequency(const uint32_t max_hz);
+static void SPI2_Set_Prescaler(const uint32_t prescaler);
 void SDC_SPI_Msp_Init(void);
 static SDC_Status SDC_Init_Internal(SDC_Type *restrict const card_type);
 static SDC_Status Send_CMD(const uint8_t cmd, const uint32_t args,
@@ -69,128 +247,261 @@ static SDC_Status Receive_Response_3_Or_7(uint8_t *restrict const reponse);
 static SDC_Status Do_CMD8_Init(SDC_Type *restrict const card_type);
 static SDC_Status Do_ACMD41_Init(const SDC_Type card_type);
 static SDC_Status Do_CMD58_Init(SDC_Type *restrict const card_type);
-static HAL_StatusTypeDef SDC_SPI_Deselect(void);
-static HAL_StatusTypeDef SDC_SPI_Select(void);
+static SDC_Status Read_Single_Block(uint32_t start_addr,
+        uint8_t *restrict const buffer);
+static SDC_Status Read_Multiple_Blocks(uint32_t start_addr,
+        const uint32_t count, uint8_t *restrict const buffer,
+        uint32_t *restrict const blocks_read);
+static SDC_Status Receive_Data_Block(uint8_t *restrict const buffer);
+static SDC_Status Wait_For_Data_Token(void);
+static SDC_Status Read_Register_Block(const uint8_t cmd, const uint32_t args,
+        uint8_t *restrict const buffer, const uint8_t size);
+static SDC_Status Configure_Bus_Speed(const SDC_Type card_type);
+static SDC_Status Switch_To_High_Speed(void);
+static uint32_t Decode_Tran_Speed(const uint8_t tran_speed);
+static uint32_t Decode_Block_Count(const uint8_t *restrict const csd);
+static Block_Device_Status Block_Device_Read(void *ctx, const uint32_t lba,
+        const uint32_t count, uint8_t *restrict const buffer);
+static void Block_Device_Wait(void *ctx, volatile const uint8_t *done);
+static uint32_t Block_Device_Block_Count(void *ctx);
+static SDC_Status Probe_Bus_Speed(void);
+static SDC_Status CRC_Init(void);
+static uint16_t CRC16_Compute(const uint8_t *restrict const data,
+        const uint32_t size);
+static SDC_Status Stop_Transmission(void);
+static SDC_Status Queue_Read(const uint32_t start_addr, const uint32_t count,
+        uint8_t *restrict const buffer, SDC_Read_Callback cb,
+        Block_Device_Read_Callback block_device_cb, void *ctx);
+static inline SDC_Read_Request* Async_Current_Request(void);
+static void Async_Start_Request(void);
+static void Async_Start_Next_Block(void);
+static void Async_Block_Received(void);
+static void Async_Finish_Request(SDC_Status status);
+static void Async_Complete_Requests(void);
+static Block_Device_Status Block_Device_Read_Async(void *ctx,
+        const uint32_t lba, const uint32_t count,
+        uint8_t *restrict const buffer, Block_Device_Read_Callback cb,
+        void *cb_ctx);
+static inline uint32_t Ms_To_Cycles(const uint32_t ms);
+static inline void Telemetry_Record_Command(const uint8_t cmd);
+static inline void Telemetry_Record_Response1(const SDC_Status status,
+        const uint8_t response);
+static inline void Telemetry_Record_Latency(uint32_t *restrict const histogram,
+        const uint32_t cycles);
+static void Log_Histogram(const char *restrict const name,
+        const uint32_t *restrict const histogram);
+static SDC_Status Wait_While_Busy(const uint32_t timeout_ms);
+static SDC_Status Prepare_For_Power_Off(void);
+static SDC_Status Receive_Payload_Blocking(uint8_t *restrict const buffer);
+static SDC_Status Receive_Payload_DMA(uint8_t *restrict const buffer);
+static uint8_t SPI2_Exchange_Byte(const uint8_t tx_byte);
+static void SDC_SPI_Deselect(void);
+static void SDC_SPI_Select(void);
 static void SDC_Power_Pin_Init(void);
 static void SDC_Power_Enable(void);
 static void SDC_Power_Disable(void);
 
 SDC_Status SDC_Init(void) {
+    const uint32_t start_us = Profiling_Get_Time_Us();
+
     // Assume the card type is unknown until it is initialized
     SD_card_type = CARD_UNKNOWN;
 
     // Initialize pin to power up SD card
     SDC_Power_Pin_Init();
 
-    // Enable power to SD card
+    // Enable power to SD card. Card needs at least 1 ms after supply is stable
+    // before it is clocked
     SDC_Power_Enable();
-
-    HAL_Delay(10);
+    HAL_Delay(POWER_UP_SETTLE_MS);
 
     SDC_Status ret;
-    ret = SPI2_Init(SDC_SPI_SPEED_LOW);    // Use low speed for initial setup
+    ret = SPI2_Init();    // Use low speed for initial setup
+    if (ret != SDC_OK) {
+        return ret;
+    }
+
+    ret = CRC_Init();
     if (ret != SDC_OK) {
         return ret;
     }
 
     ret = SDC_Init_Internal(&SD_card_type);
+    latency_stats.init_time_us = Profiling_Get_Time_Us() - start_us;
     return ret;
 }
 
 SDC_Status SDC_Read_Sector(uint32_t start_addr, uint8_t *restrict const buffer) {
-    uint8_t ret;
-    uint8_t response;
-    uint32_t start_tick;
-    uint8_t crc[2] = { 0xFF, 0xFF };
+    return SDC_Read_Sectors(start_addr, 1, buffer);
+}
+
+SDC_Status SDC_Read_Sectors(uint32_t start_addr, const uint32_t count,
+        uint8_t *restrict const buffer) {
+    uint8_t ret = SDC_OK;
+    uint32_t blocks_read = 0;
+    uint32_t blocks_done;
+    uint8_t retries = 0;
 
     // SD card initialization should have set the card type if successful
     if (SD_card_type == CARD_UNKNOWN) {
         return SDC_READ_CARD_UNSUPPORTED;
     }
-
-    // SDSC V1 takes address in terms of byte offsets
-    if (SD_card_type == SDSC_V1) {
-        start_addr *= SECTOR_SIZE;
-    }
-
-    if (SDC_SPI_Select() != HAL_OK) {
-        return SDC_READ_START_ERR;
+    // Bus is owned by the queued reads until they finish
+    Async_Complete_Requests();
+    if (read_queue_count != 0) {
+        return SDC_READ_BUSY;
     }
 
-    ret = Send_CMD(CMD17, start_addr, CMD17_CRC);
-    if (ret != SDC_OK) {
-        if (SDC_SPI_Deselect() != HAL_OK) {
-            return SDC_READ_END_ERR;
+    // Blocks received before a CRC failure are kept and reading resumes from
+    // the failed block, for a bounded number of times
+    while (blocks_read < count) {
+        blocks_done = 0;
+        // A single sector does not benefit from the multiple block read command,
+        // and CMD17 does not need the extra CMD12 to end the transfer
+        if ((count - blocks_read) == 1) {
+            ret = Read_Single_Block(start_addr + blocks_read,
+                    buffer + (blocks_read * SECTOR_SIZE));
+            if (ret == SDC_OK) {
+                blocks_done = 1;
+            }
+        } else {
+            ret = Read_Multiple_Blocks(start_addr + blocks_read,
+                    count - blocks_read, buffer + (blocks_read * SECTOR_SIZE),
+                    &blocks_done);
         }
-        return SDC_READ_SEND_CMD_ERR;
-    }
-    ret = Receive_Response1(&response);
-    if (ret != SDC_OK) {
-        if (SDC_SPI_Deselect() != HAL_OK) {
-            return SDC_READ_END_ERR;
+        blocks_read += blocks_done;
+
+        if ((ret == SDC_READ_DATA_CRC_MISMATCH)
+                && (retries < SDC_READ_MAX_RETRIES)) {
+            retries++;
+            crc_stats.retries++;
+        } else if (ret != SDC_OK) {
+            return ret;
         }
-        return SDC_READ_RESPONSE1_ERR;
     }
 
-    start_tick = HAL_GetTick();
-    do {    // Wait at most 200 ms for valid data/err token to appear
-        response = 0xFF;
-        if (HAL_SPI_Receive(&hspi2, &response, 1, HAL_MAX_DELAY) != HAL_OK) {
-            if (SDC_SPI_Deselect() != HAL_OK) {
-                return SDC_READ_END_ERR;
-            }
-            return SDC_READ_DATA_TOKEN_RCV_ERR;
-        }
-    } while (((HAL_GetTick() - start_tick) < 200) && (response == 0xFF));
+    return SDC_OK;
+}
 
-    if (response == 0xFE) {
-        // Valid data token
-        for (uint16_t i = 0; i < SECTOR_SIZE; i++) {
-            buffer[i] = 0xFF;
-        }
-        if (HAL_SPI_Receive(&hspi2, buffer, SECTOR_SIZE, HAL_MAX_DELAY)
-                != HAL_OK) {
-            if (SDC_SPI_Deselect() != HAL_OK) {
-                return SDC_READ_END_ERR;
-            }
-            return SDC_READ_DATA_RCV_ERR;
-        }
+SDC_Status SDC_Submit_Read(const uint32_t start_addr, const uint32_t count,
+        uint8_t *restrict const buffer, SDC_Read_Callback cb, void *ctx) {
+    return Queue_Read(start_addr, count, buffer, cb, NULL, ctx);
+}
 
-        // Receive CRC tokens. We do not check for CRC errors
-        if (HAL_SPI_Receive(&hspi2, crc, 2, HAL_MAX_DELAY) != HAL_OK) {
-            if (SDC_SPI_Deselect() != HAL_OK) {
-                return SDC_READ_END_ERR;
-            }
-            return SDC_READ_DATA_CRC_RCV_ERR;
-        }
-    } else if (response == 0xFF) {
-        if (SDC_SPI_Deselect() != HAL_OK) {
-            return SDC_READ_END_ERR;
-        }
-        return SDC_READ_DATA_TOKEN_WAIT_TIMEOUT;
-    } else {
-        if (SDC_SPI_Deselect() != HAL_OK) {
-            return SDC_READ_END_ERR;
+void SDC_Wait_For_Idle(void) {
+    // Same pattern as waiting for a DMA transfer, so that the interrupt
+    // finishing the last read cannot slip in between the check and WFI.
+    // Callbacks of finished reads are run in between
+    Async_Complete_Requests();
+    __disable_irq();
+    while (read_queue_count != 0) {
+        if (read_queue_done == 0) {
+            __WFI();
         }
-        return SDC_READ_ERROR_TOKEN_RECEIVED;
+        __enable_irq();
+        Async_Complete_Requests();
+        __disable_irq();
+    }
+    __enable_irq();
+}
+
+void SDC_Set_Transfer_Mode(const SDC_Transfer_Mode mode) {
+    if (mode < SDC_TRANSFER_MODE_COUNT) {
+        transfer_mode = mode;
     }
+}
 
-    if (SDC_SPI_Deselect() != HAL_OK) {
-        return SDC_READ_END_ERR;
+void SDC_Get_Transfer_Stats(const SDC_Transfer_Mode mode,
+        SDC_Transfer_Stats *restrict const stats) {
+    if (mode < SDC_TRANSFER_MODE_COUNT) {
+        *stats = transfer_stats[mode];
     }
+}
 
-    return SDC_OK;
+void SDC_Get_Byte_Exchange_Stats(
+        SDC_Byte_Exchange_Stats *restrict const stats) {
+    *stats = byte_exchange_stats;
+}
+
+uint32_t SDC_Get_Bus_Frequency(void) {
+    return HAL_RCC_GetPCLK1Freq()
+            >> (((hspi2.Instance->CR1 & SPI_CR1_BR_Msk) >> SPI_CR1_BR_Pos) + 1);
+}
+
+void SDC_Get_CRC_Stats(SDC_CRC_Stats *restrict const stats) {
+    *stats = crc_stats;
+}
+
+void SDC_Get_Latency_Stats(SDC_Latency_Stats *restrict const stats) {
+    *stats = latency_stats;
+}
+
+void SDC_Get_Telemetry(SDC_Telemetry *restrict const telemetry_out) {
+    *telemetry_out = telemetry;
+}
+
+void SDC_Dump_Stats(void) {
+    char name[16];
+
+    Log_Msg("SD bus %lu Hz, init %lu us, %lu ACMD41 polls",
+            SDC_Get_Bus_Frequency(), latency_stats.init_time_us,
+            latency_stats.acmd41_polls);
+    for (uint8_t i = 0; i < SDC_TELEMETRY_COMMANDS; i++) {
+        const SDC_Command_Stats *const stats = &telemetry.commands[i];
+        if (stats->count == 0) {
+            continue;
+        }
+        Log_Msg("SD CMD%u: %lu sent, %lu errors", stats->cmd, stats->count,
+                stats->errors);
+        snprintf(name, sizeof(name), "CMD%u R1", stats->cmd);
+        Log_Histogram(name, stats->latency_histogram);
+    }
+    Log_Histogram("data token", telemetry.token_wait_histogram);
+    Log_Msg("SD tokens: %lu timeouts, %lu error tokens; %lu busy bytes",
+            telemetry.token_timeouts, telemetry.error_tokens,
+            telemetry.busy_bytes);
+    Log_Msg("SD bytes: %lu payload, %lu register, %lu single byte exchanges"
+            " (%lu timed out)", telemetry.payload_bytes,
+            telemetry.register_bytes, byte_exchange_stats.bytes,
+            byte_exchange_stats.timeouts);
+    Log_Msg("SD CRC: %lu blocks checked, %lu failures, %lu reads retried",
+            crc_stats.blocks_checked, crc_stats.crc_failures,
+            crc_stats.retries);
+}
+
+const Block_Device* SDC_Get_Block_Device(void) {
+    static const Block_Device sd_block_device = {
+            .read_blocks = &Block_Device_Read,
+            .read_blocks_async = &Block_Device_Read_Async,
+            .wait_for_completion = &Block_Device_Wait,
+            .get_block_count = &Block_Device_Block_Count,
+            .hint_sequential_read = NULL,
+            .ctx = NULL,
+    };
+    return &sd_block_device;
 }
 
 SDC_Status SDC_Power_Off(void) {
+    const uint32_t start_us = Profiling_Get_Time_Us();
+    uint8_t ret;
+
+    // Let queued reads finish before the bus is taken away
+    SDC_Wait_For_Idle();
+
+    // Card is powered off even if it does not report ready in time, but the
+    // failure is still reported to the caller
+    ret = Prepare_For_Power_Off();
+
+    // SPI2 low-level de-initialization also removes power from SD card
     if (HAL_SPI_DeInit(&hspi2) != HAL_OK) {
         return SDC_POWEROFF_IO_DEINIT_ERR;
     }
-    HAL_Delay(1000);
-    HAL_Delay(6);
-    SDC_Power_Disable();
-    HAL_Delay(6);
-    return SDC_OK;
+    if (HAL_CRC_DeInit(&hcrc) != HAL_OK) {
+        return SDC_POWEROFF_IO_DEINIT_ERR;
+    }
+
+    latency_stats.power_off_time_us = Profiling_Get_Time_Us() - start_us;
+    return ret;
 }
 
 /**
@@ -228,13 +539,12 @@ static void SDC_Power_Disable(void) {
 }
 
 /**
- * Initialize the IO channels to SD card using SPI2 peripheral from MCU
- *
- * @param speed (IN)    Speed to use while communicating with SD card
+ * Initialize the IO channels to SD card using SPI2 peripheral from MCU. SPI
+ * clock is kept low enough for card identification
  *
  * @return  Status of SPI2 peripheral initialization operation
  */
-static SDC_Status SPI2_Init(const SDC_SPI_Speed speed) {
+static SDC_Status SPI2_Init(void) {
     hspi2.Instance = SPI2;
     hspi2.Init.Mode = SPI_MODE_MASTER;
     hspi2.Init.Direction = SPI_DIRECTION_2LINES;
@@ -242,16 +552,10 @@ static SDC_Status SPI2_Init(const SDC_SPI_Speed speed) {
     hspi2.Init.CLKPolarity = SPI_POLARITY_LOW;
     hspi2.Init.CLKPhase = SPI_PHASE_1EDGE;
     hspi2.Init.NSS = SPI_NSS_SOFT;
-    // SPI gets fPCLK/4 = 20 MHz
-    if (speed == SDC_SPI_SPEED_LOW) {
-        // Use prescaler 128 to use 156.25KHz for
-        // initial communication with SD card
-        hspi2.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_128;
-    } else if (speed == SDC_SPI_SPEED_HIGH) {
-        // Use prescaler 2 to use 10MHz for later
-        // communication with SD card (data rx)
-        hspi2.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_2;
-    }
+    // SPI2 is clocked from PCLK1. Card identification has to be done at
+    // 400KHz or lower
+    hspi2.Init.BaudRatePrescaler = SPI2_Prescaler_For_Frequency(
+    SDC_IDENTIFICATION_MAX_HZ);
     hspi2.Init.FirstBit = SPI_FIRSTBIT_MSB;
     hspi2.Init.TIMode = SPI_TIMODE_DISABLE;
     hspi2.Init.CRCCalculation = SPI_CRCCALCULATION_DISABLE;
@@ -260,15 +564,46 @@ static SDC_Status SPI2_Init(const SDC_SPI_Speed speed) {
     if (HAL_SPI_Init(&hspi2) != HAL_OK) {
         return SDC_INIT_IO_INIT_ERR;
     }
+    // HAL only enables SPI on the first transfer. Single byte exchanges write
+    // the data register directly, so enable it here
+    __HAL_SPI_ENABLE(&hspi2);
 
     // Deselect the SD card chip to avoid spurious communication
-    if (SDC_SPI_Deselect() != HAL_OK) {
-        return SDC_INIT_CHIP_DESELECT_ERR;
-    }
+    SDC_SPI_Deselect();
 
     return SDC_OK;
 }
 
+/**
+ * Find the smallest SPI2 baud rate prescaler that keeps SPI clock at or below
+ * the given frequency
+ *
+ * @param max_hz    (IN)    Max SPI clock frequency allowed
+ *
+ * @return  Baud rate prescaler value (SPI_BAUDRATEPRESCALER_x) to use. The
+ *          largest prescaler is returned if none satisfies the limit
+ */
+static uint32_t SPI2_Prescaler_For_Frequency(const uint32_t max_hz) {
+    const uint32_t pclk = HAL_RCC_GetPCLK1Freq();
+    uint32_t br = 0;
+
+    // BR[2:0] = n divides PCLK by 2^(n+1)
+    while ((br < SDC_CALIBRATION_BR_MSK) && ((pclk >> (br + 1)) > max_hz)) {
+        br++;
+    }
+    return br << SPI_CR1_BR_Pos;
+}
+
+/**
+ * Change SPI2 clock rate. Should only be called when no transfer is ongoing
+ *
+ * @param prescaler (IN)    Baud rate prescaler value (SPI_BAUDRATEPRESCALER_x)
+ */
+static void SPI2_Set_Prescaler(const uint32_t prescaler) {
+    hspi2.Init.BaudRatePrescaler = prescaler;
+    hspi2.Instance->CR1 = (hspi2.Instance->CR1 & ~SPI_CR1_BR_Msk) | prescaler;
+}
+
 /**
  * Perform low level initialization for SPI2 peripheral
  */
@@ -293,12 +628,58 @@ void SDC_SPI_Msp_Init(void) {
     gpio_spi.Alternate = GPIO_AF5_SPI2;
     gpio_spi.Speed = GPIO_SPEED_FREQ_HIGH;
     HAL_GPIO_Init(GPIOB, &gpio_spi);
+
+    // Initialize DMA channels used to receive sector payloads
+    __HAL_RCC_DMA1_CLK_ENABLE();
+
+    hdma_spi2_rx.Instance = DMA1_Channel4;
+    hdma_spi2_rx.Init.Request = DMA_REQUEST_1;
+    hdma_spi2_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_spi2_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_spi2_rx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_spi2_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_spi2_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_spi2_rx.Init.Mode = DMA_NORMAL;
+    hdma_spi2_rx.Init.Priority = DMA_PRIORITY_HIGH;
+    // Return value should be HAL_OK since the handle is fully configured
+    assert(HAL_DMA_Init(&hdma_spi2_rx) == HAL_OK);
+    __HAL_LINKDMA(&hspi2, hdmarx, hdma_spi2_rx);
+
+    // Memory address is not incremented so that the same dummy byte is sent
+    hdma_spi2_tx.Instance = DMA1_Channel5;
+    hdma_spi2_tx.Init.Request = DMA_REQUEST_1;
+    hdma_spi2_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    hdma_spi2_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_spi2_tx.Init.MemInc = DMA_MINC_DISABLE;
+    hdma_spi2_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_spi2_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_spi2_tx.Init.Mode = DMA_NORMAL;
+    hdma_spi2_tx.Init.Priority = DMA_PRIORITY_MEDIUM;
+    assert(HAL_DMA_Init(&hdma_spi2_tx) == HAL_OK);
+    __HAL_LINKDMA(&hspi2, hdmatx, hdma_spi2_tx);
+
+    HAL_NVIC_SetPriority(DMA1_Channel4_IRQn, 1, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Channel4_IRQn);
+    HAL_NVIC_SetPriority(DMA1_Channel5_IRQn, 1, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Channel5_IRQn);
+    HAL_NVIC_SetPriority(SPI2_IRQn, 1, 0);
+    HAL_NVIC_EnableIRQ(SPI2_IRQn);
+    // Queued reads are continued from PendSV, below every peripheral interrupt
+    HAL_NVIC_SetPriority(PendSV_IRQn, 15, 0);
 }
 
 /**
  * Low-level de-initialization of SPI2 peripheral used for IO channels
  */
 void SDC_SPI_Msp_De_Init(void) {
+    HAL_NVIC_DisableIRQ(SPI2_IRQn);
+    HAL_NVIC_DisableIRQ(DMA1_Channel4_IRQn);
+    HAL_NVIC_DisableIRQ(DMA1_Channel5_IRQn);
+    HAL_DMA_DeInit(&hdma_spi2_rx);
+    HAL_DMA_DeInit(&hdma_spi2_tx);
+    // DMA1 clock is shared with E-paper display and is disabled before entering
+    // low power mode
+
     __HAL_RCC_SPI2_CLK_DISABLE();
     // Configure all IO channels as pull-up and power down the SD card. Logic is
     // based on data present in https://thecavepearlproject.org/2017/05/21/switching-off-sd-cards-for-low-power-data-logging/
@@ -311,6 +692,72 @@ void SDC_SPI_Msp_De_Init(void) {
     HAL_GPIO_DeInit(GPIOA, GPIO_PIN_9);
 }
 
+/**
+ * Handle interrupts from DMA channel receiving data for SPI2
+ */
+void SDC_SPI_DMA_Rx_IRQ_Handler(void) {
+    HAL_DMA_IRQHandler(&hdma_spi2_rx);
+}
+
+/**
+ * Handle interrupts from DMA channel transmitting data for SPI2
+ */
+void SDC_SPI_DMA_Tx_IRQ_Handler(void) {
+    HAL_DMA_IRQHandler(&hdma_spi2_tx);
+}
+
+/**
+ * Handle interrupts from SPI2 peripheral
+ */
+void SDC_SPI_IRQ_Handler(void) {
+    HAL_SPI_IRQHandler(&hspi2);
+}
+
+/**
+ * Mark the DMA transfer on SPI2 as complete. HAL leaves the channels enabled
+ * after a transfer, so disable them to let MCU enter Stop mode. A block of a
+ * queued read is handled in PendSV
+ */
+void SDC_SPI_Transfer_Complete_Callback(void) {
+    __HAL_DMA_DISABLE(&hdma_spi2_rx);
+    __HAL_DMA_DISABLE(&hdma_spi2_tx);
+    spi2_dma_state = SDC_DMA_IDLE;
+    if (async_dma_in_flight) {
+        SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+    }
+}
+
+/**
+ * Mark the DMA transfer on SPI2 as failed. A block of a queued read is handled
+ * in PendSV
+ */
+void SDC_SPI_Transfer_Error_Callback(void) {
+    __HAL_DMA_DISABLE(&hdma_spi2_rx);
+    __HAL_DMA_DISABLE(&hdma_spi2_tx);
+    spi2_dma_state = SDC_DMA_ERROR;
+    if (async_dma_in_flight) {
+        SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+    }
+}
+
+/**
+ * Continue the queued read whose data block was just received by DMA. Checking
+ * the block, waiting for the next data token and stopping the transfer poll
+ * the card, so they are done at the lowest interrupt priority
+ */
+void SDC_Async_IRQ_Handler(void) {
+    if (!async_dma_in_flight || (spi2_dma_state == SDC_DMA_BUSY)) {
+        return;
+    }
+    async_dma_in_flight = 0;
+    if (spi2_dma_state == SDC_DMA_ERROR) {
+        spi2_dma_state = SDC_DMA_IDLE;
+        Async_Finish_Request(SDC_READ_DMA_TRANSFER_ERR);
+        return;
+    }
+    Async_Block_Received();
+}
+
 /**
  * Initialize the SD card by sending commands over IO channels
  *
@@ -320,16 +767,11 @@ void SDC_SPI_Msp_De_Init(void) {
  * @return  Status of SD card initialization operation
  */
 static SDC_Status SDC_Init_Internal(SDC_Type *restrict const card_type) {
-    uint8_t dummy_data = 0xFF;
     uint8_t ret;
 
-    HAL_Delay(2);        // Wait for at least 1 ms
-
     // Send at least 74 clock ticks keeping CS high - 10 bytes = 80 clock cycles
     for (uint8_t i = 0; i < 10; i++) {
-        if (HAL_SPI_Transmit(&hspi2, &dummy_data, 1, HAL_MAX_DELAY) != HAL_OK) {
-            return SDC_INIT_POWER_ON_WAIT_ERR;
-        }
+        SPI2_Exchange_Byte(0xFF);
     }
 
     ret = Do_CMD0_Init();
@@ -354,7 +796,7 @@ static SDC_Status SDC_Init_Internal(SDC_Type *restrict const card_type) {
         }
     }
 
-    return SDC_OK;
+    return Configure_Bus_Speed(*card_type);
 }
 
 /**
@@ -368,7 +810,7 @@ static SDC_Status SDC_Init_Internal(SDC_Type *restrict const card_type) {
  */
 static SDC_Status Send_CMD(const uint8_t cmd, const uint32_t args,
         const uint8_t crc) {
-    static uint8_t tx_data[6];
+    uint8_t tx_data[6];
 
     // Use last 6 bytes for cmd and set transmission bit
     tx_data[0] = (cmd & 0x3F) | (1 << 6);
@@ -380,9 +822,9 @@ static SDC_Status Send_CMD(const uint8_t cmd, const uint32_t args,
 
     tx_data[5] = crc | 1;    // Set the end bit to 1
 
-    if (HAL_SPI_Transmit(&hspi2, tx_data, sizeof(tx_data),
-    HAL_MAX_DELAY) != HAL_OK) {
-        return SDC_INIT_CMD_SEND_ERR;
+    Telemetry_Record_Command(cmd);
+    for (uint8_t i = 0; i < sizeof(tx_data); i++) {
+        SPI2_Exchange_Byte(tx_data[i]);
     }
 
     return SDC_OK;
@@ -398,13 +840,12 @@ static SDC_Status Send_CMD(const uint8_t cmd, const uint32_t args,
 static SDC_Status Receive_Response1(uint8_t *restrict const response) {
     // Number of times to check: 0 to 8 bytes for SDC, 1 to 8 bytes for MMC
     uint8_t tries = 12;
-    *response = 0xFF;    // Keep MOSI high while receiving data
 
     do {
-        if (HAL_SPI_Receive(&hspi2, response, 1, HAL_MAX_DELAY) != HAL_OK) {
-            return SDC_INIT_RESPONSE1_WAIT_RCV_ERR;
-        }
+        *response = SPI2_Exchange_Byte(0xFF);   // Keep MOSI high while receiving
         if (tries-- == 0) {
+            Telemetry_Record_Response1(SDC_INIT_RESPONSE1_WAIT_TIMEOUT,
+                    *response);
             return SDC_INIT_RESPONSE1_WAIT_TIMEOUT;
         }
     } while ((*response & 0x7F) == 0X7F);    // TODO: Check why 0xFF does not
@@ -413,6 +854,7 @@ static SDC_Status Receive_Response1(uint8_t *restrict const response) {
                                              // the first byte after CMD0 is 0x7F
                                              // followed by 0x01 - Fix code to not
                                              //initialize SD card without removing power
+    Telemetry_Record_Response1(SDC_OK, *response);
     return SDC_OK;
 }
 
@@ -426,39 +868,29 @@ static SDC_Status Do_CMD0_Init(void) {
     uint8_t ret;
     uint8_t tries = 10;
 
-    if (SDC_SPI_Select() != HAL_OK) {
-        return SDC_INIT_CMD0_START_ERR;
-    }
+    SDC_SPI_Select();
 
     do {
         // Send CMD0 request
         ret = Send_CMD(CMD0, CMD0_ARGS, CMD0_CRC);
         if (ret != SDC_OK) {
-            if (SDC_SPI_Deselect() != HAL_OK) {
-                return SDC_INIT_CMD0_END_ERR;
-            }
+            SDC_SPI_Deselect();
             return ret;
         }
         // Wait for R1 response
         ret = Receive_Response1(&response);
         if (ret != SDC_OK) {
-            if (SDC_SPI_Deselect() != HAL_OK) {
-                return SDC_INIT_CMD0_END_ERR;
-            }
+            SDC_SPI_Deselect();
             return ret;
         }
         // If we fail a couple of times, mark the initialization as failure
         if (tries-- == 0) {
-            if (SDC_SPI_Deselect() != HAL_OK) {
-                return SDC_INIT_CMD0_END_ERR;
-            }
+            SDC_SPI_Deselect();
             return SDC_INIT_CMD0_TIMEOUT;
         }
     } while (response != 0x01);
 
-    if (SDC_SPI_Deselect() != HAL_OK) {
-        return SDC_INIT_CMD0_END_ERR;
-    }
+    SDC_SPI_Deselect();
     return SDC_OK;
 }
 
@@ -485,8 +917,8 @@ static SDC_Status Receive_Response_3_Or_7(uint8_t *restrict const response) {
         return SDC_INIT_RESPONSE37_RESPONSE1_ERR;
     }
 
-    if (HAL_SPI_Receive(&hspi2, &response[1], 4, HAL_MAX_DELAY) != HAL_OK) {
-        return SDC_INIT_RESPONSE37_POST_RESPONSE1_RECV_ERR;
+    for (uint8_t i = 1; i < 5; i++) {
+        response[i] = SPI2_Exchange_Byte(0xFF);
     }
 
     return SDC_OK;
@@ -504,29 +936,21 @@ static SDC_Status Do_CMD8_Init(SDC_Type *restrict const card_type) {
     uint8_t ret;
     uint8_t response[5];
 
-    if (SDC_SPI_Select() != HAL_OK) {
-        return SDC_INIT_CMD8_START_ERR;
-    }
+    SDC_SPI_Select();
 
     ret = Send_CMD(CMD8, CMD8_ARGS, CMD8_CRC);
     if (ret != SDC_OK) {
-        if (SDC_SPI_Deselect() != HAL_OK) {
-            return SDC_INIT_CMD8_END_ERR;
-        }
+        SDC_SPI_Deselect();
         return ret;
     }
 
     ret = Receive_Response_3_Or_7(response);
     if (ret != SDC_OK) {
-        if (SDC_SPI_Deselect() != HAL_OK) {
-            return SDC_INIT_CMD8_END_ERR;
-        }
+        SDC_SPI_Deselect();
         return ret;
     }
 
-    if (SDC_SPI_Deselect() != HAL_OK) {
-        return SDC_INIT_CMD8_END_ERR;
-    }
+    SDC_SPI_Deselect();
 
     // Check all the response bytes
     if (response[0] == 0x1) {
@@ -546,9 +970,6 @@ static SDC_Status Do_CMD8_Init(SDC_Type *restrict const card_type) {
         return SDC_INIT_CARD_UNSUPPORTED;
     }
 
-    // Set SPI to use 10MHz clock for faster transfers
-    hspi2.Instance->CR1 = (hspi2.Instance->CR1 & ~SPI_CR1_BR_Msk)
-            | SPI_BAUDRATEPRESCALER_2;
     return SDC_OK;
 }
 
@@ -562,26 +983,20 @@ static SDC_Status Do_CMD8_Init(SDC_Type *restrict const card_type) {
  */
 static SDC_Status Do_ACMD41_Init(const SDC_Type card_type) {
     uint8_t ret;
-    uint8_t tries = 100; // 100 tries with 10 ms wait each = 1s wait for response
     uint8_t response = 0xFF;
+    const uint32_t start_tick = HAL_GetTick();
 
-    if (SDC_SPI_Select() != HAL_OK) {
-        return SDC_INIT_ACMD41_START_ERR;
-    }
+    SDC_SPI_Select();
 
     do {
         ret = Send_CMD(CMD55, CMD55_ARGS, CMD55_CRC);
         if (ret != SDC_OK) {
-            if (SDC_SPI_Deselect() != HAL_OK) {
-                return SDC_INIT_ACMD41_END_ERR;
-            }
+            SDC_SPI_Deselect();
             return ret;
         }
         ret = Receive_Response1(&response);
         if (ret != SDC_OK) {
-            if (SDC_SPI_Deselect() != HAL_OK) {
-                return SDC_INIT_ACMD41_END_ERR;
-            }
+            SDC_SPI_Deselect();
             return ret;
         }
 
@@ -591,28 +1006,23 @@ static SDC_Status Do_ACMD41_Init(const SDC_Type card_type) {
             ret = Send_CMD(CMD41, CMD41_ARGS_OTHERS, CMD41_CRC);
         }
         if (ret != SDC_OK) {
-            if (SDC_SPI_Deselect() != HAL_OK) {
-                return SDC_INIT_ACMD41_END_ERR;
-            }
+            SDC_SPI_Deselect();
             return ret;
         }
         ret = Receive_Response1(&response);
         if (ret != SDC_OK) {
-            if (SDC_SPI_Deselect() != HAL_OK) {
-                return SDC_INIT_ACMD41_END_ERR;
-            }
+            SDC_SPI_Deselect();
             return ret;
         }
+        latency_stats.acmd41_polls++;
 
-        // Wait for 10 ms to check initialization status again
-        HAL_Delay(10);
-    } while ((tries-- > 0) && (response != 0));   // Wait until card goes out of
-                                                  // idle state or 1s
-    if (SDC_SPI_Deselect() != HAL_OK) {
-        return SDC_INIT_ACMD41_END_ERR;
-    }
+        // Poll again right away. One ACMD41 round trip at identification clock
+        // rate already takes a fraction of a millisecond
+    } while (((HAL_GetTick() - start_tick) < ACMD41_TIMEOUT_MS)
+            && (response != 0));   // Wait until card goes out of idle state
+    SDC_SPI_Deselect();
 
-    if (tries == 0) {
+    if (response != 0) {
         // Either MMC or unknown card type
         return SDC_INIT_CARD_UNSUPPORTED;
     }
@@ -631,28 +1041,20 @@ static SDC_Status Do_CMD58_Init(SDC_Type *restrict const card_type) {
     uint8_t ret;
     uint8_t response[5];
 
-    if (SDC_SPI_Select() != HAL_OK) {
-        return SDC_INIT_CMD58_START_ERR;
-    }
+    SDC_SPI_Select();
 
     ret = Send_CMD(CMD58, CMD58_ARGS, CMD58_CRC);
     if (ret != SDC_OK) {
-        if (SDC_SPI_Deselect() != HAL_OK) {
-            return SDC_INIT_CMD58_END_ERR;
-        }
+        SDC_SPI_Deselect();
         return ret;
     }
     ret = Receive_Response_3_Or_7(response);
     if (ret != SDC_OK) {
-        if (SDC_SPI_Deselect() != HAL_OK) {
-            return SDC_INIT_CMD58_END_ERR;
-        }
+        SDC_SPI_Deselect();
         return ret;
     }
 
-    if (SDC_SPI_Deselect() != HAL_OK) {
-        return SDC_INIT_CMD58_END_ERR;
-    }
+    SDC_SPI_Deselect();
 
     if (!(response[1] & 0x80)) {
         // Power up bit is not set
@@ -669,23 +1071,1085 @@ static SDC_Status Do_CMD58_Init(SDC_Type *restrict const card_type) {
 }
 
 /**
- * Select the SD card chip for communication
+ * Read a sector using single block read command
+ *
+ * @param start_addr    (IN)    Address of the sector to read
+ * @param buffer        (OUT)   Buffer to read the sector into
  *
- * @return  Status of chip select operation
+ * @return  Status of sector read operation
  */
-static HAL_StatusTypeDef SDC_SPI_Select(void) {
-    uint8_t temp = 0xFF;
-    SDC_CS_SELECT();
-    return HAL_SPI_Transmit(&hspi2, &temp, 1, HAL_MAX_DELAY);
+static SDC_Status Read_Single_Block(uint32_t start_addr,
+        uint8_t *restrict const buffer) {
+    uint8_t ret;
+    uint8_t response;
+
+    // SDSC V1 takes address in terms of byte offsets
+    if (SD_card_type == SDSC_V1) {
+        start_addr *= SECTOR_SIZE;
+    }
+
+    SDC_SPI_Select();
+
+    ret = Send_CMD(CMD17, start_addr, CMD17_CRC);
+    if (ret != SDC_OK) {
+        SDC_SPI_Deselect();
+        return SDC_READ_SEND_CMD_ERR;
+    }
+    ret = Receive_Response1(&response);
+    if (ret != SDC_OK) {
+        SDC_SPI_Deselect();
+        return SDC_READ_RESPONSE1_ERR;
+    }
+
+    ret = Receive_Data_Block(buffer);
+    if (ret != SDC_OK) {
+        SDC_SPI_Deselect();
+        return ret;
+    }
+
+    SDC_SPI_Deselect();
+
+    return SDC_OK;
 }
 
 /**
- * De-select the SD card chip for communication
+ * Read consecutive sectors using multiple block read command
  *
- * @return  Status of chip de-select operation
+ * @param start_addr    (IN)    Address of the first sector to read
+ * @param count         (IN)    Number of sectors to read
+ * @param buffer        (OUT)   Buffer to read the sectors into
+ * @param blocks_read   (OUT)   Number of sectors received successfully before
+ *                              the transfer ended
+ *
+ * @return  Status of multiple sector read operation
  */
-static HAL_StatusTypeDef SDC_SPI_Deselect(void) {
-    uint8_t temp = 0xFF;
-    SDC_CS_DESELECT();
-    return HAL_SPI_Transmit(&hspi2, &temp, 1, HAL_MAX_DELAY);
+static SDC_Status Read_Multiple_Blocks(uint32_t start_addr,
+        const uint32_t count, uint8_t *restrict const buffer,
+        uint32_t *restrict const blocks_read) {
+    uint8_t ret;
+    uint8_t response;
+
+    *blocks_read = 0;
+
+    // SDSC V1 takes address in terms of byte offsets
+    if (SD_card_type == SDSC_V1) {
+        start_addr *= SECTOR_SIZE;
+    }
+
+    SDC_SPI_Select();
+
+    ret = Send_CMD(CMD18, start_addr, CMD18_CRC);
+    if (ret != SDC_OK) {
+        SDC_SPI_Deselect();
+        return SDC_READ_SEND_CMD_ERR;
+    }
+    ret = Receive_Response1(&response);
+    if ((ret != SDC_OK) || (response != 0x00)) {
+        // Card did not accept the command, so there is no transfer to stop
+        SDC_SPI_Deselect();
+        return SDC_READ_RESPONSE1_ERR;
+    }
+
+    // Card keeps sending data blocks until it is asked to stop
+    for (uint32_t i = 0; i < count; i++) {
+        ret = Receive_Data_Block(buffer + (i * SECTOR_SIZE));
+        if (ret != SDC_OK) {
+            // Stop the transfer even on failure so that the card goes back to
+            // transfer state. Report the original error to the caller
+            Stop_Transmission();
+            SDC_SPI_Deselect();
+            return ret;
+        }
+        (*blocks_read)++;
+    }
+
+    ret = Stop_Transmission();
+    if (ret != SDC_OK) {
+        SDC_SPI_Deselect();
+        return ret;
+    }
+
+    SDC_SPI_Deselect();
+
+    return SDC_OK;
+}
+
+/**
+ * Receive a data block (data token, payload and CRC) from SD card after a read
+ * command has been accepted. Chip should already be selected
+ *
+ * @param buffer    (OUT)   Buffer to store the payload in. It should be at
+ *                          least SECTOR_SIZE in size
+ *
+ * @return  Status of receiving the data block
+ */
+static SDC_Status Receive_Data_Block(uint8_t *restrict const buffer) {
+    uint8_t ret;
+    uint8_t crc[2];
+
+    ret = Wait_For_Data_Token();
+    if (ret != SDC_OK) {
+        return ret;
+    }
+
+    // Valid data token. Account the payload transfer cost against the mode
+    // used so that the modes can be compared
+    const SDC_Transfer_Mode mode = transfer_mode;
+    const uint32_t start_us = Profiling_Get_Time_Us();
+    const uint32_t start_cycles = Profiling_Get_Cycles();
+    if (mode == SDC_TRANSFER_MODE_DMA) {
+        ret = Receive_Payload_DMA(buffer);
+    } else {
+        ret = Receive_Payload_Blocking(buffer);
+    }
+    transfer_stats[mode].active_cycles += Profiling_Get_Cycles()
+            - start_cycles;
+    transfer_stats[mode].wall_time_us += Profiling_Get_Time_Us() - start_us;
+    if (ret != SDC_OK) {
+        return ret;
+    }
+    transfer_stats[mode].sectors++;
+#if SDC_COLLECT_TELEMETRY
+    telemetry.payload_bytes += SECTOR_SIZE;
+#endif
+
+    // Receive CRC tokens and check them against CRC computed by CRC peripheral
+    crc[0] = SPI2_Exchange_Byte(0xFF);
+    crc[1] = SPI2_Exchange_Byte(0xFF);
+    if (verify_data_crc) {
+        crc_stats.blocks_checked++;
+        if (CRC16_Compute(buffer, SECTOR_SIZE) != ((crc[0] << 8) | crc[1])) {
+            crc_stats.crc_failures++;
+            return SDC_READ_DATA_CRC_MISMATCH;
+        }
+    }
+
+    return SDC_OK;
+}
+
+/**
+ * Wait for the card to send the token which starts a data block. Chip should
+ * already be selected
+ *
+ * @return  Status of waiting for the data token
+ */
+static SDC_Status Wait_For_Data_Token(void) {
+    uint8_t response;
+    const uint32_t start_cycles = Profiling_Get_Cycles();
+    const uint32_t timeout_cycles = Ms_To_Cycles(DATA_TOKEN_TIMEOUT_MS);
+
+    do {    // Wait at most 200 ms for valid data/err token to appear
+        response = SPI2_Exchange_Byte(0xFF);
+    } while (((Profiling_Get_Cycles() - start_cycles) < timeout_cycles)
+            && (response == 0xFF));
+
+    if (response == 0xFF) {
+#if SDC_COLLECT_TELEMETRY
+        telemetry.token_timeouts++;
+#endif
+        return SDC_READ_DATA_TOKEN_WAIT_TIMEOUT;
+    }
+    Telemetry_Record_Latency(telemetry.token_wait_histogram,
+            Profiling_Get_Cycles() - start_cycles);
+    if (response != DATA_TOKEN) {
+#if SDC_COLLECT_TELEMETRY
+        telemetry.error_tokens++;
+#endif
+        return SDC_READ_ERROR_TOKEN_RECEIVED;
+    }
+    return SDC_OK;
+}
+
+/**
+ * Send a command which is answered with a short data block (CSD, switch
+ * function status) and receive that block with CRC verification
+ *
+ * @param cmd       (IN)    Command to request on SD card
+ * @param args      (IN)    Arguments to use for the requested command
+ * @param buffer    (OUT)   Buffer to store the data block in
+ * @param size      (IN)    Number of bytes in the data block
+ *
+ * @return  Status of reading the data block
+ */
+static SDC_Status Read_Register_Block(const uint8_t cmd, const uint32_t args,
+        uint8_t *restrict const buffer, const uint8_t size) {
+    uint8_t ret;
+    uint8_t response;
+    uint16_t crc;
+
+    SDC_SPI_Select();
+
+    ret = Send_CMD(cmd, args, 0);
+    if (ret == SDC_OK) {
+        ret = Receive_Response1(&response);
+        if ((ret != SDC_OK) || (response != 0x00)) {
+            ret = SDC_READ_RESPONSE1_ERR;
+        }
+    }
+    if (ret == SDC_OK) {
+        ret = Wait_For_Data_Token();
+    }
+    if (ret == SDC_OK) {
+        for (uint8_t i = 0; i < size; i++) {
+            buffer[i] = SPI2_Exchange_Byte(0xFF);
+        }
+#if SDC_COLLECT_TELEMETRY
+        telemetry.register_bytes += size;
+#endif
+        crc = SPI2_Exchange_Byte(0xFF) << 8;
+        crc |= SPI2_Exchange_Byte(0xFF);
+        if (CRC16_Compute(buffer, size) != crc) {
+            ret = SDC_READ_DATA_CRC_MISMATCH;
+        }
+    }
+
+    SDC_SPI_Deselect();
+    return ret;
+}
+
+/**
+ * Select the SPI clock rate to use for data transfers. The rate proven for this
+ * card on an earlier wake is reused from backup register. Otherwise the
+ * fastest rate allowed by the card (CSD TRAN_SPEED, or high speed mode when
+ * CMD6 switch succeeds) is probed with CRC verified reads, falling back to
+ * slower rates until the reads pass, and the result is stored for later wakes
+ *
+ * @param card_type (IN)    Type of SD card as determined during initialization
+ *
+ * @return  Status of configuring the SPI clock rate
+ */
+static SDC_Status Configure_Bus_Speed(const SDC_Type card_type) {
+    uint8_t csd[CSD_SIZE];
+    uint8_t ret;
+    uint32_t max_hz;
+    uint32_t calibration;
+    uint8_t high_speed = 0;
+
+    // Any card is fine with default speed. Use it for reading the CSD
+    SPI2_Set_Prescaler(SPI2_Prescaler_For_Frequency(SDC_DEFAULT_SPEED_MAX_HZ));
+
+    if (Read_Register_Block(CMD9, CMD9_ARGS, csd, CSD_SIZE) != SDC_OK) {
+        return SDC_INIT_CSD_READ_ERR;
+    }
+    const uint16_t csd_crc = CRC16_Compute(csd, CSD_SIZE);
+    block_count = Decode_Block_Count(csd);
+
+    // Reuse the clock rate proven earlier for this card. High speed mode is
+    // lost when the card is powered off, so it is requested again
+    calibration = RTC_Read_Backup_Register(SDC_CLOCK_CALIBRATION_BKUP_REG);
+    if (((calibration >> SDC_CALIBRATION_MAGIC_POS) == SDC_CALIBRATION_MAGIC)
+            && (((calibration >> SDC_CALIBRATION_CSD_CRC_POS) & 0xFFFF)
+                    == csd_crc)) {
+        if (!(calibration & SDC_CALIBRATION_HIGH_SPEED)
+                || (Switch_To_High_Speed() == SDC_OK)) {
+            SPI2_Set_Prescaler(
+                    (calibration & SDC_CALIBRATION_BR_MSK) << SPI_CR1_BR_Pos);
+            return SDC_OK;
+        }
+    }
+
+    // CSD byte 3 holds TRAN_SPEED. Command class 10 (switch) is needed for
+    // CMD6, which SD v1 cards do not support
+    max_hz = Decode_Tran_Speed(csd[3]);
+    const uint16_t command_classes = (csd[4] << 4) | (csd[5] >> 4);
+    if ((card_type != SDSC_V1) && (command_classes & (1 << 10))
+            && (Switch_To_High_Speed() == SDC_OK)) {
+        max_hz = SDC_HIGH_SPEED_MAX_HZ;
+        high_speed = 1;
+    }
+
+    // Start with the fastest rate allowed and slow down until reads pass
+    uint32_t br = SPI2_Prescaler_For_Frequency(max_hz) >> SPI_CR1_BR_Pos;
+    do {
+        SPI2_Set_Prescaler(br << SPI_CR1_BR_Pos);
+        ret = Probe_Bus_Speed();
+    } while ((ret != SDC_OK) && (br++ < SDC_CALIBRATION_BR_MSK));
+    if (ret != SDC_OK) {
+        return SDC_INIT_CLOCK_CALIBRATION_ERR;
+    }
+
+    calibration = ((uint32_t) SDC_CALIBRATION_MAGIC << SDC_CALIBRATION_MAGIC_POS)
+            | (csd_crc << SDC_CALIBRATION_CSD_CRC_POS)
+            | (high_speed ? SDC_CALIBRATION_HIGH_SPEED : 0) | br;
+    RTC_Write_Backup_Register(SDC_CLOCK_CALIBRATION_BKUP_REG, calibration);
+    return SDC_OK;
+}
+
+/**
+ * Switch the card to high speed mode using CMD6
+ *
+ * @return  Status of switching to high speed mode
+ */
+static SDC_Status Switch_To_High_Speed(void) {
+    static uint8_t switch_status[SWITCH_STATUS_SIZE];
+
+    // Check mode first so that nothing changes if function is not supported.
+    // Byte 13 bit 1 indicates support for high speed function in group 1
+    if ((Read_Register_Block(CMD6, CMD6_ARGS_CHECK_HS, switch_status,
+    SWITCH_STATUS_SIZE) != SDC_OK) || !(switch_status[13] & (1 << 1))) {
+        return SDC_INIT_SWITCH_FUNC_ERR;
+    }
+
+    // Low nibble of byte 16 holds the function selected in group 1
+    if ((Read_Register_Block(CMD6, CMD6_ARGS_SWITCH_HS, switch_status,
+    SWITCH_STATUS_SIZE) != SDC_OK) || ((switch_status[16] & 0xF) != 1)) {
+        return SDC_INIT_SWITCH_FUNC_ERR;
+    }
+
+    // Card needs 8 clocks after the switch before it is used at the new rate
+    SPI2_Exchange_Byte(0xFF);
+    return SDC_OK;
+}
+
+/**
+ * Decode the card capacity from CSD register
+ *
+ * @param csd   (IN)    Contents of CSD register
+ *
+ * @return  Number of SECTOR_SIZE blocks on the card
+ */
+static uint32_t Decode_Block_Count(const uint8_t *restrict const csd) {
+    uint32_t c_size;
+
+    // CSD_STRUCTURE in the top 2 bits tells the layout of the register
+    if ((csd[0] >> 6) == 0) {
+        // CSD v1: C_SIZE[73:62], C_SIZE_MULT[49:47], READ_BL_LEN[83:80].
+        // Capacity = (C_SIZE + 1) * 2^(C_SIZE_MULT + 2) * 2^READ_BL_LEN, which
+        // reaches 4 GiB on the largest SDSC cards, so it is computed in 64 bits
+        c_size = ((csd[6] & 0x3) << 10) | (csd[7] << 2) | (csd[8] >> 6);
+        const uint8_t c_size_mult = ((csd[9] & 0x3) << 1) | (csd[10] >> 7);
+        const uint8_t read_bl_len = csd[5] & 0xF;
+        return (uint32_t) (((uint64_t) (c_size + 1)
+                << (c_size_mult + 2 + read_bl_len)) / SECTOR_SIZE);
+    }
+
+    // CSD v2: C_SIZE[69:48] in units of 512 KiB
+    c_size = ((csd[7] & 0x3F) << 16) | (csd[8] << 8) | csd[9];
+    return (c_size + 1) * 1024;
+}
+
+/**
+ * Block device read function for the SD card
+ *
+ * @param ctx       (IN)    Unused
+ * @param lba       (IN)    Address of the first sector to read
+ * @param count     (IN)    Number of consecutive sectors to read
+ * @param buffer    (OUT)   Buffer to read the sectors into
+ *
+ * @return  Status of the read operation
+ */
+static Block_Device_Status Block_Device_Read(void *ctx, const uint32_t lba,
+        const uint32_t count, uint8_t *restrict const buffer) {
+    (void) ctx;
+    if (SDC_Read_Sectors(lba, count, buffer) != SDC_OK) {
+        return BLOCK_DEVICE_READ_ERR;
+    }
+    return BLOCK_DEVICE_OK;
+}
+
+/**
+ * Block device asynchronous read function for the SD card
+ *
+ * @param ctx       (IN)    Unused
+ * @param lba       (IN)    Address of the first sector to read
+ * @param count     (IN)    Number of consecutive sectors to read
+ * @param buffer    (OUT)   Buffer to read the sectors into
+ * @param cb        (IN)    Function to call when the read finishes
+ * @param cb_ctx    (IN)    Context pointer to pass to cb
+ *
+ * @return  Status of queuing the read operation
+ */
+static Block_Device_Status Block_Device_Read_Async(void *ctx,
+        const uint32_t lba, const uint32_t count,
+        uint8_t *restrict const buffer, Block_Device_Read_Callback cb,
+        void *cb_ctx) {
+    (void) ctx;
+    const SDC_Status ret = Queue_Read(lba, count, buffer, NULL, cb, cb_ctx);
+    if (ret == SDC_READ_QUEUE_FULL) {
+        return BLOCK_DEVICE_BUSY;
+    } else if (ret != SDC_OK) {
+        return BLOCK_DEVICE_READ_ERR;
+    }
+    return BLOCK_DEVICE_OK;
+}
+
+/**
+ * Block device function to sleep until a queued read of the SD card finishes
+ *
+ * @param ctx   (IN)    Unused
+ * @param done  (IN)    Flag set by the read's callback
+ */
+static void Block_Device_Wait(void *ctx, volatile const uint8_t *done) {
+    (void) ctx;
+    // Flag is set by the callback, which runs once the read is completed here
+    Async_Complete_Requests();
+    __disable_irq();
+    while (*done == 0) {
+        if (read_queue_done == 0) {
+            __WFI();
+        }
+        __enable_irq();
+        Async_Complete_Requests();
+        __disable_irq();
+    }
+    __enable_irq();
+}
+
+/**
+ * Block device capacity function for the SD card
+ *
+ * @param ctx   (IN)    Unused
+ *
+ * @return  Number of sectors on the card
+ */
+static uint32_t Block_Device_Block_Count(void *ctx) {
+    (void) ctx;
+    return block_count;
+}
+
+/**
+ * Decode TRAN_SPEED field of CSD register into a SPI clock frequency
+ *
+ * @param tran_speed    (IN)    TRAN_SPEED byte from CSD register
+ *
+ * @return  Max clock frequency in Hz supported by the card
+ */
+static uint32_t Decode_Tran_Speed(const uint8_t tran_speed) {
+    // Time values multiplied by 10. Units are 100kbit/s, 1, 10 and 100Mbit/s
+    static const uint8_t time_values[16] = { 0, 10, 12, 13, 15, 20, 25, 30, 35,
+            40, 45, 50, 55, 60, 70, 80 };
+    static const uint32_t rate_units[4] = { 10000, 100000, 1000000, 10000000 };
+    const uint8_t unit = tran_speed & 0x7;
+
+    if (unit >= 4) {
+        return SDC_DEFAULT_SPEED_MAX_HZ;
+    }
+    return rate_units[unit] * time_values[(tran_speed >> 3) & 0xF];
+}
+
+/**
+ * Read a few sectors with CRC verification at the current SPI clock rate
+ *
+ * @return  Status of the probe reads
+ */
+static SDC_Status Probe_Bus_Speed(void) {
+    uint8_t ret = SDC_OK;
+    const uint8_t verify_data_crc_saved = verify_data_crc;
+
+    // Probe reads are always verified, and are not retried so that a rate
+    // which needs retries is not selected
+    verify_data_crc = 1;
+    for (uint8_t i = 0; (i < SDC_CALIBRATION_PROBE_SECTORS) && (ret == SDC_OK);
+            i++) {
+        ret = Read_Single_Block(i, probe_buffer);
+    }
+    verify_data_crc = verify_data_crc_saved;
+    return ret;
+}
+
+/**
+ * Initialize CRC peripheral for CRC16 (CCITT, polynomial x^16 + x^12 + x^5 + 1)
+ * used by SD card for data blocks
+ *
+ * @return  Status of CRC peripheral initialization
+ */
+static SDC_Status CRC_Init(void) {
+    hcrc.Instance = CRC;
+    hcrc.Init.DefaultPolynomialUse = DEFAULT_POLYNOMIAL_DISABLE;
+    hcrc.Init.DefaultInitValueUse = DEFAULT_INIT_VALUE_DISABLE;
+    hcrc.Init.GeneratingPolynomial = 0x1021;
+    hcrc.Init.CRCLength = CRC_POLYLENGTH_16B;
+    hcrc.Init.InitValue = 0;
+    hcrc.Init.InputDataInversionMode = CRC_INPUTDATA_INVERSION_NONE;
+    hcrc.Init.OutputDataInversionMode = CRC_OUTPUTDATA_INVERSION_DISABLE;
+    hcrc.InputDataFormat = CRC_INPUTDATA_FORMAT_BYTES;
+
+    if (HAL_CRC_Init(&hcrc) != HAL_OK) {
+        return SDC_INIT_CRC_INIT_ERR;
+    }
+    return SDC_OK;
+}
+
+/**
+ * Low-level initialization of CRC peripheral
+ */
+void SDC_CRC_Msp_Init(void) {
+    __HAL_RCC_CRC_CLK_ENABLE();
+}
+
+/**
+ * Low-level de-initialization of CRC peripheral
+ */
+void SDC_CRC_Msp_De_Init(void) {
+    __HAL_RCC_CRC_CLK_DISABLE();
+}
+
+/**
+ * Compute CRC16 used by SD card for data blocks using CRC peripheral
+ *
+ * @param data  (IN)    Bytes to compute the CRC for
+ * @param size  (IN)    Number of bytes
+ *
+ * @return  CRC16 value
+ */
+static uint16_t CRC16_Compute(const uint8_t *restrict const data,
+        const uint32_t size) {
+    // Input format is set to bytes, so HAL feeds the buffer byte by byte
+    return HAL_CRC_Calculate(&hcrc, (uint32_t*) data, size);
+}
+
+/**
+ * Receive the payload of a data block by polling SPI from the CPU
+ *
+ * @param buffer    (OUT)   Buffer to store SECTOR_SIZE bytes of payload in
+ *
+ * @return  Status of receiving the payload
+ */
+static SDC_Status Receive_Payload_Blocking(uint8_t *restrict const buffer) {
+    // Keep MOSI high while receiving data
+    for (uint16_t i = 0; i < SECTOR_SIZE; i++) {
+        buffer[i] = 0xFF;
+    }
+    if (HAL_SPI_Receive(&hspi2, buffer, SECTOR_SIZE, HAL_MAX_DELAY) != HAL_OK) {
+        return SDC_READ_DATA_RCV_ERR;
+    }
+    return SDC_OK;
+}
+
+/**
+ * Receive the payload of a data block using DMA. The core sleeps until the
+ * transfer complete interrupt arrives
+ *
+ * @param buffer    (OUT)   Buffer to store SECTOR_SIZE bytes of payload in
+ *
+ * @return  Status of receiving the payload
+ */
+static SDC_Status Receive_Payload_DMA(uint8_t *restrict const buffer) {
+    spi2_dma_state = SDC_DMA_BUSY;
+    if (HAL_SPI_TransmitReceive_DMA(&hspi2, (uint8_t*) &dma_dummy_tx_byte,
+            buffer, SECTOR_SIZE) != HAL_OK) {
+        spi2_dma_state = SDC_DMA_IDLE;
+        return SDC_READ_DMA_START_ERR;
+    }
+
+    // Check the state with interrupts masked so that the completion interrupt
+    // cannot slip in between the check and WFI. A pending interrupt still
+    // wakes up the core and gets serviced as soon as it is unmasked
+    __disable_irq();
+    while (spi2_dma_state == SDC_DMA_BUSY) {
+        __WFI();
+        __enable_irq();
+        __disable_irq();
+    }
+    __enable_irq();
+
+    if (spi2_dma_state == SDC_DMA_ERROR) {
+        spi2_dma_state = SDC_DMA_IDLE;
+        return SDC_READ_DMA_TRANSFER_ERR;
+    }
+    return SDC_OK;
+}
+
+/**
+ * Send CMD12 to end a multiple block read and wait for the card to become
+ * ready again. Chip should already be selected
+ *
+ * @return  Status of stopping the data transmission
+ */
+static SDC_Status Stop_Transmission(void) {
+    const uint32_t timeout_cycles = Ms_To_Cycles(STOP_BUSY_TIMEOUT_MS);
+    uint8_t ret;
+    uint8_t response;
+    uint32_t start_cycles;
+
+    ret = Send_CMD(CMD12, CMD12_ARGS, CMD12_CRC);
+    if (ret != SDC_OK) {
+        return SDC_READ_STOP_CMD_ERR;
+    }
+
+    // Card may still be clocking out data when CMD12 arrives. Discard the
+    // stuff byte following the command before looking for R1
+    SPI2_Exchange_Byte(0xFF);
+    ret = Receive_Response1(&response);
+    if (ret != SDC_OK) {
+        return SDC_READ_STOP_CMD_ERR;
+    }
+
+    // R1b response: card holds MISO low while it is busy
+    start_cycles = Profiling_Get_Cycles();
+    do {
+        response = SPI2_Exchange_Byte(0xFF);
+#if SDC_COLLECT_TELEMETRY
+        telemetry.busy_bytes++;
+#endif
+    } while (((Profiling_Get_Cycles() - start_cycles) < timeout_cycles)
+            && (response == 0x00));
+
+    if (response == 0x00) {
+        return SDC_READ_STOP_BUSY_TIMEOUT;
+    }
+    return SDC_OK;
+}
+
+/**
+ * Add a read to the queue of asynchronous reads, and start it right away if
+ * the bus is free
+ *
+ * @param start_addr        (IN)    Address of the first sector to read
+ * @param count             (IN)    Number of consecutive sectors to read
+ * @param buffer            (OUT)   Buffer to read the sectors into
+ * @param cb                (IN)    SD card API callback, or NULL
+ * @param block_device_cb   (IN)    Block device API callback, or NULL
+ * @param ctx               (IN)    Context pointer to pass to the callback
+ *
+ * @return  Status of queuing the read
+ */
+static SDC_Status Queue_Read(const uint32_t start_addr, const uint32_t count,
+        uint8_t *restrict const buffer, SDC_Read_Callback cb,
+        Block_Device_Read_Callback block_device_cb, void *ctx) {
+    uint8_t start_now;
+
+    // SD card initialization should have set the card type if successful
+    if (SD_card_type == CARD_UNKNOWN) {
+        return SDC_READ_CARD_UNSUPPORTED;
+    }
+
+    // Free the slots of finished reads. Queue is also updated from PendSV when
+    // a read finishes
+    Async_Complete_Requests();
+    __disable_irq();
+    if (read_queue_count == SDC_READ_QUEUE_DEPTH) {
+        __enable_irq();
+        return SDC_READ_QUEUE_FULL;
+    }
+    SDC_Read_Request *const request = &read_queue[(read_queue_head
+            + read_queue_count) % SDC_READ_QUEUE_DEPTH];
+    request->start_addr = start_addr;
+    request->count = count;
+    request->buffer = buffer;
+    request->cb = cb;
+    request->block_device_cb = block_device_cb;
+    request->ctx = ctx;
+    request->status = SDC_OK;
+    start_now = (read_queue_count == read_queue_done);
+    read_queue_count++;
+    __enable_irq();
+
+    // Otherwise the read is started when the ones before it finish
+    if (start_now) {
+        async_blocks_read = 0;
+        async_retries = 0;
+        Async_Start_Request();
+    }
+    return SDC_OK;
+}
+
+/**
+ * Get the read in progress, which follows the finished reads in the queue
+ *
+ * @return  Read in progress
+ */
+static inline SDC_Read_Request* Async_Current_Request(void) {
+    return &read_queue[(read_queue_head + read_queue_done)
+            % SDC_READ_QUEUE_DEPTH];
+}
+
+/**
+ * Send the read command for the remaining sectors of the read in progress, and
+ * start receiving the first data block
+ */
+static void Async_Start_Request(void) {
+    const SDC_Read_Request *const request = Async_Current_Request();
+    uint32_t addr = request->start_addr + async_blocks_read;
+    uint8_t response;
+
+    if (request->count == async_blocks_read) {
+        // Nothing to read
+        Async_Finish_Request(SDC_OK);
+        return;
+    }
+
+    // SDSC V1 takes address in terms of byte offsets
+    if (SD_card_type == SDSC_V1) {
+        addr *= SECTOR_SIZE;
+    }
+
+    SDC_SPI_Select();
+
+    async_multiple_blocks = ((request->count - async_blocks_read) > 1);
+    if (Send_CMD(async_multiple_blocks ? CMD18 : CMD17, addr,
+            async_multiple_blocks ? CMD18_CRC : CMD17_CRC) != SDC_OK) {
+        async_multiple_blocks = 0;
+        Async_Finish_Request(SDC_READ_SEND_CMD_ERR);
+        return;
+    }
+    if ((Receive_Response1(&response) != SDC_OK) || (response != 0x00)) {
+        // Card did not accept the command, so there is no transfer to stop
+        async_multiple_blocks = 0;
+        Async_Finish_Request(SDC_READ_RESPONSE1_ERR);
+        return;
+    }
+
+    Async_Start_Next_Block();
+}
+
+/**
+ * Wait for the next data token and start receiving the payload with DMA. The
+ * token follows shortly once the card is streaming, so it is polled here
+ */
+static void Async_Start_Next_Block(void) {
+    const SDC_Read_Request *const request = Async_Current_Request();
+    uint8_t ret;
+
+    ret = Wait_For_Data_Token();
+    if (ret != SDC_OK) {
+        Async_Finish_Request(ret);
+        return;
+    }
+
+    async_payload_start_us = Profiling_Get_Time_Us();
+    spi2_dma_state = SDC_DMA_BUSY;
+    async_dma_in_flight = 1;
+    if (HAL_SPI_TransmitReceive_DMA(&hspi2, (uint8_t*) &dma_dummy_tx_byte,
+            request->buffer + (async_blocks_read * SECTOR_SIZE), SECTOR_SIZE)
+            != HAL_OK) {
+        async_dma_in_flight = 0;
+        spi2_dma_state = SDC_DMA_IDLE;
+        Async_Finish_Request(SDC_READ_DMA_START_ERR);
+    }
+}
+
+/**
+ * Check the data block just received by DMA, and continue with the next block,
+ * a retry or the completion of the read. Called from PendSV
+ */
+static void Async_Block_Received(void) {
+    const SDC_Read_Request *const request = Async_Current_Request();
+    uint8_t *const block = request->buffer + (async_blocks_read * SECTOR_SIZE);
+    uint8_t crc[2];
+
+    transfer_stats[SDC_TRANSFER_MODE_DMA].wall_time_us += Profiling_Get_Time_Us()
+            - async_payload_start_us;
+    transfer_stats[SDC_TRANSFER_MODE_DMA].sectors++;
+#if SDC_COLLECT_TELEMETRY
+    telemetry.payload_bytes += SECTOR_SIZE;
+#endif
+
+    crc[0] = SPI2_Exchange_Byte(0xFF);
+    crc[1] = SPI2_Exchange_Byte(0xFF);
+    if (verify_data_crc) {
+        crc_stats.blocks_checked++;
+        if (CRC16_Compute(block, SECTOR_SIZE) != ((crc[0] << 8) | crc[1])) {
+            crc_stats.crc_failures++;
+            if (async_retries >= SDC_READ_MAX_RETRIES) {
+                Async_Finish_Request(SDC_READ_DATA_CRC_MISMATCH);
+                return;
+            }
+            // Resume from the failed block with a new read command
+            async_retries++;
+            crc_stats.retries++;
+            if (async_multiple_blocks) {
+                Stop_Transmission();
+            }
+            SDC_SPI_Deselect();
+            Async_Start_Request();
+            return;
+        }
+    }
+
+    async_blocks_read++;
+    if (async_blocks_read < request->count) {
+        Async_Start_Next_Block();
+    } else {
+        Async_Finish_Request(SDC_OK);
+    }
+}
+
+/**
+ * End the transfer of the read in progress, record its status and start the
+ * next queued read. Its callback is called later from thread context
+ *
+ * @param status    (IN)    Status of the finished read
+ */
+static void Async_Finish_Request(SDC_Status status) {
+    SDC_Read_Request *const request = Async_Current_Request();
+
+    // Stop the transfer even on failure so that the card goes back to
+    // transfer state. Report the original error to the caller
+    if (async_multiple_blocks) {
+        async_multiple_blocks = 0;
+        if ((Stop_Transmission() != SDC_OK) && (status == SDC_OK)) {
+            status = SDC_READ_STOP_CMD_ERR;
+        }
+    }
+    SDC_SPI_Deselect();
+
+    request->status = status;
+    __disable_irq();
+    read_queue_done++;
+    const uint8_t pending = read_queue_count - read_queue_done;
+    __enable_irq();
+    async_blocks_read = 0;
+    async_retries = 0;
+
+    if (pending != 0) {
+        Async_Start_Request();
+    }
+}
+
+/**
+ * Free the slots of finished reads and call their callbacks, in the order the
+ * reads were queued. Only called from thread context, so that callbacks never
+ * run in interrupt context
+ */
+static void Async_Complete_Requests(void) {
+    SDC_Read_Request request;
+
+    while (read_queue_done != 0) {
+        // Free the slot before calling back, so that the callback can queue
+        // the next read
+        request = read_queue[read_queue_head];
+        __disable_irq();
+        read_queue_head = (read_queue_head + 1) % SDC_READ_QUEUE_DEPTH;
+        read_queue_count--;
+        read_queue_done--;
+        __enable_irq();
+
+        if (request.cb != NULL) {
+            (*request.cb)(request.status, request.ctx);
+        } else if (request.block_device_cb != NULL) {
+            (*request.block_device_cb)(
+                    (request.status == SDC_OK) ?
+                            BLOCK_DEVICE_OK : BLOCK_DEVICE_READ_ERR,
+                    request.ctx);
+        }
+    }
+}
+
+/**
+ * Convert a timeout in ms to core clock cycles. Timeouts are measured with the
+ * cycle counter because HAL tick does not advance inside PendSV, which shares
+ * the lowest priority with SysTick, where queued reads wait for the card
+ *
+ * @param ms    (IN)    Timeout in ms
+ *
+ * @return  Number of core clock cycles in the timeout
+ */
+static inline uint32_t Ms_To_Cycles(const uint32_t ms) {
+    return (SystemCoreClock / 1000) * ms;
+}
+
+/**
+ * Count a command being sent and start timing its response
+ *
+ * @param cmd   (IN)    Command index being sent
+ */
+static inline void Telemetry_Record_Command(const uint8_t cmd) {
+#if SDC_COLLECT_TELEMETRY
+    pending_command = NULL;
+    for (uint8_t i = 0; i < SDC_TELEMETRY_COMMANDS; i++) {
+        if (telemetry.commands[i].cmd == cmd) {
+            pending_command = &telemetry.commands[i];
+            pending_command->count++;
+            pending_command_start_cycles = Profiling_Get_Cycles();
+            return;
+        }
+    }
+#else
+    (void) cmd;
+#endif
+}
+
+/**
+ * Record the R1 response of the last command sent
+ *
+ * @param status    (IN)    Status of receiving the response
+ * @param response  (IN)    R1 byte received
+ */
+static inline void Telemetry_Record_Response1(const SDC_Status status,
+        const uint8_t response) {
+#if SDC_COLLECT_TELEMETRY
+    if (pending_command == NULL) {
+        return;
+    }
+    // Idle bit is expected during initialization, other bits are errors
+    if ((status != SDC_OK) || (response & 0x7E)) {
+        pending_command->errors++;
+    }
+    if (status == SDC_OK) {
+        Telemetry_Record_Latency(pending_command->latency_histogram,
+                Profiling_Get_Cycles() - pending_command_start_cycles);
+    }
+    pending_command = NULL;
+#else
+    (void) status;
+    (void) response;
+#endif
+}
+
+/**
+ * Add a latency to a histogram with power of two buckets in microseconds
+ *
+ * @param histogram (IN)    Histogram with SDC_HISTOGRAM_BUCKETS buckets
+ * @param cycles    (IN)    Latency in core clock cycles
+ */
+static inline void Telemetry_Record_Latency(uint32_t *restrict const histogram,
+        const uint32_t cycles) {
+#if SDC_COLLECT_TELEMETRY
+    const uint32_t us = cycles / (SystemCoreClock / 1000000);
+    uint32_t bucket = 31 - __builtin_clz(us | 1);
+    if (bucket >= SDC_HISTOGRAM_BUCKETS) {
+        bucket = SDC_HISTOGRAM_BUCKETS - 1;
+    }
+    histogram[bucket]++;
+#else
+    (void) histogram;
+    (void) cycles;
+#endif
+}
+
+/**
+ * Log the buckets of a latency histogram on a single line
+ *
+ * @param name      (IN)    Name of what the latencies were measured for
+ * @param histogram (IN)    Histogram with SDC_HISTOGRAM_BUCKETS buckets
+ */
+static void Log_Histogram(const char *restrict const name,
+        const uint32_t *restrict const histogram) {
+    char line[MAX_LOG_MSG_SIZE];
+    int len;
+
+    len = snprintf(line, sizeof(line), "SD %s latency us:", name);
+    for (uint8_t i = 0; (i < SDC_HISTOGRAM_BUCKETS) && (len > 0)
+            && ((size_t) len < sizeof(line)); i++) {
+        if (i == (SDC_HISTOGRAM_BUCKETS - 1)) {
+            len += snprintf(line + len, sizeof(line) - len, " >=%lu:%lu",
+                    (uint32_t) 1 << i, histogram[i]);
+        } else {
+            len += snprintf(line + len, sizeof(line) - len, " <%lu:%lu",
+                    (uint32_t) 2 << i, histogram[i]);
+        }
+    }
+    Log_Msg("%s", line);
+}
+
+/**
+ * Wait until the card releases MISO after an operation. Card holds MISO low
+ * while it is busy. Chip should already be selected
+ *
+ * @param timeout_ms    (IN)    Max time in ms to wait for the card
+ *
+ * @return  Status of waiting for the card to become ready
+ */
+static SDC_Status Wait_While_Busy(const uint32_t timeout_ms) {
+    const uint32_t start_tick = HAL_GetTick();
+
+    while (SPI2_Exchange_Byte(0xFF) != 0xFF) {
+#if SDC_COLLECT_TELEMETRY
+        telemetry.busy_bytes++;
+#endif
+        if ((HAL_GetTick() - start_tick) >= timeout_ms) {
+            return SDC_POWEROFF_BUSY_TIMEOUT;
+        }
+    }
+    return SDC_OK;
+}
+
+/**
+ * Make sure the card has finished internal operations and reports no error
+ * using CMD13, so that power can be removed right away
+ *
+ * @return  Status of checking that the card can be powered off
+ */
+static SDC_Status Prepare_For_Power_Off(void) {
+    uint8_t ret;
+    uint8_t response;
+    uint8_t status;
+
+    if (SD_card_type == CARD_UNKNOWN) {
+        // Card was not initialized, so it cannot be in the middle of an
+        // operation
+        return SDC_OK;
+    }
+
+    SDC_SPI_Select();
+
+    ret = Wait_While_Busy(POWER_OFF_READY_TIMEOUT_MS);
+    if (ret == SDC_OK) {
+        // R2 response is R1 followed by second status byte
+        ret = Send_CMD(CMD13, CMD13_ARGS, CMD13_CRC);
+        if (ret == SDC_OK) {
+            ret = Receive_Response1(&response);
+        }
+        status = SPI2_Exchange_Byte(0xFF);
+        if ((ret != SDC_OK) || (response != 0x00) || (status != 0x00)) {
+            ret = SDC_POWEROFF_CARD_STATUS_ERR;
+        }
+    }
+
+    SDC_SPI_Deselect();
+    return ret;
+}
+
+/**
+ * Select the SD card chip for communication
+ */
+static void SDC_SPI_Select(void) {
+    SDC_CS_SELECT();
+    SPI2_Exchange_Byte(0xFF);
+}
+
+/**
+ * De-select the SD card chip for communication
+ */
+static void SDC_SPI_Deselect(void) {
+    SDC_CS_DESELECT();
+    SPI2_Exchange_Byte(0xFF);
+}
+
+/**
+ * Send a byte to SD card and return the byte received at the same time. Used
+ * for commands, responses and polling where the cost of a HAL transfer call
+ * for every byte dominates the time on the wire
+ *
+ * @param tx_byte   (IN)    Byte to send. Use 0xFF to keep MOSI high when only
+ *                          receiving
+ *
+ * @return  Byte received from SD card, or 0xFF if SPI did not complete the
+ *          exchange in time
+ */
+static uint8_t SPI2_Exchange_Byte(const uint8_t tx_byte) {
+    uint8_t rx_byte = 0xFF;
+    const uint32_t start_cycles = Profiling_Get_Cycles();
+
+#if SDC_SPI_FAST_BYTE_EXCHANGE
+    const uint32_t timeout_cycles = Ms_To_Cycles(BYTE_EXCHANGE_TIMEOUT_MS);
+
+    // With FRXTH set for 8-bit frames, RXNE is raised as soon as one byte is in
+    // RX FIFO. Data register must be accessed as 8-bit to push/pop one byte
+    while (!(SPI2->SR & SPI_SR_TXE)) {
+        if ((Profiling_Get_Cycles() - start_cycles) >= timeout_cycles) {
+            byte_exchange_stats.timeouts++;
+            return rx_byte;
+        }
+    }
+    *((__IO uint8_t*) &SPI2->DR) = tx_byte;
+    while (!(SPI2->SR & SPI_SR_RXNE)) {
+        if ((Profiling_Get_Cycles() - start_cycles) >= timeout_cycles) {
+            byte_exchange_stats.timeouts++;
+            return rx_byte;
+        }
+    }
+    rx_byte = *((__IO uint8_t*) &SPI2->DR);
+#else
+    if (HAL_SPI_TransmitReceive(&hspi2, (uint8_t*) &tx_byte, &rx_byte, 1,
+            BYTE_EXCHANGE_TIMEOUT_MS) != HAL_OK) {
+        byte_exchange_stats.timeouts++;
+        rx_byte = 0xFF;
+    }
+#endif
+
+    byte_exchange_stats.cycles += Profiling_Get_Cycles() - start_cycles;
+    byte_exchange_stats.bytes++;
+    return rx_byte;
 }
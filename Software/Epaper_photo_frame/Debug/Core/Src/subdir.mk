@@ -6,12 +6,16 @@
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
 ../Core/Src/epd.c \
+../Core/Src/exfat.c \
 ../Core/Src/fat32.c \
 ../Core/Src/it.c \
 ../Core/Src/led.c \
 ../Core/Src/logging.c \
 ../Core/Src/main.c \
 ../Core/Src/msp.c \
+../Core/Src/profiling.c \
+../Core/Src/readahead.c \
+../Core/Src/refresh_policy.c \
 ../Core/Src/rtc_and_pwr.c \
 ../Core/Src/sdcard.c \
 ../Core/Src/syscalls.c \
@@ -20,12 +24,16 @@ C_SRCS += \
 
 OBJS += \
 ./Core/Src/epd.o \
+./Core/Src/exfat.o \
 ./Core/Src/fat32.o \
 ./Core/Src/it.o \
 ./Core/Src/led.o \
 ./Core/Src/logging.o \
 ./Core/Src/main.o \
 ./Core/Src/msp.o \
+./Core/Src/profiling.o \
+./Core/Src/readahead.o \
+./Core/Src/refresh_policy.o \
 ./Core/Src/rtc_and_pwr.o \
 ./Core/Src/sdcard.o \
 ./Core/Src/syscalls.o \
@@ -34,12 +42,16 @@ OBJS += \
 
 C_DEPS += \
 ./Core/Src/epd.d \
+./Core/Src/exfat.d \
 ./Core/Src/fat32.d \
 ./Core/Src/it.d \
 ./Core/Src/led.d \
 ./Core/Src/logging.d \
 ./Core/Src/main.d \
 ./Core/Src/msp.d \
+./Core/Src/profiling.d \
+./Core/Src/readahead.d \
+./Core/Src/refresh_policy.d \
 ./Core/Src/rtc_and_pwr.d \
 ./Core/Src/sdcard.d \
 ./Core/Src/syscalls.d \
@@ -54,7 +66,7 @@ Core/Src/%.o Core/Src/%.su: ../Core/Src/%.c Core/Src/subdir.mk
 clean: clean-Core-2f-Src
 
 clean-Core-2f-Src:
-	-$(RM) ./Core/Src/epd.d ./Core/Src/epd.o ./Core/Src/epd.su ./Core/Src/fat32.d ./Core/Src/fat32.o ./Core/Src/fat32.su ./Core/Src/it.d ./Core/Src/it.o ./Core/Src/it.su ./Core/Src/led.d ./Core/Src/led.o ./Core/Src/led.su ./Core/Src/logging.d ./Core/Src/logging.o ./Core/Src/logging.su ./Core/Src/main.d ./Core/Src/main.o ./Core/Src/main.su ./Core/Src/msp.d ./Core/Src/msp.o ./Core/Src/msp.su ./Core/Src/rtc_and_pwr.d ./Core/Src/rtc_and_pwr.o ./Core/Src/rtc_and_pwr.su ./Core/Src/sdcard.d ./Core/Src/sdcard.o ./Core/Src/sdcard.su ./Core/Src/syscalls.d ./Core/Src/syscalls.o ./Core/Src/syscalls.su ./Core/Src/sysmem.d ./Core/Src/sysmem.o ./Core/Src/sysmem.su ./Core/Src/system_stm32l4xx.d ./Core/Src/system_stm32l4xx.o ./Core/Src/system_stm32l4xx.su
+	-$(RM) ./Core/Src/epd.d ./Core/Src/epd.o ./Core/Src/epd.su ./Core/Src/exfat.d ./Core/Src/exfat.o ./Core/Src/exfat.su ./Core/Src/fat32.d ./Core/Src/fat32.o ./Core/Src/fat32.su ./Core/Src/it.d ./Core/Src/it.o ./Core/Src/it.su ./Core/Src/led.d ./Core/Src/led.o ./Core/Src/led.su ./Core/Src/logging.d ./Core/Src/logging.o ./Core/Src/logging.su ./Core/Src/main.d ./Core/Src/main.o ./Core/Src/main.su ./Core/Src/msp.d ./Core/Src/msp.o ./Core/Src/msp.su ./Core/Src/profiling.d ./Core/Src/profiling.o ./Core/Src/profiling.su ./Core/Src/readahead.d ./Core/Src/readahead.o ./Core/Src/readahead.su ./Core/Src/refresh_policy.d ./Core/Src/refresh_policy.o ./Core/Src/refresh_policy.su ./Core/Src/rtc_and_pwr.d ./Core/Src/rtc_and_pwr.o ./Core/Src/rtc_and_pwr.su ./Core/Src/sdcard.d ./Core/Src/sdcard.o ./Core/Src/sdcard.su ./Core/Src/syscalls.d ./Core/Src/syscalls.o ./Core/Src/syscalls.su ./Core/Src/sysmem.d ./Core/Src/sysmem.o ./Core/Src/sysmem.su ./Core/Src/system_stm32l4xx.d ./Core/Src/system_stm32l4xx.o ./Core/Src/system_stm32l4xx.su
 
 .PHONY: clean-Core-2f-Src
 
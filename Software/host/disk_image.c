@@ -0,0 +1,119 @@
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "disk_image.h"
+
+static Block_Device_Status Disk_Image_Read(void *ctx, const uint32_t lba,
+        const uint32_t count, uint8_t *restrict const buffer);
+static Block_Device_Status Disk_Image_Read_Async(void *ctx, const uint32_t lba,
+        const uint32_t count, uint8_t *restrict const buffer,
+        Block_Device_Read_Callback cb, void *cb_ctx);
+static uint32_t Disk_Image_Block_Count(void *ctx);
+
+int Disk_Image_Open(Disk_Image *const image, const char *const path) {
+    struct stat st;
+    void *data;
+
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    if ((fstat(fd, &st) != 0) || (st.st_size < SECTOR_SIZE)) {
+        close(fd);
+        return -1;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+
+    memset(image, 0, sizeof(*image));
+    image->data = data;
+    image->size = st.st_size;
+    image->dev.read_blocks = &Disk_Image_Read;
+    image->dev.read_blocks_async = &Disk_Image_Read_Async;
+    image->dev.wait_for_completion = NULL;
+    image->dev.get_block_count = &Disk_Image_Block_Count;
+    image->dev.hint_sequential_read = NULL;
+    image->dev.ctx = image;
+    return 0;
+}
+
+void Disk_Image_Close(Disk_Image *const image) {
+    munmap((void*) image->data, image->size);
+    image->data = NULL;
+    image->size = 0;
+}
+
+const Block_Device* Disk_Image_Get_Block_Device(const Disk_Image *const image) {
+    return &image->dev;
+}
+
+void Disk_Image_Reset_Stats(Disk_Image *const image) {
+    memset(&image->stats, 0, sizeof(image->stats));
+}
+
+/**
+ * Copy blocks out of the mapped disk image
+ *
+ * @param ctx       (IN)    Disk image to read from
+ * @param lba       (IN)    Address of the first block to read
+ * @param count     (IN)    Number of consecutive blocks to read
+ * @param buffer    (OUT)   Buffer to read the blocks into
+ *
+ * @return  Status of the read operation
+ */
+static Block_Device_Status Disk_Image_Read(void *ctx, const uint32_t lba,
+        const uint32_t count, uint8_t *restrict const buffer) {
+    Disk_Image *const image = ctx;
+
+    if (((uint64_t) lba + count) > Disk_Image_Block_Count(ctx)) {
+        return BLOCK_DEVICE_OUT_OF_RANGE;
+    }
+    memcpy(buffer, image->data + ((uint64_t) lba * SECTOR_SIZE),
+            (size_t) count * SECTOR_SIZE);
+
+    image->stats.read_calls++;
+    image->stats.blocks_read += count;
+    image->stats.bytes_read += (uint64_t) count * SECTOR_SIZE;
+    return BLOCK_DEVICE_OK;
+}
+
+/**
+ * Read blocks out of the mapped disk image. Data is already in memory, so the
+ * read finishes and the callback is called before returning
+ *
+ * @param ctx       (IN)    Disk image to read from
+ * @param lba       (IN)    Address of the first block to read
+ * @param count     (IN)    Number of consecutive blocks to read
+ * @param buffer    (OUT)   Buffer to read the blocks into
+ * @param cb        (IN)    Function to call when the read finishes
+ * @param cb_ctx    (IN)    Context pointer to pass to cb
+ *
+ * @return  Status of submitting the read operation
+ */
+static Block_Device_Status Disk_Image_Read_Async(void *ctx, const uint32_t lba,
+        const uint32_t count, uint8_t *restrict const buffer,
+        Block_Device_Read_Callback cb, void *cb_ctx) {
+    const Block_Device_Status ret = Disk_Image_Read(ctx, lba, count, buffer);
+    if (ret == BLOCK_DEVICE_OK) {
+        (*cb)(ret, cb_ctx);
+    }
+    return ret;
+}
+
+/**
+ * Get the number of whole blocks in the mapped disk image
+ *
+ * @param ctx   (IN)    Disk image to query
+ *
+ * @return  Number of blocks in the disk image
+ */
+static uint32_t Disk_Image_Block_Count(void *ctx) {
+    const Disk_Image *const image = ctx;
+    return (uint32_t) (image->size / SECTOR_SIZE);
+}
@@ -0,0 +1,59 @@
+#ifndef DISK_IMAGE_H_
+#define DISK_IMAGE_H_
+
+#include <stdint.h>
+#include "block_device.h"
+
+/**
+ * Counters for block reads served from a disk image
+ */
+typedef struct {
+	uint32_t read_calls;		// Number of read requests
+	uint32_t blocks_read;		// Number of blocks copied out of the image
+	uint64_t bytes_read;		// Number of bytes copied out of the image
+} Disk_Image_Stats;
+
+/**
+ * Disk image mapped into memory and exposed as a block device
+ */
+typedef struct {
+	Block_Device dev;
+	const uint8_t *data;
+	uint64_t size;
+	Disk_Image_Stats stats;
+} Disk_Image;
+
+/**
+ * Map a raw disk image (e.g. dd copy of an SD card) read-only into memory
+ *
+ * @param image	(OUT)	Disk image to initialize
+ * @param path	(IN)	Path of the disk image file
+ *
+ * @return	0 on success, -1 on failure with errno set
+ */
+int Disk_Image_Open(Disk_Image *const image, const char *const path);
+
+/**
+ * Unmap a disk image opened with Disk_Image_Open
+ *
+ * @param image	(IN)	Disk image to close
+ */
+void Disk_Image_Close(Disk_Image *const image);
+
+/**
+ * Get the block device interface for an opened disk image
+ *
+ * @param image	(IN)	Disk image opened with Disk_Image_Open
+ *
+ * @return	Block device reading from the disk image
+ */
+const Block_Device* Disk_Image_Get_Block_Device(const Disk_Image *const image);
+
+/**
+ * Reset the read counters of a disk image
+ *
+ * @param image	(IN)	Disk image to reset the counters for
+ */
+void Disk_Image_Reset_Stats(Disk_Image *const image);
+
+#endif /* DISK_IMAGE_H_ */
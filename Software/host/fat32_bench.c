@@ -0,0 +1,325 @@
+/*
+ * Measure the cost of reading images through the FAT32 module on a Linux host,
+ * using a raw disk image of an SD card instead of the hardware. Images are read
+ * the same way as on the device, starting with 0.bin, 1.bin and so on until a
+ * file is not found.
+ *
+ * Build from this directory with:
+ *   gcc -O2 -Wall -I. -I../Epaper_photo_frame/Core/Inc -o fat32_bench \
+ *       fat32_bench.c disk_image.c ../Epaper_photo_frame/Core/Src/fat32.c \
+ *       ../Epaper_photo_frame/Core/Src/exfat.c \
+ *       ../Epaper_photo_frame/Core/Src/readahead.c
+ *
+ * Usage:
+ *   ./fat32_bench [-r] [-l] [-e] [-s] [-d <dir>] <disk image> [max files]
+ *
+ * With -r, reads go through the read-ahead layer as on the device, and its
+ * hit/miss counters are printed at the end.
+ *
+ * With -l, each image is located before reading it, and read the way it is
+ * read after a wake from a location saved before sleeping, starting from the
+ * BPB of the partition instead of mounting the filesystem.
+ *
+ * With -d, images are read from the given directory, like "albums/summer",
+ * instead of the root directory.
+ *
+ * With -s, each image is also opened as a file handle, read sequentially and
+ * then read again in small pieces from the end towards the start with seeks,
+ * and the pieces are compared with the sequential data.
+ *
+ * With -e, the root directory is enumerated after mounting and one line is
+ * printed per file found in it.
+ *
+ * Volumes which FAT32 module does not mount are tried with exFAT module.
+ *
+ * One line is printed per image, so that the output can be compared between
+ * runs in CI.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "disk_image.h"
+#include "fat32.h"
+#include "exfat.h"
+#include "readahead.h"
+#include "main.h"
+
+// Same size as the data buffer used on the device
+static uint8_t data_buffer[8 * 1024];
+static uint64_t data_bytes;
+
+void Error_Handler(void) {
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * Count the file data handed out by the FAT32 module
+ */
+static DataProcessingStatus Count_Data_Callback(const uint32_t data_offset,
+        const uint8_t *restrict const data_buffer, const uint32_t data_size) {
+    (void) data_offset;
+    (void) data_buffer;
+    data_bytes += data_size;
+    return DATA_PROCESSING_OK;
+}
+
+/**
+ * Print a file found in the root directory
+ */
+static FAT32_Enumerate_Action Print_Dir_Entry_Callback(
+        const FAT32_Dir_Entry *restrict const entry, void *ctx) {
+    uint32_t *const count = ctx;
+
+    printf("entry name=%s attrs=0x%02x cluster=%u size=%u\n", entry->filename,
+            entry->attributes, entry->first_cluster, entry->file_size);
+    (*count)++;
+    return FAT32_ENUMERATE_CONTINUE;
+}
+
+/**
+ * Read a file sequentially through a file handle, then read it again backwards
+ * in small pieces with seeks and compare them with the sequential data
+ */
+static FAT32_Status Check_File_Seeks(const char *restrict const filename) {
+    static uint8_t piece[700];
+    FAT32_File file;
+    FAT32_Status ret;
+    uint8_t *data;
+    uint32_t bytes_read;
+    uint32_t offset;
+    uint32_t pieces = 0;
+
+    ret = FAT32_File_Open(filename, &file);
+    if (ret != FAT32_OK) {
+        return ret;
+    }
+    data = malloc(file.file_size + 1);
+    if (data == NULL) {
+        Error_Handler();
+    }
+    ret = FAT32_File_Read(&file, data, file.file_size + 1, &bytes_read);
+    if ((ret == FAT32_OK) && (bytes_read != file.file_size)) {
+        ret = FAT32_READ_FILE_ERR;
+    }
+
+    offset = file.file_size;
+    while ((ret == FAT32_OK) && (offset > 0)) {
+        offset = (offset > sizeof(piece)) ? (offset - sizeof(piece)) : 0;
+        ret = FAT32_File_Seek(&file, offset);
+        if (ret == FAT32_OK) {
+            ret = FAT32_File_Read(&file, piece, sizeof(piece), &bytes_read);
+        }
+        if ((ret == FAT32_OK) && (memcmp(piece, &data[offset], bytes_read)
+                != 0)) {
+            ret = FAT32_READ_FILE_ERR;
+        }
+        pieces++;
+    }
+    printf("seek file=%s size=%u pieces=%u checkpoints=%u interval=%u "
+            "status=%d\n", filename, file.file_size, pieces,
+            file.checkpoint_count, file.checkpoint_interval, ret);
+
+    FAT32_File_Close(&file);
+    free(data);
+    return ret;
+}
+
+static double Elapsed_Us(const struct timespec *const start,
+        const struct timespec *const end) {
+    return ((end->tv_sec - start->tv_sec) * 1e6)
+            + ((end->tv_nsec - start->tv_nsec) / 1e3);
+}
+
+int main(int argc, char **argv) {
+    Disk_Image image;
+    char filename[FAT32_PATH_MAX_LENGTH + FILENAME_MAX_LENGTH];
+    const char *dir = NULL;
+    struct timespec start, end;
+    FAT32_Status ret;
+    Readahead_Stats readahead_stats;
+    FAT32_Cache_Stats fat_cache_stats;
+    FAT32_Read_Stats fat_read_stats;
+    FAT32_Index_Stats fat_index_stats;
+    uint32_t max_files = UINT32_MAX;
+    FAT32_File_Location location;
+    EXFAT_Status exfat_ret;
+    EXFAT_Read_Stats exfat_read_stats;
+    int is_exfat = 0;
+    int use_readahead = 0;
+    int use_location = 0;
+    int enumerate = 0;
+    int check_seeks = 0;
+    uint32_t entries = 0;
+    uint32_t i;
+
+    while (argc > 1) {
+        if (strcmp(argv[1], "-r") == 0) {
+            use_readahead = 1;
+        } else if (strcmp(argv[1], "-l") == 0) {
+            use_location = 1;
+        } else if (strcmp(argv[1], "-e") == 0) {
+            enumerate = 1;
+        } else if (strcmp(argv[1], "-s") == 0) {
+            check_seeks = 1;
+        } else if ((strcmp(argv[1], "-d") == 0) && (argc > 2)) {
+            dir = argv[2];
+            argc--;
+            argv++;
+        } else {
+            break;
+        }
+        argc--;
+        argv++;
+    }
+    if ((argc < 2) || (argc > 3)) {
+        fprintf(stderr,
+                "Usage: %s [-r] [-l] [-e] [-s] [-d <dir>] <disk image> "
+                "[max files]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (argc == 3) {
+        max_files = strtoul(argv[2], NULL, 0);
+    }
+
+    if (Disk_Image_Open(&image, argv[1]) != 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", argv[1], strerror(errno));
+        return EXIT_FAILURE;
+    }
+    const Block_Device *dev = Disk_Image_Get_Block_Device(&image);
+    if (use_readahead) {
+        dev = Readahead_Init(dev);
+    }
+    printf("image=%s blocks=%u\n", argv[1], Block_Device_Get_Block_Count(dev));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = FAT32_Init(dev);
+    if (ret != FAT32_OK) {
+        exfat_ret = EXFAT_Init(dev);
+        if (exfat_ret != EXFAT_OK) {
+            fprintf(stderr, "FAT32 initialization failed: %d, exFAT "
+                    "initialization failed: %d\n", ret, exfat_ret);
+            Disk_Image_Close(&image);
+            return EXIT_FAILURE;
+        }
+        is_exfat = 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("init fs=%s reads=%u blocks=%u bytes=%llu time_us=%.1f\n",
+            is_exfat ? "exfat" : "fat32", image.stats.read_calls,
+            image.stats.blocks_read,
+            (unsigned long long) image.stats.bytes_read,
+            Elapsed_Us(&start, &end));
+
+    if (enumerate && !is_exfat) {
+        Disk_Image_Reset_Stats(&image);
+        ret = FAT32_Enumerate_Root_Dir(&Print_Dir_Entry_Callback, &entries);
+        if (ret != FAT32_OK) {
+            fprintf(stderr, "Enumerating root directory failed: %d\n", ret);
+            Disk_Image_Close(&image);
+            return EXIT_FAILURE;
+        }
+        printf("entries=%u reads=%u blocks=%u\n", entries,
+                image.stats.read_calls, image.stats.blocks_read);
+    }
+
+    for (i = 0; i < max_files; i++) {
+        if (dir != NULL) {
+            snprintf(filename, sizeof(filename), "%s/%u.bin", dir, i);
+        } else {
+            snprintf(filename, sizeof(filename), "%u.bin", i);
+        }
+        Disk_Image_Reset_Stats(&image);
+        data_bytes = 0;
+
+        if (is_exfat) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            exfat_ret = EXFAT_Read_File_From_Root_Dir_And_Process_Data(
+                    filename, data_buffer, sizeof(data_buffer),
+                    &Count_Data_Callback);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            if (exfat_ret == EXFAT_READ_FILE_NOT_FOUND) {
+                break;
+            }
+            if (exfat_ret != EXFAT_OK) {
+                fprintf(stderr, "Reading %s failed: %d\n", filename,
+                        exfat_ret);
+                Disk_Image_Close(&image);
+                return EXIT_FAILURE;
+            }
+            ret = FAT32_OK;
+        } else if (use_location) {
+            ret = FAT32_Locate_File_At_Path(filename, &location);
+            if (ret == FAT32_OK) {
+                Disk_Image_Reset_Stats(&image);
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                ret = FAT32_Init_From_Location(dev, &location);
+                if (ret == FAT32_OK) {
+                    ret = FAT32_Read_File_At_Location(&location, data_buffer,
+                            sizeof(data_buffer), &Count_Data_Callback);
+                }
+                clock_gettime(CLOCK_MONOTONIC, &end);
+            }
+        } else {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            ret = FAT32_Read_File_At_Path_And_Process_Data(filename,
+                    data_buffer, sizeof(data_buffer), &Count_Data_Callback);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+        }
+        if (ret == FAT32_READ_FILE_NOT_FOUND) {
+            break;
+        }
+        if (ret != FAT32_OK) {
+            fprintf(stderr, "Reading %s failed: %d\n", filename, ret);
+            Disk_Image_Close(&image);
+            return EXIT_FAILURE;
+        }
+
+        printf("file=%s data_bytes=%llu reads=%u blocks=%u bytes=%llu "
+                "time_us=%.1f\n", filename, (unsigned long long) data_bytes,
+                image.stats.read_calls, image.stats.blocks_read,
+                (unsigned long long) image.stats.bytes_read,
+                Elapsed_Us(&start, &end));
+
+        if (check_seeks && !is_exfat
+                && (Check_File_Seeks(filename) != FAT32_OK)) {
+            Disk_Image_Close(&image);
+            return EXIT_FAILURE;
+        }
+    }
+    printf("files=%u\n", i);
+
+    if (is_exfat) {
+        EXFAT_Get_Read_Stats(&exfat_read_stats);
+        printf("exfat files=%u contiguous_files=%u extents=%u fat_reads=%u\n",
+                exfat_read_stats.files, exfat_read_stats.contiguous_files,
+                exfat_read_stats.extents, exfat_read_stats.fat_reads);
+    }
+
+    FAT32_Get_Cache_Stats(&fat_cache_stats);
+    printf("fat_cache hits=%u misses=%u\n", fat_cache_stats.hits,
+            fat_cache_stats.misses);
+    FAT32_Get_Read_Stats(&fat_read_stats);
+    printf("fat32 files=%u contiguous_files=%u clusters=%u extents=%u\n",
+            fat_read_stats.files, fat_read_stats.contiguous_files,
+            fat_read_stats.clusters, fat_read_stats.extents);
+    FAT32_Get_Index_Stats(&fat_index_stats);
+    printf("fat32_index entries=%u hits=%u dir_scans=%u dir_cache_hits=%u "
+            "dir_cache_misses=%u\n", fat_index_stats.entries,
+            fat_index_stats.hits, fat_index_stats.dir_scans,
+            fat_index_stats.dir_cache_hits, fat_index_stats.dir_cache_misses);
+
+    if (use_readahead) {
+        Readahead_Flush();
+        Readahead_Get_Stats(&readahead_stats);
+        printf("readahead hits=%u misses=%u prefetched_blocks=%u "
+                "wasted_blocks=%u\n", readahead_stats.hits,
+                readahead_stats.misses, readahead_stats.prefetched_blocks,
+                readahead_stats.wasted_blocks);
+    }
+
+    Disk_Image_Close(&image);
+    return EXIT_SUCCESS;
+}